@@ -20,6 +20,35 @@ public class CodeGen {
   /// Tracks generated vtable instance names to avoid duplicate generation.
   /// Key format: `__koral_vtable_{TraitName}_for_{ConcreteType}`
   var generatedVtableInstances: Set<String> = []
+
+  // MARK: - String Literal Pool
+  /// One file-scope immortal StringStorage per distinct literal, keyed by its
+  /// UTF-8 bytes (String equality would merge canonically equivalent text).
+  /// Declarations are collected while function bodies are emitted and placed
+  /// in the shared header section, ahead of the first body.
+  private var stringLiteralPool: [[UInt8]: String] = [:]
+  private var stringLiteralDeclarations: String = ""
+
+  // MARK: - Program Sections
+  /// `generateProgram` fills these once; `generate` joins them into a single
+  /// C file and `generateUnits` spreads the definitions over several files
+  /// that share one header (declarations, literals, vtables).
+  private var declarationSection = ""
+  private var vtableSection = ""
+  /// Type copy/drop helpers; only their prototypes are in the header.
+  var typeHelperDefinitions = ""
+  private var globalDefinitions = ""
+  /// One entry per MIR function, including its nested lambda definitions.
+  var functionDefinitions: [String] = []
+  private var mainDefinition = ""
+  private var programGenerated = false
+
+  /// C sources for parallel compilation. Every unit includes `header`; the
+  /// first unit also defines the type helpers, globals and `main`.
+  public struct TranslationUnits {
+    public let header: String
+    public let units: [String]
+  }
   
   /// 用户定义的 main 函数的限定名（如 "hello_main"）
   /// 如果用户没有定义 main 函数，则为 nil
@@ -289,16 +318,61 @@ public class CodeGen {
   }
 
   public func generate() -> String {
-    buffer = """
+    generateProgramOnce()
+    return programHeader() + typeHelperDefinitions + globalDefinitions
+      + functionDefinitions.joined() + mainDefinition
+  }
+
+  /// Size in bytes of the generated C, summed over its sections so the
+  /// driver can choose a unit count without joining the whole program.
+  public func generatedSize() -> Int {
+    generateProgramOnce()
+    let sections = [
+      declarationSection, stringLiteralDeclarations, vtableSection,
+      typeHelperDefinitions, globalDefinitions, mainDefinition,
+    ]
+    let sectionSize = sections.reduce(0) { $0 + $1.utf8.count }
+    return functionDefinitions.reduce(sectionSize) { $0 + $1.utf8.count }
+  }
+
+  /// Split the program into at most `count` translation units of similar
+  /// size. Functions keep their emission order, so related instantiations
+  /// tend to share a unit.
+  public func generateUnits(count: Int, headerName: String) -> TranslationUnits {
+    generateProgramOnce()
+    let include = "#include \"\(headerName)\"\n\n"
+    let unitCount = max(1, count)
+    var units: [String] = []
+    var current = include + typeHelperDefinitions + globalDefinitions + mainDefinition
+    var currentSize = current.utf8.count
+    let totalSize = functionDefinitions.reduce(currentSize) { $0 + $1.utf8.count }
+    let targetSize = max(1, totalSize / unitCount)
+    for definition in functionDefinitions {
+      if currentSize >= targetSize && units.count < unitCount - 1 {
+        units.append(current)
+        current = include
+        currentSize = include.utf8.count
+      }
+      current += definition
+      currentSize += definition.utf8.count
+    }
+    units.append(current)
+    return TranslationUnits(header: programHeader(), units: units)
+  }
+
+  private func programHeader() -> String {
+    return """
       #include <stdatomic.h>
       #include <stdint.h>
       #include "koral_runtime.h"
 
-      """
+      """ + declarationSection + stringLiteralDeclarations + vtableSection
+  }
 
+  private func generateProgramOnce() {
+    guard !programGenerated else { return }
+    programGenerated = true
     generateProgram()
-    
-    return buffer
   }
 
   private func collectTypeDeclarations(_ nodes: [MIRGlobal]) -> [TypeDeclaration] {
@@ -547,13 +621,18 @@ public class CodeGen {
       if case .globalVariable(let identifier, let initializerFunction, _) = global {
         let cType = cTypeName(identifier.type)
         let cName = cIdentifier(for: identifier)
-        buffer += "\(cType) \(cName);\n"
+        buffer += "extern \(cType) \(cName);\n"
+        globalDefinitions += "\(cType) \(cName);\n"
         globalInitializations.append((cName, initializerFunction))
       }
     }
     buffer += "\n"
+    declarationSection = buffer
+    buffer = ""
 
     processVtableRequests()
+    vtableSection = buffer
+    buffer = ""
 
     for function in mirProgram.functions {
       generateMIRGlobalFunction(function.identifier, function.parameters, function)
@@ -562,6 +641,8 @@ public class CodeGen {
     if !globalInitializations.isEmpty || userMainFunctionName != nil {
       generateCMainFunction()
     }
+    mainDefinition = buffer
+    buffer = ""
   }
 
   /// 生成 C 的 main 函数入口
@@ -813,17 +894,20 @@ public class CodeGen {
     }
   }
 
+  /// Literals are immortal: the storage is a file-scope constant with a NULL
+  /// control block, which retain/release skip and `is_unique` reports as
+  /// shared, so evaluating a literal copies two words and never allocates.
   func generateStringLiteral(_ value: String, type: Type) -> String {
-    let bytesVar = nextTemp() + "_bytes"
-    let storageVar = nextTemp() + "_storage"
+    let cType = cTypeName(type)
+    let storageVar = stringLiteralStorage(value, type: type)
+    return nextTempWithInit(cType: cType, initExpr: "(\(cType)){ (struct __koral_Ref){ (void*)&\(storageVar), NULL } }")
+  }
+
+  private func stringLiteralStorage(_ value: String, type: Type) -> String {
     let utf8Bytes = Array(value.utf8)
-    var byteLiterals = utf8Bytes.map { String(format: "0x%02X", $0) }.joined(separator: ", ")
-    if !byteLiterals.isEmpty {
-      byteLiterals += ", "
+    if let existing = stringLiteralPool[utf8Bytes] {
+      return existing
     }
-    byteLiterals += "0x00"
-    addIndent()
-    buffer += "static const uint8_t \(bytesVar)[] = { \(byteLiterals) };\n"
 
     guard case .structure(let stringDefId) = type,
           let stringMembers = context.getStructMembers(stringDefId),
@@ -839,11 +923,17 @@ public class CodeGen {
       fatalError("String literal requires String.storage: ref StringStorage")
     }
     let storageCType = cTypeName(storageType)
-    addIndent()
-    buffer += "static const \(storageCType) \(storageVar) = { (uint8_t*)\(bytesVar), \(utf8Bytes.count), \(utf8Bytes.count + 1) };\n"
 
-    let cType = cTypeName(type)
-    return nextTempWithInit(cType: cType, initExpr: "(\(cType)){ (struct __koral_Ref){ (void*)&\(storageVar), NULL } }")
+    let storageVar = "__koral_str_\(stringLiteralPool.count)"
+    var byteLiterals = utf8Bytes.map { String(format: "0x%02X", $0) }.joined(separator: ", ")
+    if !byteLiterals.isEmpty {
+      byteLiterals += ", "
+    }
+    byteLiterals += "0x00"
+    stringLiteralDeclarations += "static const uint8_t \(storageVar)_bytes[] = { \(byteLiterals) };\n"
+    stringLiteralDeclarations += "static const \(storageCType) \(storageVar) = { (uint8_t*)\(storageVar)_bytes, \(utf8Bytes.count), \(utf8Bytes.count + 1) };\n"
+    stringLiteralPool[utf8Bytes] = storageVar
+    return storageVar
   }
 
   // MARK: - Unified Copy/Move Helpers
@@ -1856,15 +1856,13 @@ final class MIRFunctionCodeEmitter {
     let pointeeType = resolver.type(of: place) ?? .void
     let pointeeCType = codeGen.cTypeName(pointeeType)
     let result = codeGen.nextTempWithDecl(cType: codeGen.cTypeName(resultType))
-    // Merged layout: allocate control block + payload in one malloc
+    // Merged layout: allocate control block + payload in one box allocation
     codeGen.addIndent()
-    codeGen.appendToBuffer("\(result).control = malloc(sizeof(struct __koral_Control) + sizeof(\(pointeeCType)));\n")
+    codeGen.appendToBuffer("\(result).control = __koral_box_alloc(sizeof(struct __koral_Control) + sizeof(\(pointeeCType)));\n")
     codeGen.addIndent()
     codeGen.appendToBuffer("\(result).ptr = (char*)\(result).control + sizeof(struct __koral_Control);\n")
     codeGen.addIndent()
-    codeGen.appendToBuffer("((struct __koral_Control*)\(result).control)->strong_count = 1;\n")
-    codeGen.addIndent()
-    codeGen.appendToBuffer("((struct __koral_Control*)\(result).control)->weak_count = 1;\n")
+    codeGen.appendToBuffer("__koral_control_init(\(result).control);\n")
     codeGen.addIndent()
     codeGen.appendToBuffer("((struct __koral_Control*)\(result).control)->ptr = \(result).ptr;\n")
     let shouldTransferOwnership = allocation == .heapOwnedMove
@@ -1984,7 +1982,7 @@ final class MIRFunctionCodeEmitter {
       codeGen.appendToBuffer("if (\(control)) {\n")
       codeGen.withIndent {
         codeGen.addIndent()
-        codeGen.appendToBuffer("\(result) = (atomic_load(&((struct __koral_Control*)\(control))->strong_count) == 1);\n")
+        codeGen.appendToBuffer("\(result) = __koral_control_is_unique(\(control));\n")
       }
       codeGen.addIndent()
       codeGen.appendToBuffer("}\n")
@@ -2022,7 +2020,7 @@ final class MIRFunctionCodeEmitter {
       codeGen.appendToBuffer("if (\(control)) {\n")
       codeGen.withIndent {
         codeGen.addIndent()
-        codeGen.appendToBuffer("\(result) = (\(codeGen.cTypeName(.uint)))atomic_load(&((struct __koral_Control*)\(control))->strong_count);\n")
+        codeGen.appendToBuffer("\(result) = (\(codeGen.cTypeName(.uint)))__koral_control_strong_count(\(control));\n")
       }
       codeGen.addIndent()
       codeGen.appendToBuffer("}\n")
@@ -2609,6 +2607,6 @@ extension CodeGen {
     let functionCode = buffer
     buffer = savedBuffer
 
-    buffer += functionCode
+    functionDefinitions.append(functionCode)
   }
 }
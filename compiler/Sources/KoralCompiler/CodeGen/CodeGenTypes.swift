@@ -29,39 +29,41 @@ extension CodeGen {
     }
     appendToBuffer("};\n\n")
 
-    // Generate copy function
-    appendToBuffer("struct \(name) __koral_\(name)_copy(const struct \(name) *self) {\n")
-    withIndent {
-      appendToBuffer("    struct \(name) result;\n")
-      for param in parameters {
-        let fieldName = sanitizeCIdentifier(context.getName(param.defId) ?? "<unknown>")
-        appendCopyAssignment(
-          for: param.type,
-          source: "self->\(fieldName)",
-          dest: "result.\(fieldName)"
-        )
+    emitTypeHelpers(name: name) {
+      // Generate copy function
+      appendToBuffer("struct \(name) __koral_\(name)_copy(const struct \(name) *self) {\n")
+      withIndent {
+        appendToBuffer("    struct \(name) result;\n")
+        for param in parameters {
+          let fieldName = sanitizeCIdentifier(context.getName(param.defId) ?? "<unknown>")
+          appendCopyAssignment(
+            for: param.type,
+            source: "self->\(fieldName)",
+            dest: "result.\(fieldName)"
+          )
+        }
+        appendToBuffer("    return result;\n")
       }
-      appendToBuffer("    return result;\n")
-    }
-    appendToBuffer("}\n\n")
+      appendToBuffer("}\n\n")
 
-    // Generate drop function
-    appendToBuffer("void __koral_\(name)_drop(struct \(name)* self) {\n")
-    withIndent {
-      // Call user defined drop if exists
-      if let userDrop = getUserDefinedDrop(for: name) {
-          appendToBuffer("    {\n")
-          appendToBuffer("        void \(userDrop)(struct \(name)*);\n")
-          appendToBuffer("        \(userDrop)(self);\n")
-          appendToBuffer("    }\n")
-      }
+      // Generate drop function
+      appendToBuffer("void __koral_\(name)_drop(struct \(name)* self) {\n")
+      withIndent {
+        // Call user defined drop if exists
+        if let userDrop = getUserDefinedDrop(for: name) {
+            appendToBuffer("    {\n")
+            appendToBuffer("        void \(userDrop)(struct \(name)*);\n")
+            appendToBuffer("        \(userDrop)(self);\n")
+            appendToBuffer("    }\n")
+        }
 
-      for param in parameters {
-        let fieldName = sanitizeCIdentifier(context.getName(param.defId) ?? "<unknown>")
-        appendDropStatement(for: param.type, value: "self->\(fieldName)")
+        for param in parameters {
+          let fieldName = sanitizeCIdentifier(context.getName(param.defId) ?? "<unknown>")
+          appendDropStatement(for: param.type, value: "self->\(fieldName)")
+        }
       }
+      appendToBuffer("}\n\n")
     }
-    appendToBuffer("}\n\n")
   }
 
   /// Generate enum type declaration with copy and drop functions
@@ -112,69 +114,84 @@ extension CodeGen {
     }
     appendToBuffer("};\n\n")
 
-    // Generate Copy
-    appendToBuffer("struct \(name) __koral_\(name)_copy(const struct \(name) *self) {\n")
-    withIndent {
-        appendToBuffer("    struct \(name) result;\n")
-        appendToBuffer("    result.tag = self->tag;\n")
-        appendToBuffer("    switch (self->tag) {\n")
-        for (index, c) in cases.enumerated() {
-             let caseName = sanitizeCIdentifier(c.name)
-             appendToBuffer("    case \(index): // \(c.name)\n")
-             // Filter out Void type parameters
-             let nonVoidParams = c.parameters.filter { param in
-                 if case .void = param.type { return false }
-                 return true
-             }
-             if !nonVoidParams.isEmpty {
-                 for param in nonVoidParams {
-                     let fieldName = sanitizeCIdentifier(param.name)
-                     let fieldPath = "self->data.\(caseName).\(fieldName)"
-                     let resultPath = "result.data.\(caseName).\(fieldName)"
-                     appendCopyAssignment(
-                       for: param.type,
-                       source: fieldPath,
-                       dest: resultPath
-                     )
-                 }
-             }
-             appendToBuffer("        break;\n")
-        }
-        appendToBuffer("    }\n")
-        appendToBuffer("    return result;\n")
-    }
-    appendToBuffer("}\n\n")
+    emitTypeHelpers(name: name) {
+      // Generate Copy
+      appendToBuffer("struct \(name) __koral_\(name)_copy(const struct \(name) *self) {\n")
+      withIndent {
+          appendToBuffer("    struct \(name) result;\n")
+          appendToBuffer("    result.tag = self->tag;\n")
+          appendToBuffer("    switch (self->tag) {\n")
+          for (index, c) in cases.enumerated() {
+               let caseName = sanitizeCIdentifier(c.name)
+               appendToBuffer("    case \(index): // \(c.name)\n")
+               // Filter out Void type parameters
+               let nonVoidParams = c.parameters.filter { param in
+                   if case .void = param.type { return false }
+                   return true
+               }
+               if !nonVoidParams.isEmpty {
+                   for param in nonVoidParams {
+                       let fieldName = sanitizeCIdentifier(param.name)
+                       let fieldPath = "self->data.\(caseName).\(fieldName)"
+                       let resultPath = "result.data.\(caseName).\(fieldName)"
+                       appendCopyAssignment(
+                         for: param.type,
+                         source: fieldPath,
+                         dest: resultPath
+                       )
+                   }
+               }
+               appendToBuffer("        break;\n")
+          }
+          appendToBuffer("    }\n")
+          appendToBuffer("    return result;\n")
+      }
+      appendToBuffer("}\n\n")
 
-    // Generate Drop
-    appendToBuffer("void __koral_\(name)_drop(struct \(name)* self) {\n")
-    withIndent {
-        // Call user defined drop if exists
-        if let userDrop = getUserDefinedDrop(for: name) {
-            appendToBuffer("    {\n")
-          appendToBuffer("        void \(userDrop)(struct \(name)*);\n")
-            appendToBuffer("        \(userDrop)(self);\n")
-            appendToBuffer("    }\n")
-        }
+      // Generate Drop
+      appendToBuffer("void __koral_\(name)_drop(struct \(name)* self) {\n")
+      withIndent {
+          // Call user defined drop if exists
+          if let userDrop = getUserDefinedDrop(for: name) {
+              appendToBuffer("    {\n")
+            appendToBuffer("        void \(userDrop)(struct \(name)*);\n")
+              appendToBuffer("        \(userDrop)(self);\n")
+              appendToBuffer("    }\n")
+          }
 
-        appendToBuffer("    switch (self->tag) {\n")
-        for (index, c) in cases.enumerated() {
-             let caseName = sanitizeCIdentifier(c.name)
-             appendToBuffer("    case \(index): // \(c.name)\n")
-             // Filter out Void type parameters
-             let nonVoidParams = c.parameters.filter { param in
-                 if case .void = param.type { return false }
-                 return true
-             }
-             for param in nonVoidParams {
-               let fieldName = sanitizeCIdentifier(param.name)
-               let fieldPath = "self->data.\(caseName).\(fieldName)"
-               appendDropStatement(for: param.type, value: fieldPath)
-             }
-             appendToBuffer("        break;\n")
-        }
-        appendToBuffer("    }\n")
+          appendToBuffer("    switch (self->tag) {\n")
+          for (index, c) in cases.enumerated() {
+               let caseName = sanitizeCIdentifier(c.name)
+               appendToBuffer("    case \(index): // \(c.name)\n")
+               // Filter out Void type parameters
+               let nonVoidParams = c.parameters.filter { param in
+                   if case .void = param.type { return false }
+                   return true
+               }
+               for param in nonVoidParams {
+                 let fieldName = sanitizeCIdentifier(param.name)
+                 let fieldPath = "self->data.\(caseName).\(fieldName)"
+                 appendDropStatement(for: param.type, value: fieldPath)
+               }
+               appendToBuffer("        break;\n")
+          }
+          appendToBuffer("    }\n")
+      }
+      appendToBuffer("}\n\n")
     }
-    appendToBuffer("}\n\n")
+  }
+
+  /// Emits the copy/drop prototypes inline and moves the definitions written
+  /// by `body` to `typeHelperDefinitions`, so the type section can be shared
+  /// by every translation unit while the helpers are defined once.
+  private func emitTypeHelpers(name: String, _ body: () -> Void) {
+    appendToBuffer("struct \(name) __koral_\(name)_copy(const struct \(name) *self);\n")
+    appendToBuffer("void __koral_\(name)_drop(struct \(name)* self);\n\n")
+    let savedBuffer = buffer
+    buffer = ""
+    body()
+    typeHelperDefinitions += buffer
+    buffer = savedBuffer
   }
 
   /// Generate foreign struct declaration without copy/drop
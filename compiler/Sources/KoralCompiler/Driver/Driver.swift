@@ -19,6 +19,101 @@ public class Driver {
     var stdConfigPath: String?
     var outputDir: String?
     var noStd = false
+    var profileName: String?
+    var optLevel: String?
+    var targetCPU: String?
+    var lto: Bool?
+    var pgoGenerateDir: String?
+    var pgoUsePath: String?
+    var codegenUnits: Int?
+    var biasedRC = false
+  }
+
+  /// Flags for the clang invocation that builds the executable. The built-in
+  /// `dev` profile keeps -O1; `release` raises it to -O3. A manifest profile
+  /// of the same name overrides the built-in, and CLI flags override both.
+  private struct NativeBuildSettings {
+    var optLevel = "1"
+    var targetCPU: String?
+    var lto = false
+    /// Instrument for profiling; raw profiles are written to this directory.
+    var pgoGenerateDir: String?
+    /// Optimize with a merged `.profdata` file.
+    var pgoUsePath: String?
+    /// Number of C translation units; nil picks one from the program size.
+    var codegenUnits: Int?
+    /// Build the program and runtime with biased reference counting.
+    var biasedRC = false
+
+    static func builtin(_ profileName: String) -> NativeBuildSettings? {
+      switch profileName {
+      case "dev":
+        return NativeBuildSettings()
+      case "release":
+        return NativeBuildSettings(optLevel: "3")
+      default:
+        return nil
+      }
+    }
+
+    mutating func apply(_ profile: PackageBuildProfile) {
+      if let optLevel = profile.optLevel {
+        self.optLevel = optLevel
+      }
+      if let targetCPU = profile.targetCPU {
+        self.targetCPU = targetCPU
+      }
+      if let lto = profile.lto {
+        self.lto = lto
+      }
+      if let codegenUnits = profile.codegenUnits {
+        self.codegenUnits = codegenUnits
+      }
+    }
+
+    /// Splitting the C output lets clang compile it in parallel but hides
+    /// callees in other units from the inliner. Optimized builds therefore
+    /// stay in one unit unless LTO restores cross-unit inlining; other builds
+    /// use one unit per 512 KiB of C, up to the number of cores.
+    func resolvedCodegenUnits(sourceSize: Int) -> Int {
+      if let codegenUnits {
+        return codegenUnits
+      }
+      if (optLevel == "2" || optLevel == "3") && !lto {
+        return 1
+      }
+      let cores = ProcessInfo.processInfo.activeProcessorCount
+      return max(1, min(cores, sourceSize / (512 * 1024)))
+    }
+
+    var clangFlags: [String] {
+      var flags = ["-O\(optLevel)"]
+      if optLevel == "2" || optLevel == "3" {
+        // Lets clang inline and specialize across exported runtime symbols.
+        flags.append("-fno-semantic-interposition")
+      }
+      if let targetCPU {
+        flags.append("-march=\(targetCPU)")
+      }
+      if lto {
+        flags.append("-flto")
+        #if os(Windows)
+        flags.append("-fuse-ld=lld")
+        #endif
+      }
+      if let pgoGenerateDir {
+        flags.append("-fprofile-instr-generate=\(pgoGenerateDir)/koral-%p.profraw")
+      }
+      if let pgoUsePath {
+        flags.append("-fprofile-instr-use=\(pgoUsePath)")
+      }
+      if biasedRC {
+        // Changes the control block layout, so it applies to every unit
+        // and to the runtime object alike.
+        flags.append("-DKORAL_RC_BIASED=1")
+      }
+      return flags
+    }
   }
   
   public init() {}
@@ -137,6 +232,69 @@ public class Driver {
       } else if arg == "--no-std" {
         options.noStd = true
         i += 1
+      } else if arg == "--profile" {
+        if i + 1 < remainingArgs.count {
+          options.profileName = remainingArgs[i + 1]
+          i += 2
+        } else {
+          writeStderr("Error: Missing name for --profile option")
+          exit(1)
+        }
+      } else if arg == "--opt-level" {
+        if i + 1 < remainingArgs.count {
+          let level = remainingArgs[i + 1]
+          guard validOptLevels.contains(level) else {
+            writeStderr("Error: Invalid --opt-level '\(level)' (expected 0, 1, 2, 3, s or z)")
+            exit(1)
+          }
+          options.optLevel = level
+          i += 2
+        } else {
+          writeStderr("Error: Missing value for --opt-level option")
+          exit(1)
+        }
+      } else if arg == "--target-cpu" {
+        if i + 1 < remainingArgs.count {
+          options.targetCPU = remainingArgs[i + 1]
+          i += 2
+        } else {
+          writeStderr("Error: Missing value for --target-cpu option")
+          exit(1)
+        }
+      } else if arg == "--lto" {
+        options.lto = true
+        i += 1
+      } else if arg == "--biased-rc" {
+        options.biasedRC = true
+        i += 1
+      } else if arg == "--codegen-units" {
+        if i + 1 < remainingArgs.count {
+          guard let units = Int(remainingArgs[i + 1]), units > 0 else {
+            writeStderr("Error: Invalid --codegen-units '\(remainingArgs[i + 1])' (expected a positive integer)")
+            exit(1)
+          }
+          options.codegenUnits = units
+          i += 2
+        } else {
+          writeStderr("Error: Missing value for --codegen-units option")
+          exit(1)
+        }
+      } else if arg == "--pgo-generate" {
+        if i + 1 < remainingArgs.count {
+          options.pgoGenerateDir = remainingArgs[i + 1]
+          i += 2
+        } else {
+          writeStderr("Error: Missing directory for --pgo-generate option")
+          exit(1)
+        }
+      } else if arg == "--pgo-use" {
+        if i + 1 < remainingArgs.count {
+          options.pgoUsePath = remainingArgs[i + 1]
+          i += 2
+        } else {
+          writeStderr("Error: Missing path for --pgo-use option")
+          exit(1)
+        }
       } else if arg.hasPrefix("-") {
         writeStderr("Error: Unknown argument: \(arg)")
         printUsage()
@@ -163,6 +321,10 @@ public class Driver {
       printUsage()
       exit(1)
     }
+    if options.pgoGenerateDir != nil && options.pgoUsePath != nil {
+      writeStderr("Error: Cannot combine --pgo-generate with --pgo-use")
+      exit(1)
+    }
 
     do {
       try process(mode: mode, options: options)
@@ -331,6 +493,51 @@ public class Driver {
     )
   }
 
+  private func resolveBuildSettings(
+    options: InvocationOptions,
+    manifest: PackageManifest?
+  ) throws -> NativeBuildSettings {
+    let name = options.profileName ?? "dev"
+    let manifestProfile = manifest?.profiles[name]
+    var settings: NativeBuildSettings
+    if let builtin = NativeBuildSettings.builtin(name) {
+      settings = builtin
+    } else if manifestProfile != nil {
+      settings = NativeBuildSettings()
+    } else {
+      throw NSError(
+        domain: "Driver",
+        code: 1,
+        userInfo: [NSLocalizedDescriptionKey: "Unknown build profile '\(name)'"]
+      )
+    }
+    if let manifestProfile {
+      settings.apply(manifestProfile)
+    }
+    settings.apply(PackageBuildProfile(
+      optLevel: options.optLevel,
+      targetCPU: options.targetCPU,
+      lto: options.lto,
+      codegenUnits: options.codegenUnits
+    ))
+    if let pgoGenerateDir = options.pgoGenerateDir {
+      settings.pgoGenerateDir = URL(fileURLWithPath: pgoGenerateDir).standardized.path
+    }
+    if let pgoUsePath = options.pgoUsePath {
+      let profileURL = URL(fileURLWithPath: pgoUsePath).standardized
+      guard FileManager.default.fileExists(atPath: profileURL.path) else {
+        throw NSError(
+          domain: "Driver",
+          code: 1,
+          userInfo: [NSLocalizedDescriptionKey: "Profile data not found: \(profileURL.path)"]
+        )
+      }
+      settings.pgoUsePath = profileURL.path
+    }
+    settings.biasedRC = options.biasedRC
+    return settings
+  }
+
   private func process(mode: DriverCommand, options: InvocationOptions) throws {
     if let packageConfigPath = options.packageConfigPath {
       try processPackage(
@@ -340,7 +547,8 @@ public class Driver {
         outputDir: options.outputDir,
         noStd: options.noStd,
         depsRoot: options.depsRoot,
-        stdConfigPath: options.stdConfigPath
+        stdConfigPath: options.stdConfigPath,
+        buildOptions: options
       )
       return
     }
@@ -358,7 +566,8 @@ public class Driver {
       mode: mode,
       outputDir: options.outputDir,
       noStd: options.noStd,
-      stdConfigPath: options.stdConfigPath
+      stdConfigPath: options.stdConfigPath,
+      buildSettings: try resolveBuildSettings(options: options, manifest: nil)
     )
   }
 
@@ -426,10 +635,12 @@ public class Driver {
     outputDir: String?,
     noStd: Bool,
     depsRoot: String?,
-    stdConfigPath: String?
+    stdConfigPath: String?,
+    buildOptions: InvocationOptions
   ) throws {
     let packageConfigURL = URL(fileURLWithPath: packageConfigPath).standardized
     let manifest = try loadPackageManifest(at: packageConfigURL.path)
+    let buildSettings = try resolveBuildSettings(options: buildOptions, manifest: manifest)
     guard let resolvedTargetModuleName = targetModuleName ?? defaultTargetModuleName(in: manifest) else {
       throw PackageManifestError.missingTargetModule("<unspecified>")
     }
@@ -546,7 +757,8 @@ public class Driver {
       allGlobalNodes: allGlobalNodes,
       nodeSourceInfoList: nodeSourceInfoList,
       importGraph: mergedImportGraph,
-      extraLinkedLibraries: extraLinkedLibraries
+      extraLinkedLibraries: extraLinkedLibraries,
+      buildSettings: buildSettings
     )
   }
 
@@ -555,7 +767,8 @@ public class Driver {
     mode: DriverCommand,
     outputDir: String?,
     noStd: Bool,
-    stdConfigPath: String?
+    stdConfigPath: String?,
+    buildSettings: NativeBuildSettings
   ) throws {
     let entryURL = URL(fileURLWithPath: entryFilePath).standardized
     let resolver = initializeModuleResolver()
@@ -614,7 +827,8 @@ public class Driver {
       allGlobalNodes: allGlobalNodes,
       nodeSourceInfoList: nodeSourceInfoList,
       importGraph: mergedImportGraph,
-      extraLinkedLibraries: extraLinkedLibraries
+      extraLinkedLibraries: extraLinkedLibraries,
+      buildSettings: buildSettings
     )
   }
 
@@ -628,7 +842,8 @@ public class Driver {
     allGlobalNodes: [GlobalNode],
     nodeSourceInfoList: [GlobalNodeSourceInfo],
     importGraph: ImportGraph,
-    extraLinkedLibraries: [String]
+    extraLinkedLibraries: [String],
+    buildSettings: NativeBuildSettings
   ) throws {
     let fileManager = FileManager.default
     let combinedAST: ASTNode = .program(globalNodes: allGlobalNodes)
@@ -704,35 +919,46 @@ public class Driver {
       mirProgram: mirProgram,
       context: monomorphizer.context
     )
-    let cSource = codeGen.generate()
+    let cSize = codeGen.generatedSize()
     profilePhase("\(phasePrefix): codegen", start: codegenStart)
 
     if !fileManager.fileExists(atPath: outputDirectory.path) {
       try fileManager.createDirectory(at: outputDirectory, withIntermediateDirectories: true, attributes: nil)
     }
 
-    let cFileURL: URL
-    var temporaryCFileURL: URL?
     if mode == .emitC {
-      cFileURL = outputDirectory.appendingPathComponent("\(baseName).c")
-    } else {
-      let tempFileName = "koralc_\(baseName)_\(UUID().uuidString).c"
-      let tempFileURL = fileManager.temporaryDirectory.appendingPathComponent(tempFileName)
-      cFileURL = tempFileURL
-      temporaryCFileURL = tempFileURL
+      let cFileURL = outputDirectory.appendingPathComponent("\(baseName).c")
+      try codeGen.generate().write(to: cFileURL, atomically: true, encoding: .utf8)
+      debugPhase("emit-c: done")
+      profilePhase("emit-c: total", start: totalStart)
+      return
     }
-    try cSource.write(to: cFileURL, atomically: true, encoding: .utf8)
 
+    // Build and run compile from a scratch directory: one C file, or a
+    // shared header plus several units compiled in parallel.
+    let workURL = fileManager.temporaryDirectory
+      .appendingPathComponent("koralc_\(baseName)_\(UUID().uuidString)")
+    try fileManager.createDirectory(at: workURL, withIntermediateDirectories: true, attributes: nil)
     defer {
-      if let temporaryCFileURL {
-        try? fileManager.removeItem(at: temporaryCFileURL)
-      }
+      try? fileManager.removeItem(at: workURL)
     }
 
-    if mode == .emitC {
-      debugPhase("emit-c: done")
-      profilePhase("emit-c: total", start: totalStart)
-      return
+    let unitCount = buildSettings.resolvedCodegenUnits(sourceSize: cSize)
+    var unitSources: [String]
+    if unitCount > 1 {
+      let headerName = "\(baseName).h"
+      let split = codeGen.generateUnits(count: unitCount, headerName: headerName)
+      try split.header.write(to: workURL.appendingPathComponent(headerName), atomically: true, encoding: .utf8)
+      unitSources = split.units
+    } else {
+      unitSources = [codeGen.generate()]
+    }
+    var unitURLs: [URL] = []
+    for (index, unitSource) in unitSources.enumerated() {
+      let name = unitSources.count == 1 ? "\(baseName).c" : "\(baseName)_\(index).c"
+      let unitURL = workURL.appendingPathComponent(name)
+      try unitSource.write(to: unitURL, atomically: true, encoding: .utf8)
+      unitURLs.append(unitURL)
     }
 
     #if os(Windows)
@@ -741,11 +967,40 @@ public class Driver {
     let exeURL = outputDirectory.appendingPathComponent(baseName)
     #endif
 
-    var clangArgs = [cFileURL.path]
-    if let stdPath = getStdLibPath() {
+    let clangPath = findExecutable("clang") ?? "/usr/bin/clang"
+    var sysrootArgs: [String] = []
+    #if os(macOS)
+    if let sdkPath = getSDKPath() {
+      sysrootArgs = ["-isysroot", sdkPath]
+    }
+    #endif
+
+    let stdPath = getStdLibPath()
+    var clangArgs = unitURLs.map(\.path)
+    if unitURLs.count > 1 {
+      let unitsStart = DispatchTime.now()
+      let objectURLs = try compileUnits(
+        unitURLs,
+        clangPath: clangPath,
+        includePath: stdPath,
+        compileArgs: ["-Wno-everything"] + buildSettings.clangFlags + sysrootArgs
+      )
+      profilePhase("\(phasePrefix): clang units (\(unitURLs.count))", start: unitsStart)
+      clangArgs = objectURLs.map(\.path)
+    }
+    if let stdPath {
       let runtimeURL = URL(fileURLWithPath: stdPath).appendingPathComponent("koral_runtime.c")
       if FileManager.default.fileExists(atPath: runtimeURL.path) {
-        clangArgs.append(runtimeURL.path)
+        let runtimeStart = DispatchTime.now()
+        let runtimeObject = cachedRuntimeObject(
+          runtimeURL: runtimeURL,
+          stdPath: stdPath,
+          clangPath: clangPath,
+          buildSettings: buildSettings,
+          extraArgs: sysrootArgs
+        )
+        profilePhase("\(phasePrefix): runtime", start: runtimeStart)
+        clangArgs.append((runtimeObject ?? runtimeURL).path)
       }
       clangArgs.append(contentsOf: ["-I", stdPath])
     }
@@ -753,7 +1008,7 @@ public class Driver {
     clangArgs.append("-o")
     clangArgs.append(exeURL.path)
     clangArgs.append("-Wno-everything")
-    clangArgs.append("-O1")
+    clangArgs.append(contentsOf: buildSettings.clangFlags)
 
     let linkedLibraries = Array(NSOrderedSet(array: extraLinkedLibraries)) as? [String] ?? extraLinkedLibraries
     for lib in linkedLibraries {
@@ -773,15 +1028,10 @@ public class Driver {
     }
     #endif
 
-    #if os(macOS)
-    if let sdkPath = getSDKPath() {
-      clangArgs.append(contentsOf: ["-isysroot", sdkPath])
-    }
-    #endif
+    clangArgs.append(contentsOf: sysrootArgs)
 
     debugPhase("\(phasePrefix): clang")
     let clangStart = DispatchTime.now()
-    let clangPath = findExecutable("clang") ?? "/usr/bin/clang"
     let clangResult = try runSubprocess(executable: clangPath, args: clangArgs)
     profilePhase("\(phasePrefix): clang", start: clangStart)
     if clangResult != 0 {
@@ -809,6 +1059,139 @@ public class Driver {
     }
   }
 
+  /// Compile each unit to an object next to it, running the clang processes
+  /// concurrently. Throws if any unit fails to compile.
+  private func compileUnits(
+    _ unitURLs: [URL],
+    clangPath: String,
+    includePath: String?,
+    compileArgs: [String]
+  ) throws -> [URL] {
+    let objectURLs = unitURLs.map { $0.deletingPathExtension().appendingPathExtension("o") }
+    var statuses = [Int32](repeating: -1, count: unitURLs.count)
+    let lock = NSLock()
+    DispatchQueue.concurrentPerform(iterations: unitURLs.count) { index in
+      var args = ["-c", unitURLs[index].path, "-o", objectURLs[index].path]
+      if let includePath {
+        args.append(contentsOf: ["-I", includePath])
+      }
+      args.append(contentsOf: compileArgs)
+      let status = (try? runSubprocess(executable: clangPath, args: args)) ?? -1
+      lock.lock()
+      statuses[index] = status
+      lock.unlock()
+    }
+    if let failed = statuses.firstIndex(where: { $0 != 0 }) {
+      throw NSError(
+        domain: "Driver",
+        code: 1,
+        userInfo: [NSLocalizedDescriptionKey: "Clang compilation failed for \(unitURLs[failed].lastPathComponent)"]
+      )
+    }
+    return objectURLs
+  }
+
+  /// FNV-1a; unlike `Hasher`, stable across processes, so usable as a cache key.
+  private func stableHash<S: Sequence>(_ bytes: S) -> UInt64 where S.Element == UInt8 {
+    var hash: UInt64 = 0xcbf2_9ce4_8422_2325
+    for byte in bytes {
+      hash ^= UInt64(byte)
+      hash = hash &* 0x0000_0100_0000_01b3
+    }
+    return hash
+  }
+
+  private func runtimeABIVersion(headerText: String) -> String {
+    for line in headerText.split(separator: "\n") where line.hasPrefix("#define KORAL_RUNTIME_ABI_VERSION ") {
+      return String(line.dropFirst("#define KORAL_RUNTIME_ABI_VERSION ".count))
+        .trimmingCharacters(in: .whitespaces)
+    }
+    return "unknown"
+  }
+
+  /// Directory for cached build products: `KORAL_CACHE_DIR`, else the user
+  /// cache directory (XDG cache, ~/Library/Caches, %LOCALAPPDATA%).
+  private func koralCacheDirectory() -> URL? {
+    if let override = ProcessInfo.processInfo.environment["KORAL_CACHE_DIR"], !override.isEmpty {
+      return URL(fileURLWithPath: override).standardized
+    }
+    return FileManager.default.urls(for: .cachesDirectory, in: .userDomainMask).first?
+      .appendingPathComponent("koral")
+  }
+
+  /// Returns a precompiled `koral_runtime.c` object, compiling it on a cache
+  /// miss. The key covers KORAL_RUNTIME_ABI_VERSION, the runtime source and
+  /// header, the clang binary and the compile flags. Returns nil (compile the
+  /// runtime with the program) for LTO and PGO builds, which must see the
+  /// runtime source, when KORAL_NO_RUNTIME_CACHE is set, or on any failure.
+  private func cachedRuntimeObject(
+    runtimeURL: URL,
+    stdPath: String,
+    clangPath: String,
+    buildSettings: NativeBuildSettings,
+    extraArgs: [String]
+  ) -> URL? {
+    if buildSettings.lto || buildSettings.pgoGenerateDir != nil || buildSettings.pgoUsePath != nil {
+      return nil
+    }
+    if envFlag("KORAL_NO_RUNTIME_CACHE") {
+      return nil
+    }
+    let fileManager = FileManager.default
+    let headerURL = URL(fileURLWithPath: stdPath).appendingPathComponent("koral_runtime.h")
+    guard let cacheRoot = koralCacheDirectory(),
+          let runtimeSource = fileManager.contents(atPath: runtimeURL.path),
+          let headerSource = fileManager.contents(atPath: headerURL.path) else {
+      return nil
+    }
+
+    let compileArgs = ["-Wno-everything"] + buildSettings.clangFlags + extraArgs
+    let clangAttributes = try? fileManager.attributesOfItem(atPath: clangPath)
+    let clangStamp = [
+      clangPath,
+      (clangAttributes?[.modificationDate] as? Date).map { "\($0.timeIntervalSince1970)" } ?? "",
+      (clangAttributes?[.size] as? NSNumber)?.stringValue ?? "",
+    ].joined(separator: ":")
+    let key = [
+      "abi=\(runtimeABIVersion(headerText: String(decoding: headerSource, as: UTF8.self)))",
+      "runtime=\(stableHash(runtimeSource))",
+      "header=\(stableHash(headerSource))",
+      "clang=\(clangStamp)",
+      "flags=\(compileArgs.joined(separator: " "))",
+    ].joined(separator: "\n")
+
+    let entryURL = cacheRoot
+      .appendingPathComponent("runtime")
+      .appendingPathComponent(String(stableHash(Array(key.utf8)), radix: 16))
+    #if os(Windows)
+    let objectURL = entryURL.appendingPathComponent("koral_runtime.obj")
+    #else
+    let objectURL = entryURL.appendingPathComponent("koral_runtime.o")
+    #endif
+    if fileManager.fileExists(atPath: objectURL.path) {
+      return objectURL
+    }
+
+    // Compile to a private name and move into place, so concurrent builds
+    // never link a partially written object.
+    debugPhase("runtime: compile \(objectURL.path)")
+    do {
+      try fileManager.createDirectory(at: entryURL, withIntermediateDirectories: true, attributes: nil)
+      let partialURL = entryURL.appendingPathComponent("partial-\(UUID().uuidString).o")
+      defer { try? fileManager.removeItem(at: partialURL) }
+      let args = ["-c", runtimeURL.path, "-I", stdPath, "-o", partialURL.path] + compileArgs
+      guard try runSubprocess(executable: clangPath, args: args) == 0 else {
+        return nil
+      }
+      if !fileManager.fileExists(atPath: objectURL.path) {
+        try? fileManager.moveItem(at: partialURL, to: objectURL)
+      }
+      return fileManager.fileExists(atPath: objectURL.path) ? objectURL : nil
+    } catch {
+      return nil
+    }
+  }
+
   func getCoreLibPath() -> String {
     if let stdManifestPath = getStdManifestPath() {
       let legacyEntry = URL(fileURLWithPath: stdManifestPath)
@@ -989,6 +1372,14 @@ public class Driver {
         --deps-root <path>        Dependency root directory (default unresolved)
         --std-config <path>       Standard library manifest path
         --no-std                  Compile without standard library
+        --profile <name>          Build profile: dev (default), release, or a manifest 'profile' entry
+        --opt-level <level>       C optimization level: 0, 1, 2, 3, s, z (overrides the profile)
+        --target-cpu <cpu>        Tune for a CPU, passed to clang as -march (e.g. native)
+        --lto                     Link-time optimization across the program and runtime
+        --codegen-units <n>       Split the C output into <n> files compiled in parallel
+        --pgo-generate <dir>      Instrument for PGO; raw profiles are written to <dir>
+        --pgo-use <file>          Optimize with merged PGO profile data (.profdata)
+        --biased-rc               Use biased reference counting in the program and runtime
       """
     )
   }
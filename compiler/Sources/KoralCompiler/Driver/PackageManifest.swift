@@ -45,6 +45,18 @@ public struct PackageModuleConfig {
   public let links: [String]
 }
 
+/// Native build settings from a `profile.<name>` manifest entry.
+/// Unset fields fall back to the built-in profile of the same name.
+public struct PackageBuildProfile {
+  public let optLevel: String?
+  public let targetCPU: String?
+  public let lto: Bool?
+  public let codegenUnits: Int?
+}
+
+/// Optimization levels accepted by `--opt-level` and `profile.*.opt_level`.
+public let validOptLevels: Set<String> = ["0", "1", "2", "3", "s", "z"]
+
 public struct PackageManifest {
   public let manifestPath: String
   public let packageRoot: String
@@ -54,6 +66,7 @@ public struct PackageManifest {
   public let links: [String]
   public let modules: [String: PackageModuleConfig]
   public let dependencies: [String: PackageDependencyConfig]
+  public let profiles: [String: PackageBuildProfile]
 }
 
 public enum ResolvedPackageKind {
@@ -186,6 +199,38 @@ private func optionalStringMap(_ value: Any?, path: String) throws -> [String: S
   return result
 }
 
+private func optionalBool(_ value: Any?, path: String) throws -> Bool? {
+  guard let value else { return nil }
+  guard let flag = value as? Bool else {
+    throw PackageManifestError.invalidField(path: path, message: "expected boolean")
+  }
+  return flag
+}
+
+private func optionalOptLevel(_ value: Any?, path: String) throws -> String? {
+  guard let value else { return nil }
+  let level: String
+  if let string = value as? String {
+    level = string
+  } else if let number = value as? Int {
+    level = String(number)
+  } else {
+    throw PackageManifestError.invalidField(path: path, message: "expected string or integer")
+  }
+  guard validOptLevels.contains(level) else {
+    throw PackageManifestError.invalidField(path: path, message: "expected one of 0, 1, 2, 3, s, z")
+  }
+  return level
+}
+
+private func optionalPositiveInt(_ value: Any?, path: String) throws -> Int? {
+  guard let value else { return nil }
+  guard let number = value as? Int, number > 0 else {
+    throw PackageManifestError.invalidField(path: path, message: "expected positive integer")
+  }
+  return number
+}
+
 public func loadPackageManifest(at manifestPath: String) throws -> PackageManifest {
   let manifestURL = URL(fileURLWithPath: manifestPath).standardized
   guard FileManager.default.fileExists(atPath: manifestURL.path) else {
@@ -229,6 +274,23 @@ public func loadPackageManifest(at manifestPath: String) throws -> PackageManife
     }
   }
 
+  var profiles: [String: PackageBuildProfile] = [:]
+  if let rawProfiles = object["profile"] {
+    let profileObject = try expectObject(rawProfiles, path: "profile")
+    for (profileName, rawProfile) in profileObject {
+      let settings = try expectObject(rawProfile, path: "profile.\(profileName)")
+      profiles[profileName] = PackageBuildProfile(
+        optLevel: try optionalOptLevel(settings["opt_level"], path: "profile.\(profileName).opt_level"),
+        targetCPU: try optionalString(settings["target_cpu"], path: "profile.\(profileName).target_cpu"),
+        lto: try optionalBool(settings["lto"], path: "profile.\(profileName).lto"),
+        codegenUnits: try optionalPositiveInt(
+          settings["codegen_units"],
+          path: "profile.\(profileName).codegen_units"
+        )
+      )
+    }
+  }
+
   var modules: [String: PackageModuleConfig] = [:]
   if let rawModules = object["modules"] {
     let moduleObject = try expectObject(rawModules, path: "modules")
@@ -290,7 +352,8 @@ public func loadPackageManifest(at manifestPath: String) throws -> PackageManife
     defaultTargetModuleName: defaultTargetModuleName,
     links: packageLinks,
     modules: modules,
-    dependencies: dependencies
+    dependencies: dependencies,
+    profiles: profiles
   )
 }
 
@@ -38,6 +38,7 @@ struct MIRProgram {
   let traits: [String: TraitDeclInfo]
   let receiverMethodDispatch: [DefId: ReceiverMethodDispatchInfo]
   let escapeSummaries: [DefId: MIREscapeSummary]
+  var eliminatedReferenceCountOpCount = 0
 
   func lookupStaticMethod(typeName: String, methodName: String) -> DefId? {
     staticMethodLookup["\(typeName).\(methodName)"]
@@ -114,6 +115,7 @@ struct MIRFunction {
   let entryBlock: MIRBlockID
   var locals: [MIRLocal]
   var blocks: [MIRBasicBlock]
+  var eliminatedReferenceCountOpCount = 0
 }
 
 struct MIRLocal {
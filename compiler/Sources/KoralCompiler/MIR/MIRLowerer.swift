@@ -68,7 +68,8 @@ final class MIRLowerer {
       receiverMethodDispatch: program.receiverMethodDispatch,
       escapeSummaries: [:]
     )
-    return MIRReferenceAllocationPromoter(program: loweredProgram).promote()
+    let promotedProgram = MIRReferenceAllocationPromoter(program: loweredProgram).promote()
+    return MIRReferenceCountOptimizer(program: promotedProgram).optimize()
   }
 
   private func sortedVTableRequests() -> [VtableRequest] {
@@ -15,6 +15,9 @@ final class MIRPrinter {
     if let blockerLine = renderBlockerFunctionLine() {
       lines.append(blockerLine)
     }
+    if let rcLine = renderReferenceCountFunctionLine() {
+      lines.append(rcLine)
+    }
     for global in program.globals.compactMap(renderTraitVTableGlobal) {
       lines.append(global)
     }
@@ -32,12 +35,15 @@ final class MIRPrinter {
     if let blockerLine = renderBlockerFunctionLine() {
       lines.append(blockerLine)
     }
+    if let rcLine = renderReferenceCountFunctionLine() {
+      lines.append(rcLine)
+    }
     return lines.joined(separator: "\n") + "\n"
   }
 
   private func renderSummaryLine() -> String {
     let stats = MIRStatsCollector.collect(program)
-    return "mir stats blocks=\(stats.blockCount) locals=\(stats.localCount) statements=\(stats.statementCount) terminators=\(stats.terminatorCount) values=\(stats.valueCount) calls=\(stats.callCount) aggregates=\(stats.aggregateCount) enums=\(stats.enumConstructionCount) vtables=\(stats.traitVTableCount) branches=\(stats.branchTerminatorCount) switches=\(stats.switchTerminatorCount) fully_structured_functions=\(stats.fullyStructuredFunctionCount)/\(stats.functionCount) mir_codegen_candidates=\(stats.mirCodeGenCandidateFunctionCount)/\(stats.functionCount) mir_codegen_blockers=\(stats.mirCodeGenBlockerCount) mir_codegen_blocker_kinds=\(renderCounts(stats.mirCodeGenBlockerKinds))"
+    return "mir stats blocks=\(stats.blockCount) locals=\(stats.localCount) statements=\(stats.statementCount) terminators=\(stats.terminatorCount) values=\(stats.valueCount) calls=\(stats.callCount) aggregates=\(stats.aggregateCount) enums=\(stats.enumConstructionCount) vtables=\(stats.traitVTableCount) branches=\(stats.branchTerminatorCount) switches=\(stats.switchTerminatorCount) rc_ops_eliminated=\(stats.eliminatedReferenceCountOpCount) fully_structured_functions=\(stats.fullyStructuredFunctionCount)/\(stats.functionCount) mir_codegen_candidates=\(stats.mirCodeGenCandidateFunctionCount)/\(stats.functionCount) mir_codegen_blockers=\(stats.mirCodeGenBlockerCount) mir_codegen_blocker_kinds=\(renderCounts(stats.mirCodeGenBlockerKinds))"
   }
 
   private func renderCounts(_ counts: [String: Int]) -> String {
@@ -70,6 +76,17 @@ final class MIRPrinter {
     return "mir blocker_functions \(rendered)"
   }
 
+  /// Every function whose count traffic was reduced, by name, so a test can
+  /// check that a rewrite fired in its own code rather than somewhere in std.
+  private func renderReferenceCountFunctionLine() -> String? {
+    let rendered = program.functions
+      .filter { $0.eliminatedReferenceCountOpCount > 0 }
+      .map { "\(renderFunctionName($0)):\($0.eliminatedReferenceCountOpCount)" }
+      .sorted()
+    if rendered.isEmpty { return nil }
+    return "mir rc_ops_eliminated_functions \(rendered.joined(separator: " "))"
+  }
+
   private func renderFunctionName(_ function: MIRFunction) -> String {
     context.getQualifiedName(function.identifier.defId)
       ?? context.getName(function.identifier.defId)
@@ -0,0 +1,300 @@
+import Foundation
+
+/// Removes reference-count traffic that the lowerer produces conservatively.
+///
+/// A whole-local `copy` that is the last use of an owned local becomes a
+/// `move`, and any trailing `drop` of that local is removed. Each rewrite
+/// saves one retain and one release in the generated C.
+final class MIRReferenceCountOptimizer {
+  private let program: MIRProgram
+
+  init(program: MIRProgram) {
+    self.program = program
+  }
+
+  func optimize() -> MIRProgram {
+    var eliminated = 0
+    let functions = program.functions.map { function in
+      let optimizer = MIRReferenceCountFunctionOptimizer(function: function)
+      var optimized = optimizer.optimize()
+      optimized.eliminatedReferenceCountOpCount += optimizer.eliminatedOpCount
+      eliminated += optimizer.eliminatedOpCount
+      return optimized
+    }
+
+    return MIRProgram(
+      globals: program.globals,
+      functions: functions,
+      context: program.context,
+      staticMethodLookup: program.staticMethodLookup,
+      traits: program.traits,
+      receiverMethodDispatch: program.receiverMethodDispatch,
+      escapeSummaries: program.escapeSummaries,
+      eliminatedReferenceCountOpCount: program.eliminatedReferenceCountOpCount + eliminated
+    )
+  }
+}
+
+private struct MIRStatementPosition: Hashable {
+  let block: Int
+  let statement: Int
+}
+
+private enum MIRLocalMention {
+  case declare
+  case assignTarget
+  case copyRead
+  case wholeCopy
+  case drop
+  case other
+}
+
+private final class MIRReferenceCountFunctionOptimizer {
+  private var function: MIRFunction
+  private var removed = Set<MIRStatementPosition>()
+  private(set) var eliminatedOpCount = 0
+
+  init(function: MIRFunction) {
+    self.function = function
+  }
+
+  func optimize() -> MIRFunction {
+    promoteLastCopiesToMoves()
+
+    guard !removed.isEmpty else { return function }
+    for blockIndex in function.blocks.indices {
+      let statements = function.blocks[blockIndex].statements
+      function.blocks[blockIndex].statements = statements.enumerated()
+        .filter { !removed.contains(MIRStatementPosition(block: blockIndex, statement: $0.offset)) }
+        .map(\.element)
+    }
+    return function
+  }
+
+  // MARK: - Copy then drop
+
+  private func promoteLastCopiesToMoves() {
+    var mentionsByLocal: [MIRLocalID: [(position: MIRStatementPosition, kind: MIRLocalMention)]] = [:]
+    var disqualified = Set<MIRLocalID>()
+
+    for (blockIndex, block) in function.blocks.enumerated() {
+      for (statementIndex, statement) in block.statements.enumerated() {
+        let position = MIRStatementPosition(block: blockIndex, statement: statementIndex)
+        visitLocals(in: statement) { local, kind in
+          mentionsByLocal[local, default: []].append((position, kind))
+        }
+      }
+      visitLocals(in: block.terminator) { local in
+        disqualified.insert(local)
+      }
+    }
+
+    for local in function.locals {
+      guard local.storage == .local || local.storage == .temporary,
+            Self.isCountedType(local.type),
+            !disqualified.contains(local.id),
+            let mentions = mentionsByLocal[local.id],
+            let first = mentions.first,
+            mentions.allSatisfy({ $0.position.block == first.position.block && $0.kind != .other }),
+            let copyIndex = mentions.lastIndex(where: { $0.kind != .drop }),
+            mentions[copyIndex].kind == .wholeCopy,
+            mentions.filter({ $0.position == mentions[copyIndex].position }).count == 1,
+            mentions.first(where: { $0.kind != .declare })?.kind == .assignTarget else {
+        continue
+      }
+
+      let copyPosition = mentions[copyIndex].position
+      guard case .assign(let destination, .placeRead(let source, .copy)) =
+        function.blocks[copyPosition.block].statements[copyPosition.statement] else {
+        continue
+      }
+      function.blocks[copyPosition.block].statements[copyPosition.statement] =
+        .assign(destination, .placeRead(source, ownership: .move))
+      for mention in mentions[(copyIndex + 1)...] {
+        removed.insert(mention.position)
+      }
+      eliminatedOpCount += 2
+    }
+  }
+
+  /// Mirrors `CodeGen.needsDrop`: only these types carry a count that a
+  /// copy retains and a drop releases.
+  private static func isCountedType(_ type: Type) -> Bool {
+    switch type {
+    case .structure, .`enum`, .reference, .mutableReference, .borrowedReference, .mutableBorrowedReference,
+         .function, .weakReference, .mutableWeakReference, .traitObject:
+      return true
+    default:
+      return false
+    }
+  }
+
+  // MARK: - Local mentions
+
+  private func visitLocals(in statement: MIRStatement, _ visit: (MIRLocalID, MIRLocalMention) -> Void) {
+    switch statement {
+    case .declare(let local):
+      visit(local, .declare)
+    case .assign(let place, let value):
+      if case .local(let local) = place {
+        visit(local, Self.isOwnedAssignment(value) ? .assignTarget : .other)
+      } else {
+        visitLocals(in: place, as: .other, visit)
+      }
+      if case .placeRead(.local(let local), .copy) = value {
+        visit(local, .wholeCopy)
+      } else {
+        visitLocals(in: value, visit)
+      }
+    case .compoundAssign(let assignment):
+      visitLocals(in: assignment.target, as: .other, visit)
+      visitLocals(in: assignment.value, visit)
+    case .drop(let place):
+      if case .local(let local) = place {
+        visit(local, .drop)
+      } else {
+        visitLocals(in: place, as: .other, visit)
+      }
+    case .retain(let value),
+         .release(let value):
+      visitLocals(in: value) { local, _ in visit(local, .other) }
+    case .evaluate(let value):
+      visitLocals(in: value, visit)
+    case .scopeEnter, .scopeExit, .debugSource:
+      break
+    }
+  }
+
+  private func visitLocals(in terminator: MIRTerminator, _ visit: (MIRLocalID) -> Void) {
+    switch terminator {
+    case .branch(.local(let local), _, _),
+         .switchValue(.local(let local), _, _),
+         .returnValue(.local(let local)):
+      visit(local)
+    default:
+      break
+    }
+  }
+
+  private func visitLocals(in place: MIRPlace, as kind: MIRLocalMention, _ visit: (MIRLocalID, MIRLocalMention) -> Void) {
+    switch place {
+    case .local(let local):
+      visit(local, kind)
+    case .global:
+      break
+    case .field(let base, _),
+         .enumPayload(let base, _, _, _, _):
+      visitLocals(in: base, as: kind, visit)
+    case .deref(let base, _),
+         .pointerElement(let base, _):
+      visitLocals(in: base, visit)
+    }
+  }
+
+  /// Reports every local a value touches. Plain copies out of a local (or
+  /// one of its fields) leave the local intact and are reported as
+  /// `.copyRead`; anything that moves, borrows or aliases it is `.other`.
+  private func visitLocals(in value: MIRValue, _ visit: (MIRLocalID, MIRLocalMention) -> Void) {
+    switch value {
+    case .operand(let operand):
+      if case .local(let local) = operand {
+        visit(local, .other)
+      }
+    case .placeRead(let place, let ownership):
+      visitLocals(in: place, as: ownership == .copy ? .copyRead : .other, visit)
+    case .ref(let place, _, _),
+         .pointer(let place):
+      visitLocals(in: place, as: .other, visit)
+    case .binary(let operation):
+      if case .local(let local) = operation.left {
+        visit(local, .other)
+      }
+      if case .local(let local) = operation.right {
+        visit(local, .other)
+      }
+    case .unary(let operation):
+      if case .local(let local) = operation.operand {
+        visit(local, .other)
+      }
+    case .cast(let operand, _):
+      if case .local(let local) = operand {
+        visit(local, .other)
+      }
+    case .call(let call):
+      if case .local(let local) = call.callee {
+        visit(local, .other)
+      }
+      for argument in call.arguments {
+        visitLocals(in: argument, visit)
+      }
+    case .aggregate(let aggregate):
+      for field in aggregate.fields {
+        visitLocals(in: field, visit)
+      }
+    case .enumCase(let construction):
+      for argument in construction.arguments {
+        visitLocals(in: argument, visit)
+      }
+    case .enumTag(let tag):
+      visitLocals(in: tag.subject, visit)
+    case .traitObjectConversion(let conversion):
+      visitLocals(in: conversion.inner, visit)
+    case .traitMethodCall(let call):
+      visitLocals(in: call.receiver, visit)
+      for argument in call.arguments {
+        visitLocals(in: argument, visit)
+      }
+    case .intrinsic(let intrinsic):
+      visitLocals(in: intrinsic) { local in visit(local, .other) }
+    case .lambda(let lambda):
+      for source in lambda.captureSources {
+        visitLocals(in: source, as: .other, visit)
+      }
+    }
+  }
+
+  private func visitLocals(in intrinsic: MIRIntrinsic, _ visit: (MIRLocalID) -> Void) {
+    let values: [MIRValue]
+    switch intrinsic {
+    case .allocMemory(let count, _):
+      values = [count]
+    case .deallocMemory(let ptr),
+         .deinitMemory(let ptr),
+         .takeMemory(let ptr, _),
+         .isUniqueMutable(let ptr),
+         .refCount(let ptr),
+         .downgradeRef(let ptr, _),
+         .downgradeMutRef(let ptr, _),
+         .upgradeRef(let ptr, _),
+         .upgradeMutRef(let ptr, _):
+      values = [ptr]
+    case .copyMemory(let dest, let source, let count),
+         .moveMemory(let dest, let source, let count):
+      values = [dest, source, count]
+    case .makeRef(let ptr, let owner, _),
+         .makeMutRef(let ptr, let owner, _),
+         .initMemory(let ptr, let owner):
+      values = [ptr, owner]
+    case .nullPtr:
+      values = []
+    case .spawnThread(let outHandle, let outTid, let closure, let stackSize):
+      values = [outHandle, outTid, closure, stackSize]
+    }
+    for value in values {
+      visitLocals(in: value) { local, _ in visit(local) }
+    }
+  }
+
+  /// Locals initialised from borrows are non-owning in codegen; moving out of
+  /// them would hand the destination a count it never received.
+  private static func isOwnedAssignment(_ value: MIRValue) -> Bool {
+    switch value {
+    case .ref(_, _, let allocation):
+      return allocation != .stackBorrow
+    case .placeRead(_, let ownership):
+      return ownership != .borrow
+    default:
+      return true
+    }
+  }
+}
@@ -3,6 +3,7 @@ import Foundation
 struct MIRProgramStats {
   let globalCount: Int
   let traitVTableCount: Int
+  let eliminatedReferenceCountOpCount: Int
   let functionStats: [MIRFunctionStats]
 
   var functionCount: Int { functionStats.count }
@@ -57,6 +58,7 @@ struct MIRStatsCollector {
         if case .traitVTable = $0 { return true }
         return false
       }.count,
+      eliminatedReferenceCountOpCount: program.eliminatedReferenceCountOpCount,
       functionStats: program.functions.map { collect($0) }
     )
   }
@@ -1,4 +1,7 @@
 // Koral runtime helpers (platform shims)
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE  // CPU_SET / sched_setaffinity for configured threads
+#endif
 #include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
@@ -11,17 +14,49 @@
 #include <stdatomic.h>
 #include "koral_runtime.h"
 
-#if !defined(_WIN32) && !defined(_WIN64)
-
-#include <regex.h>
+typedef struct CFile CFile;
 
-typedef struct {
-    regex_t compiled;
-    int32_t flags;
-} KoralPosixRegex;
+// Green-thread hooks, defined in the "Green threads" section. Off a
+// green thread __koral_green_current() is NULL and callers block the OS
+// thread as usual.
+static void* __koral_green_current(void);
+static void __koral_green_park_until(int64_t deadline_ns);
+static void __koral_green_wake(void* fiber);
+static void __koral_green_yield(void);
+static void __koral_green_resume(void* fiber);
+static int64_t __koral_green_now_ns(void);
+
+// Gives up the OS thread's time slice, defined in the "Thread management"
+// section. Unlike __koral_thread_yield it never switches green threads, so
+// callers may hold pointers to carrier thread-locals across it.
+static void __koral_os_thread_yield(void);
+
+static inline void __koral_lock_spin_hint(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
 #endif
+}
 
-typedef struct CFile CFile;
+// Spin lock for the runtime's short internal critical sections. Spins with a
+// pause hint, then yields the OS thread between rounds so a preempted holder
+// can run instead of every waiter burning its time slice.
+#define KORAL_SPIN_LOCK_SPIN 64
+
+static void __koral_spin_lock(atomic_flag* lock) {
+    for (;;) {
+        for (int spin = 0; spin < KORAL_SPIN_LOCK_SPIN; spin++) {
+            if (!atomic_flag_test_and_set_explicit(lock, memory_order_acquire)) return;
+            __koral_lock_spin_hint();
+        }
+        __koral_os_thread_yield();
+    }
+}
+
+static void __koral_spin_unlock(atomic_flag* lock) {
+    atomic_flag_clear_explicit(lock, memory_order_release);
+}
 
 static int32_t __koral_argc_storage = 0;
 static uint8_t** __koral_argv_storage = NULL;
@@ -39,30 +74,729 @@ uint8_t** __koral_argv(void) {
     return __koral_argv_storage;
 }
 
-void __koral_retain(void* raw_control) {
-    if (!raw_control) return;
+// ============================================================================
+// Box allocator
+// ============================================================================
+//
+// Boxes (merged control block + payload) are small, fixed-size and extremely
+// short-lived, so they bypass malloc. Requests up to KORAL_BOX_MAX_SMALL bytes
+// are rounded up to a size class and served from a per-thread free list; the
+// lists are refilled from a global depot or by carving a new slab. Every block
+// is preceded by a 16-byte header recording its class, so a block may be freed
+// on any thread: it simply joins that thread's list. When a list grows past
+// KORAL_BOX_CACHE_LIMIT, half of it is returned to the depot, and a thread's
+// lists are flushed to the depot when it exits. Slab memory is retained for
+// reuse and never returned to the system.
+//
+// Build with -DKORAL_BOX_POOL=0 to route every box through malloc/free (useful
+// with sanitizers and heap profilers).
+//
+// While a thread is inside an arena scope (__koral_arena_enter), boxes are
+// bump-allocated from that arena instead; see "Arenas" below.
+
+#define KORAL_BOX_HEADER_SIZE 16
+#define KORAL_BOX_CLASS_COUNT 16
+#define KORAL_BOX_MAX_SMALL 512
+#define KORAL_BOX_LARGE_CLASS UINT32_MAX
+#define KORAL_BOX_ARENA_CLASS (UINT32_MAX - 1)
+#define KORAL_BOX_SLAB_BYTES (64 * 1024)
+#define KORAL_BOX_CACHE_LIMIT 256
+#define KORAL_BOX_TRANSFER_BATCH 64
+
+struct KoralArenaChunk;
+
+typedef struct KoralBoxHeader {
+    uint32_t size_class;
+    struct KoralArenaChunk* chunk;  // arena blocks only
+} KoralBoxHeader;
+
+_Static_assert(sizeof(KoralBoxHeader) <= KORAL_BOX_HEADER_SIZE, "box header must fit its reserved prefix");
+
+typedef struct KoralBoxFree {
+    struct KoralBoxFree* next;
+} KoralBoxFree;
+
+typedef struct {
+    KoralBoxFree* head;
+    uint32_t count;
+} KoralBoxList;
+
+static atomic_flag __koral_box_depot_lock = ATOMIC_FLAG_INIT;
+static KoralBoxList __koral_box_depot[KORAL_BOX_CLASS_COUNT];
+static _Thread_local KoralBoxList __koral_box_cache[KORAL_BOX_CLASS_COUNT];
+static _Atomic uintptr_t __koral_box_slabs = 0;
+
+static inline uint32_t __koral_box_class_of(size_t size) {
+    if (size <= 128) {
+        return size == 0 ? 0 : (uint32_t)((size - 1) >> 4);
+    }
+    if (size <= 256) {
+        return 8 + (uint32_t)((size - 129) >> 5);
+    }
+    return 12 + (uint32_t)((size - 257) >> 6);
+}
+
+static inline void* __koral_box_payload(KoralBoxHeader* header) {
+    return (char*)header + KORAL_BOX_HEADER_SIZE;
+}
+
+static inline KoralBoxHeader* __koral_box_header(void* block) {
+    return (KoralBoxHeader*)((char*)block - KORAL_BOX_HEADER_SIZE);
+}
+
+static void __koral_box_depot_lock_acquire(void) {
+    __koral_spin_lock(&__koral_box_depot_lock);
+}
+
+static void __koral_box_depot_lock_release(void) {
+    __koral_spin_unlock(&__koral_box_depot_lock);
+}
+
+// Moves up to `limit` blocks from `from` to `to`. Caller holds the depot lock
+// when either list is shared.
+static void __koral_box_transfer(KoralBoxList* from, KoralBoxList* to, uint32_t limit) {
+    while (limit > 0 && from->head) {
+        KoralBoxFree* node = from->head;
+        from->head = node->next;
+        from->count--;
+        node->next = to->head;
+        to->head = node;
+        to->count++;
+        limit--;
+    }
+}
+
+#if KORAL_BOX_POOL
+// 16-byte steps up to 128, 32-byte steps up to 256, 64-byte steps up to 512.
+static const uint32_t __koral_box_class_sizes[KORAL_BOX_CLASS_COUNT] = {
+    16, 32, 48, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 448, 512
+};
+
+static int __koral_box_refill(uint32_t size_class) {
+    KoralBoxList* cache = &__koral_box_cache[size_class];
+
+    __koral_box_depot_lock_acquire();
+    __koral_box_transfer(&__koral_box_depot[size_class], cache, KORAL_BOX_TRANSFER_BATCH);
+    __koral_box_depot_lock_release();
+    if (cache->head) {
+        return 1;
+    }
+
+    size_t stride = KORAL_BOX_HEADER_SIZE + __koral_box_class_sizes[size_class];
+    size_t count = KORAL_BOX_SLAB_BYTES / stride;
+    char* slab = (char*)malloc(count * stride);
+    if (!slab) {
+        return 0;
+    }
+    atomic_fetch_add_explicit(&__koral_box_slabs, 1, memory_order_relaxed);
+    for (size_t i = count; i > 0; i--) {
+        KoralBoxHeader* header = (KoralBoxHeader*)(slab + (i - 1) * stride);
+        header->size_class = size_class;
+        KoralBoxFree* node = (KoralBoxFree*)__koral_box_payload(header);
+        node->next = cache->head;
+        cache->head = node;
+    }
+    cache->count += (uint32_t)count;
+    return 1;
+}
+#endif
+
+// ----------------------------------------------------------------------------
+// Arenas
+// ----------------------------------------------------------------------------
+//
+// An arena owns a list of chunks and bump-allocates boxes from the current
+// one. A box still goes through the normal retain/release protocol (its Drop
+// must run), but freeing it only decrements the owning chunk's `live` count.
+// `live` also holds one reference for the arena itself, so a chunk is
+// released exactly when the arena has let go of it and its last box is gone.
+//
+// Leaving the outermost scope resets the arena: chunks with no surviving boxes
+// are rewound and kept for the next scope, and chunks that still hold boxes
+// which escaped the scope are detached and freed by whichever thread releases
+// their last box. An arena is active on one thread at a time; boxes allocated
+// in it may be released on any thread.
+
+#define KORAL_ARENA_DEFAULT_CHUNK_BYTES (64 * 1024)
+#define KORAL_ARENA_SPARE_CHUNKS 4
+
+typedef struct KoralArenaChunk {
+    _Atomic intptr_t live;
+    size_t used;
+    size_t capacity;
+    struct KoralArenaChunk* next;
+} KoralArenaChunk;
+
+#define KORAL_ARENA_CHUNK_HEADER ((sizeof(KoralArenaChunk) + 15) & ~(size_t)15)
+
+typedef struct KoralArena {
+    KoralArenaChunk* chunks;  // in use since the last reset, newest first
+    KoralArenaChunk* spare;   // rewound, ready for reuse
+    size_t spare_count;
+    size_t chunk_bytes;
+    size_t depth;
+    void* owner;              // thread that has the arena entered
+    struct KoralArena* outer; // arena active on this thread before entering
+} KoralArena;
+
+static _Thread_local KoralArena* __koral_arena_current = NULL;
+// The green thread running on this thread, if any. Green threads keep their
+// own arena scope and may move between threads, so they are the owner token.
+static _Thread_local void* __koral_arena_fiber = NULL;
+
+static inline void* __koral_arena_thread_token(void) {
+    return __koral_arena_fiber ? __koral_arena_fiber : (void*)&__koral_arena_current;
+}
+
+static void __koral_arena_chunk_release(KoralArenaChunk* chunk) {
+    if (atomic_fetch_sub_explicit(&chunk->live, 1, memory_order_acq_rel) == 1) {
+        free(chunk);
+    }
+}
+
+static KoralArenaChunk* __koral_arena_chunk_new(KoralArena* arena, size_t min_bytes) {
+    KoralArenaChunk* chunk = arena->spare;
+    if (chunk && chunk->capacity >= min_bytes) {
+        arena->spare = chunk->next;
+        arena->spare_count--;
+    } else {
+        size_t capacity = arena->chunk_bytes > min_bytes ? arena->chunk_bytes : min_bytes;
+        chunk = (KoralArenaChunk*)malloc(KORAL_ARENA_CHUNK_HEADER + capacity);
+        if (!chunk) {
+            fprintf(stderr, "Panic: out of memory allocating arena chunk\n");
+            abort();
+        }
+        chunk->capacity = capacity;
+        atomic_init(&chunk->live, 1);
+    }
+    chunk->used = 0;
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    return chunk;
+}
+
+static void* __koral_arena_alloc(KoralArena* arena, size_t size) {
+    size_t stride = KORAL_BOX_HEADER_SIZE + ((size + 15) & ~(size_t)15);
+    KoralArenaChunk* chunk = arena->chunks;
+    if (!chunk || chunk->capacity - chunk->used < stride) {
+        chunk = __koral_arena_chunk_new(arena, stride);
+    }
+    KoralBoxHeader* header = (KoralBoxHeader*)((char*)chunk + KORAL_ARENA_CHUNK_HEADER + chunk->used);
+    chunk->used += stride;
+    atomic_fetch_add_explicit(&chunk->live, 1, memory_order_relaxed);
+    header->size_class = KORAL_BOX_ARENA_CLASS;
+    header->chunk = chunk;
+    return __koral_box_payload(header);
+}
+
+static void __koral_arena_reset(KoralArena* arena) {
+    KoralArenaChunk* chunk = arena->chunks;
+    arena->chunks = NULL;
+    while (chunk) {
+        KoralArenaChunk* next = chunk->next;
+        // live == 1 means only the arena's own reference is left, and nothing
+        // else can add one back, so the chunk may be rewound.
+        if (atomic_load_explicit(&chunk->live, memory_order_acquire) == 1
+            && arena->spare_count < KORAL_ARENA_SPARE_CHUNKS) {
+            chunk->used = 0;
+            chunk->next = arena->spare;
+            arena->spare = chunk;
+            arena->spare_count++;
+        } else {
+            __koral_arena_chunk_release(chunk);
+        }
+        chunk = next;
+    }
+}
+
+void* __koral_arena_create(size_t chunk_bytes) {
+    KoralArena* arena = (KoralArena*)calloc(1, sizeof(KoralArena));
+    if (!arena) {
+        fprintf(stderr, "Panic: out of memory allocating arena\n");
+        abort();
+    }
+    arena->chunk_bytes = chunk_bytes > 0 ? chunk_bytes : KORAL_ARENA_DEFAULT_CHUNK_BYTES;
+    return arena;
+}
+
+void __koral_arena_enter(void* raw_arena) {
+    KoralArena* arena = (KoralArena*)raw_arena;
+    void* self = __koral_arena_thread_token();
+    if (arena->depth > 0) {
+        if (arena->owner != self) {
+            fprintf(stderr, "Panic: arena is already in use on another thread\n");
+            abort();
+        }
+        arena->depth++;
+        return;
+    }
+    arena->owner = self;
+    arena->depth = 1;
+    arena->outer = __koral_arena_current;
+    __koral_arena_current = arena;
+}
+
+void __koral_arena_leave(void* raw_arena) {
+    KoralArena* arena = (KoralArena*)raw_arena;
+    if (arena->depth == 0 || arena->owner != __koral_arena_thread_token()) {
+        fprintf(stderr, "Panic: arena scope left on a thread that did not enter it\n");
+        abort();
+    }
+    if (--arena->depth > 0) {
+        return;
+    }
+    __koral_arena_current = arena->outer;
+    arena->outer = NULL;
+    arena->owner = NULL;
+    __koral_arena_reset(arena);
+}
+
+void __koral_arena_destroy(void* raw_arena) {
+    KoralArena* arena = (KoralArena*)raw_arena;
+    if (!arena) return;
+    if (arena->depth > 0) {
+        fprintf(stderr, "Panic: arena dropped while a scope is active\n");
+        abort();
+    }
+    while (arena->spare) {
+        KoralArenaChunk* next = arena->spare->next;
+        __koral_arena_chunk_release(arena->spare);
+        arena->spare = next;
+    }
+    free(arena);
+}
+
+// Bytes bump-allocated since the arena was last reset.
+size_t __koral_arena_used_bytes(void* raw_arena) {
+    KoralArena* arena = (KoralArena*)raw_arena;
+    size_t used = 0;
+    for (KoralArenaChunk* chunk = arena->chunks; chunk; chunk = chunk->next) {
+        used += chunk->used;
+    }
+    return used;
+}
+
+void* __koral_box_alloc(size_t size) {
+    KoralArena* arena = __koral_arena_current;
+    if (arena) {
+        return __koral_arena_alloc(arena, size);
+    }
+#if KORAL_BOX_POOL
+    if (size <= KORAL_BOX_MAX_SMALL) {
+        uint32_t size_class = __koral_box_class_of(size);
+        KoralBoxList* cache = &__koral_box_cache[size_class];
+        if (!cache->head && !__koral_box_refill(size_class)) {
+            fprintf(stderr, "Panic: out of memory allocating box\n");
+            abort();
+        }
+        KoralBoxFree* node = cache->head;
+        cache->head = node->next;
+        cache->count--;
+        return node;
+    }
+#endif
+    KoralBoxHeader* header = (KoralBoxHeader*)malloc(KORAL_BOX_HEADER_SIZE + size);
+    if (!header) {
+        fprintf(stderr, "Panic: out of memory allocating box\n");
+        abort();
+    }
+    header->size_class = KORAL_BOX_LARGE_CLASS;
+    return __koral_box_payload(header);
+}
+
+void __koral_box_free(void* block) {
+    if (!block) return;
+    KoralBoxHeader* header = __koral_box_header(block);
+    if (header->size_class == KORAL_BOX_ARENA_CLASS) {
+        __koral_arena_chunk_release(header->chunk);
+        return;
+    }
+    if (header->size_class == KORAL_BOX_LARGE_CLASS) {
+        free(header);
+        return;
+    }
+    KoralBoxList* cache = &__koral_box_cache[header->size_class];
+    KoralBoxFree* node = (KoralBoxFree*)block;
+    node->next = cache->head;
+    cache->head = node;
+    cache->count++;
+    if (cache->count > KORAL_BOX_CACHE_LIMIT) {
+        __koral_box_depot_lock_acquire();
+        __koral_box_transfer(cache, &__koral_box_depot[header->size_class], KORAL_BOX_CACHE_LIMIT / 2);
+        __koral_box_depot_lock_release();
+    }
+}
+
+// Slabs carved so far. Freed blocks are reused before a new slab is carved,
+// so a steady workload stops adding to this.
+uintptr_t __koral_box_slab_count(void) {
+    return atomic_load_explicit(&__koral_box_slabs, memory_order_relaxed);
+}
+
+// Called by the thread trampolines so blocks cached by a finished thread stay
+// reusable.
+static void __koral_box_thread_exit(void) {
+    __koral_box_depot_lock_acquire();
+    for (uint32_t i = 0; i < KORAL_BOX_CLASS_COUNT; i++) {
+        __koral_box_transfer(&__koral_box_cache[i], &__koral_box_depot[i], UINT32_MAX);
+    }
+    __koral_box_depot_lock_release();
+}
+
+// ============================================================================
+// Reference counting
+// ============================================================================
+//
+// With KORAL_RC_BIASED every control block records the thread that allocated
+// it. The owner thread adjusts `local_count` without lock-prefixed
+// instructions; other threads use the atomic shared counter in
+// `strong_count`. The total strong count is local + shared, so the shared
+// part alone may legitimately go negative when a reference created on the
+// owner thread is released elsewhere.
+//
+// The two counters are merged back into `strong_count` (and `owner` cleared)
+// when the owner drops its last local reference, or when a non-owner drives
+// the shared count negative. In the latter case the block is queued to the
+// owner, which merges it the next time it allocates or releases a box while
+// holding no Koral lock, or while parked in a condvar wait; if the owner
+// thread has already exited, the releasing thread merges immediately. After
+// the merge the block behaves exactly like the default atomic scheme.
+//
+// Because of that deferral the biased mode is opt-in (-DKORAL_RC_BIASED=1):
+// a Drop that completes on a non-owner thread may run slightly later, on the
+// owner thread.
+
+static void __koral_control_destroy(struct __koral_Control* control) {
+    if (control->dtor) {
+        control->dtor(control->ptr);
+    }
+    // Merged layout: control block and payload are in the same allocation.
+    // Don't free(control->ptr) — the payload is freed together with the
+    // control block when the last weak reference is released.
+    __koral_weak_release(control);
+}
+
+#if KORAL_RC_BIASED
+
+#define KORAL_RC_NO_THREAD UINTPTR_MAX
+
+typedef struct KoralRcThread {
+    uintptr_t id;
+    _Atomic int pending;
+    struct __koral_Control** queue;  // guarded by __koral_rc_registry_lock
+    size_t queue_count;
+    size_t queue_capacity;
+    struct KoralRcThread* next;
+} KoralRcThread;
+
+static atomic_flag __koral_rc_registry_lock = ATOMIC_FLAG_INIT;
+static KoralRcThread* __koral_rc_registry = NULL;
+static _Atomic uintptr_t __koral_rc_next_id = 1;
+static _Thread_local uintptr_t __koral_rc_tid = KORAL_RC_NO_THREAD;
+static _Thread_local KoralRcThread* __koral_rc_self = NULL;
+// Koral locks held by the code running on this thread. A green thread keeps
+// its own depth, swapped in by __koral_green_resume, and may park holding a
+// lock and wake on another carrier, so the slot is looked up afresh on every
+// access instead of letting the compiler keep one carrier's address.
+static _Thread_local int __koral_rc_lock_depth = 0;
+
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((noinline))
+#endif
+static int* __koral_rc_lock_depth_slot(void) {
+    return &__koral_rc_lock_depth;
+}
+
+#define KORAL_RC_LOCK_ACQUIRED() ((*__koral_rc_lock_depth_slot())++)
+#define KORAL_RC_LOCK_RELEASED() ((*__koral_rc_lock_depth_slot())--)
+// Condvar waits wake up this often so a parked owner still drains its queue.
+#define KORAL_RC_WAIT_SLICE_MS 10
+
+static void __koral_rc_lock(void) {
+    __koral_spin_lock(&__koral_rc_registry_lock);
+}
+
+static void __koral_rc_unlock(void) {
+    __koral_spin_unlock(&__koral_rc_registry_lock);
+}
+
+// Returns the current thread's owner token, registering the thread on first
+// use. Returns 0 if registration fails; boxes are then created pre-merged.
+static uintptr_t __koral_rc_current(void) {
+    if (__koral_rc_tid != KORAL_RC_NO_THREAD) {
+        return __koral_rc_tid;
+    }
+    KoralRcThread* self = (KoralRcThread*)calloc(1, sizeof(KoralRcThread));
+    if (!self) {
+        return 0;
+    }
+    self->id = atomic_fetch_add(&__koral_rc_next_id, 1);
+    __koral_rc_lock();
+    self->next = __koral_rc_registry;
+    __koral_rc_registry = self;
+    __koral_rc_unlock();
+    __koral_rc_self = self;
+    __koral_rc_tid = self->id;
+    return self->id;
+}
+
+static inline int __koral_rc_shared_count(int shared) {
+    return shared >> KORAL_RC_SHARED_SHIFT;
+}
+
+// Folds the local counter into the shared one and clears the owner. Callers
+// must either be the owner thread or hold the registry lock after observing
+// that the owner has exited. Returns 1 if the total count reached zero.
+static int __koral_rc_merge(struct __koral_Control* control) {
+    int local = atomic_load_explicit(&control->local_count, memory_order_relaxed);
+    int old = atomic_load(&control->strong_count);
+    int desired;
+    do {
+        desired = ((old + local * KORAL_RC_SHARED_ONE) & ~KORAL_RC_FLAG_QUEUED) | KORAL_RC_FLAG_MERGED;
+    } while (!atomic_compare_exchange_weak(&control->strong_count, &old, desired));
+    // Clear the owner and local counter only after the merged flag is
+    // visible, so concurrent readers never observe both halves as zero.
+    atomic_store_explicit(&control->owner, 0, memory_order_relaxed);
+    atomic_store_explicit(&control->local_count, 0, memory_order_relaxed);
+    return __koral_rc_shared_count(desired) == 0;
+}
+
+// Merges a block taken from a queue. Queued blocks hold a weak reference so
+// the allocation survives until the queue is drained.
+static void __koral_rc_merge_queued(struct __koral_Control* control) {
+    int shared = atomic_load(&control->strong_count);
+    if (!(shared & KORAL_RC_FLAG_MERGED) && __koral_rc_merge(control)) {
+        __koral_control_destroy(control);
+    }
+    __koral_weak_release(control);
+}
+
+static void __koral_rc_drain(KoralRcThread* self) {
+    __koral_rc_lock();
+    struct __koral_Control** queue = self->queue;
+    size_t count = self->queue_count;
+    self->queue = NULL;
+    self->queue_count = 0;
+    self->queue_capacity = 0;
+    atomic_store_explicit(&self->pending, 0, memory_order_relaxed);
+    __koral_rc_unlock();
+    for (size_t i = 0; i < count; i++) {
+        __koral_rc_merge_queued(queue[i]);
+    }
+    free(queue);
+}
+
+// Queued blocks run their destructors on the owner thread, so only drain
+// while the thread holds no Koral lock a destructor might need.
+static inline int __koral_rc_should_drain(int held_locks) {
+    KoralRcThread* self = __koral_rc_self;
+    return self && *__koral_rc_lock_depth_slot() == held_locks
+        && atomic_load_explicit(&self->pending, memory_order_relaxed);
+}
+
+static inline void __koral_rc_poll(void) {
+    if (__koral_rc_should_drain(0)) {
+        __koral_rc_drain(__koral_rc_self);
+    }
+}
+
+// Hands a block whose shared count went negative to its owner thread. A
+// full queue is grown into a buffer allocated with the lock released, so
+// the registry lock is never held across malloc.
+static void __koral_rc_enqueue(struct __koral_Control* control, uintptr_t owner) {
+    __koral_weak_retain(control);
+    struct __koral_Control** spare = NULL;
+    size_t spare_capacity = 0;
+    __koral_rc_lock();
+    KoralRcThread* target = __koral_rc_registry;
+    while (target && target->id != owner) {
+        target = target->next;
+    }
+    while (target && target->queue_count == target->queue_capacity) {
+        size_t capacity = target->queue_capacity ? target->queue_capacity * 2 : 16;
+        if (spare_capacity >= capacity) {
+            // Swap in the larger buffer; the old one is freed below.
+            struct __koral_Control** old = target->queue;
+            if (target->queue_count) {
+                memcpy(spare, old, target->queue_count * sizeof(struct __koral_Control*));
+            }
+            target->queue = spare;
+            target->queue_capacity = spare_capacity;
+            spare = old;
+            break;
+        }
+        __koral_rc_unlock();
+        free(spare);
+        spare = (struct __koral_Control**)malloc(capacity * sizeof(struct __koral_Control*));
+        if (!spare) {
+            fprintf(stderr, "Panic: out of memory in reference count queue\n");
+            abort();
+        }
+        spare_capacity = capacity;
+        // The owner may have drained or exited meanwhile: look it up again.
+        __koral_rc_lock();
+        target = __koral_rc_registry;
+        while (target && target->id != owner) {
+            target = target->next;
+        }
+    }
+    if (target) {
+        target->queue[target->queue_count++] = control;
+        atomic_store_explicit(&target->pending, 1, memory_order_relaxed);
+        __koral_rc_unlock();
+        free(spare);
+        return;
+    }
+    // The owner has exited (or merged concurrently): nobody else touches
+    // local_count any more, so merge here while still holding the lock.
+    int shared = atomic_load(&control->strong_count);
+    int dead = !(shared & KORAL_RC_FLAG_MERGED) && __koral_rc_merge(control);
+    __koral_rc_unlock();
+    free(spare);
+    if (dead) {
+        __koral_control_destroy(control);
+    }
+    __koral_weak_release(control);
+}
+
+// Called by the thread trampolines before a Koral-spawned thread returns.
+static void __koral_rc_thread_exit(void) {
+    KoralRcThread* self = __koral_rc_self;
+    if (!self) return;
+    __koral_rc_drain(self);
+    __koral_rc_lock();
+    KoralRcThread** link = &__koral_rc_registry;
+    while (*link && *link != self) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = self->next;
+    }
+    struct __koral_Control** queue = self->queue;
+    size_t count = self->queue_count;
+    __koral_rc_unlock();
+    // Blocks queued between the drain above and unregistering.
+    for (size_t i = 0; i < count; i++) {
+        __koral_rc_merge_queued(queue[i]);
+    }
+    free(queue);
+    free(self);
+    __koral_rc_self = NULL;
+    __koral_rc_tid = KORAL_RC_NO_THREAD;
+}
+
+static void __koral_rc_release_shared(struct __koral_Control* control) {
+    int old = atomic_load(&control->strong_count);
+    int desired;
+    int queue;
+    do {
+        desired = old - KORAL_RC_SHARED_ONE;
+        queue = !(old & KORAL_RC_FLAG_MERGED)
+            && !(old & KORAL_RC_FLAG_QUEUED)
+            && __koral_rc_shared_count(desired) < 0;
+        if (queue) {
+            desired |= KORAL_RC_FLAG_QUEUED;
+        }
+    } while (!atomic_compare_exchange_weak(&control->strong_count, &old, desired));
+    if (queue) {
+        __koral_rc_enqueue(control, atomic_load_explicit(&control->owner, memory_order_relaxed));
+        return;
+    }
+    if ((desired & KORAL_RC_FLAG_MERGED) && __koral_rc_shared_count(desired) == 0) {
+        __koral_control_destroy(control);
+    }
+}
+
+void __koral_control_init(void* raw_control) {
+    struct __koral_Control* control = (struct __koral_Control*)raw_control;
+    uintptr_t owner = __koral_rc_current();
+    atomic_init(&control->weak_count, 1);
+    if (owner) {
+        __koral_rc_poll();
+        atomic_init(&control->owner, owner);
+        atomic_init(&control->local_count, 1);
+        atomic_init(&control->strong_count, 0);
+    } else {
+        atomic_init(&control->owner, 0);
+        atomic_init(&control->local_count, 0);
+        atomic_init(&control->strong_count, KORAL_RC_SHARED_ONE | KORAL_RC_FLAG_MERGED);
+    }
+}
+
+void __koral_retain_control(void* raw_control) {
+    struct __koral_Control* control = (struct __koral_Control*)raw_control;
+    if (atomic_load_explicit(&control->owner, memory_order_relaxed) == __koral_rc_tid) {
+        int local = atomic_load_explicit(&control->local_count, memory_order_relaxed);
+        atomic_store_explicit(&control->local_count, local + 1, memory_order_relaxed);
+        return;
+    }
+    atomic_fetch_add(&control->strong_count, KORAL_RC_SHARED_ONE);
+}
+
+void __koral_release_control(void* raw_control) {
+    struct __koral_Control* control = (struct __koral_Control*)raw_control;
+    if (atomic_load_explicit(&control->owner, memory_order_relaxed) == __koral_rc_tid) {
+        int local = atomic_load_explicit(&control->local_count, memory_order_relaxed) - 1;
+        atomic_store_explicit(&control->local_count, local, memory_order_relaxed);
+        // Merge before polling: draining the queue may free this block.
+        if (local == 0 && __koral_rc_merge(control)) {
+            __koral_control_destroy(control);
+        }
+        __koral_rc_poll();
+        return;
+    }
+    __koral_rc_release_shared(control);
+}
+
+// Reads local + shared consistently: a merge always rewrites strong_count, so
+// an unchanged shared word means the local half was read from the same epoch.
+static int __koral_rc_total(struct __koral_Control* control) {
+    int shared = atomic_load(&control->strong_count);
+    for (;;) {
+        if (shared & KORAL_RC_FLAG_MERGED) {
+            return __koral_rc_shared_count(shared);
+        }
+        int local = atomic_load_explicit(&control->local_count, memory_order_relaxed);
+        int again = atomic_load(&control->strong_count);
+        if (again == shared) {
+            return local + __koral_rc_shared_count(shared);
+        }
+        shared = again;
+    }
+}
+
+int __koral_control_is_unique(void* raw_control) {
+    return __koral_rc_total((struct __koral_Control*)raw_control) == 1;
+}
+
+uintptr_t __koral_control_strong_count(void* raw_control) {
+    int total = __koral_rc_total((struct __koral_Control*)raw_control);
+    return total > 0 ? (uintptr_t)total : 0;
+}
+
+#else
+
+#define KORAL_RC_LOCK_ACQUIRED() ((void)0)
+#define KORAL_RC_LOCK_RELEASED() ((void)0)
+
+static void __koral_rc_thread_exit(void) {
+}
+
+void __koral_retain_control(void* raw_control) {
     struct __koral_Control* control = (struct __koral_Control*)raw_control;
     atomic_fetch_add(&control->strong_count, 1);
 }
 
-void __koral_release(void* raw_control) {
-    if (!raw_control) return;
+void __koral_release_control(void* raw_control) {
     struct __koral_Control* control = (struct __koral_Control*)raw_control;
     int prev = atomic_fetch_sub(&control->strong_count, 1);
     if (prev == 1) {
-        if (control->dtor) {
-            control->dtor(control->ptr);
-        }
-        // Merged layout: control block and payload are in the same allocation.
-        // Don't free(control->ptr) — the payload is freed together with the
-        // control block when the last weak reference is released.
-        int weak_prev = atomic_fetch_sub(&control->weak_count, 1);
-        if (weak_prev == 1) {
-            free(control);
-        }
+        __koral_control_destroy(control);
     }
 }
 
+#endif
+
 void __koral_weak_retain(void* raw_control) {
     if (!raw_control) return;
     struct __koral_Control* control = (struct __koral_Control*)raw_control;
@@ -74,7 +808,7 @@ void __koral_weak_release(void* raw_control) {
     struct __koral_Control* control = (struct __koral_Control*)raw_control;
     int prev = atomic_fetch_sub(&control->weak_count, 1);
     if (prev == 1) {
-        free(control);
+        __koral_box_free(control);
     }
 }
 
@@ -108,6 +842,35 @@ struct __koral_Ref __koral_upgrade_ref(struct __koral_WeakRef w, int* success) {
     if (!w.control) return r;
 
     struct __koral_Control* control = (struct __koral_Control*)w.control;
+#if KORAL_RC_BIASED
+    if (atomic_load_explicit(&control->owner, memory_order_relaxed) == __koral_rc_tid) {
+        // A queued block can be dead while still biased; don't resurrect it.
+        if (__koral_rc_total(control) <= 0) return r;
+        int local = atomic_load_explicit(&control->local_count, memory_order_relaxed);
+        atomic_store_explicit(&control->local_count, local + 1, memory_order_relaxed);
+        r.ptr = control->ptr;
+        r.control = w.control;
+        *success = 1;
+        return r;
+    }
+    int old_shared = atomic_load(&control->strong_count);
+    for (;;) {
+        int alive;
+        if (old_shared & KORAL_RC_FLAG_MERGED) {
+            alive = __koral_rc_shared_count(old_shared) > 0;
+        } else {
+            int local = atomic_load_explicit(&control->local_count, memory_order_relaxed);
+            alive = local + __koral_rc_shared_count(old_shared) > 0;
+        }
+        if (!alive) return r;
+        if (atomic_compare_exchange_weak(&control->strong_count, &old_shared, old_shared + KORAL_RC_SHARED_ONE)) {
+            r.ptr = control->ptr;
+            r.control = w.control;
+            *success = 1;
+            return r;
+        }
+    }
+#else
     int old_count = atomic_load(&control->strong_count);
     while (old_count > 0) {
         if (atomic_compare_exchange_weak(&control->strong_count, &old_count, old_count + 1)) {
@@ -119,6 +882,7 @@ struct __koral_Ref __koral_upgrade_ref(struct __koral_WeakRef w, int* success) {
     }
 
     return r;
+#endif
 }
 
 void __koral_closure_retain(struct __koral_Closure closure) {
@@ -258,6 +1022,17 @@ int __koral_nanosleep(struct KoralTimespec *req, struct KoralTimespec *rem) {
 
 int __koral_nanosleep(struct KoralTimespec *req, struct KoralTimespec *rem) {
     if (!req) { errno = EINVAL; return -1; }
+    if (__koral_green_current()) {
+        int64_t deadline_ns = __koral_green_now_ns() + req->tv_sec * 1000000000LL + req->tv_nsec;
+        while (__koral_green_now_ns() < deadline_ns) {
+            __koral_green_park_until(deadline_ns);
+        }
+        if (rem) {
+            rem->tv_sec = 0;
+            rem->tv_nsec = 0;
+        }
+        return 0;
+    }
     struct timespec r;
     r.tv_sec = (time_t)req->tv_sec;
     r.tv_nsec = (long)req->tv_nsec;
@@ -514,101 +1289,751 @@ double __koral_float64_from_bits(uint64_t bits) {
 }
 
 // ============================================================================
-// File helpers (stdlib wrappers)
+// Byte hashing (std Hash / Hasher)
 // ============================================================================
+//
+// __koral_wyhash is the default string/byte hash: a wyhash-style function
+// that consumes 32 bytes per step in two independent 64x64->128 multiply
+// lanes, and short inputs with at most two multiplies. __koral_siphash13 is
+// the keyed SipHash-1-3 used when keys may be attacker-chosen. Both read
+// words little-endian so results do not depend on the host byte order.
+
+int32_t __koral_random_fill(uint8_t* buf, int32_t len);
+
+static const uint64_t __koral_wy_secret[4] = {
+    0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull,
+    0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull,
+};
 
-int32_t __koral_remove(const uint8_t* path) {
-    return (int32_t)remove((const char*)path);
+static inline void __koral_wy_mum(uint64_t* a, uint64_t* b) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = (__uint128_t)*a * *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32;
+    uint64_t la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32);
+    uint64_t carry = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    carry += lo < t;
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + carry;
+#endif
 }
 
-int32_t __koral_rename(const uint8_t* old_path, const uint8_t* new_path) {
-    return (int32_t)rename((const char*)old_path, (const char*)new_path);
+static inline uint64_t __koral_wy_mix(uint64_t a, uint64_t b) {
+    __koral_wy_mum(&a, &b);
+    return a ^ b;
 }
 
-uint8_t* __koral_getenv(const uint8_t* name) {
-    return (uint8_t*)getenv((const char*)name);
+static inline uint64_t __koral_read_le64(const uint8_t* p) {
+    return (uint64_t)p[0] | ((uint64_t)p[1] << 8) | ((uint64_t)p[2] << 16) |
+           ((uint64_t)p[3] << 24) | ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) |
+           ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
 }
 
-int32_t __koral_system(const uint8_t* command) {
-    return (int32_t)system((const char*)command);
+static inline uint64_t __koral_read_le32(const uint8_t* p) {
+    return (uint64_t)p[0] | ((uint64_t)p[1] << 8) | ((uint64_t)p[2] << 16) |
+           ((uint64_t)p[3] << 24);
+}
+
+uint64_t __koral_wyhash(const uint8_t* data, uintptr_t len, uint64_t seed) {
+    const uint64_t* s = __koral_wy_secret;
+    const uint8_t* p = data;
+    uint64_t a, b;
+    seed ^= __koral_wy_mix(seed ^ s[0], s[1]);
+    if (len <= 16) {
+        if (len >= 4) {
+            uintptr_t mid = (len >> 3) << 2;
+            a = (__koral_read_le32(p) << 32) | __koral_read_le32(p + mid);
+            b = (__koral_read_le32(p + len - 4) << 32) | __koral_read_le32(p + len - 4 - mid);
+        } else if (len > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        uintptr_t i = len;
+        if (i > 32) {
+            uint64_t lane = seed;
+            do {
+                seed = __koral_wy_mix(__koral_read_le64(p) ^ s[1], __koral_read_le64(p + 8) ^ seed);
+                lane = __koral_wy_mix(__koral_read_le64(p + 16) ^ s[2], __koral_read_le64(p + 24) ^ lane);
+                p += 32;
+                i -= 32;
+            } while (i > 32);
+            seed ^= lane;
+        }
+        if (i > 16) {
+            seed = __koral_wy_mix(__koral_read_le64(p) ^ s[1], __koral_read_le64(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        // The last 16 bytes of the input, overlapping what was consumed.
+        a = __koral_read_le64(p + i - 16);
+        b = __koral_read_le64(p + i - 8);
+    }
+    a ^= s[1];
+    b ^= seed;
+    __koral_wy_mum(&a, &b);
+    return __koral_wy_mix(a ^ s[0] ^ (uint64_t)len, b ^ s[1]);
+}
+
+uint64_t __koral_wyhash_word(uint64_t value, uint64_t seed) {
+    uint64_t a = value ^ __koral_wy_secret[1];
+    uint64_t b = seed ^ __koral_wy_mix(seed ^ __koral_wy_secret[0], __koral_wy_secret[1]);
+    __koral_wy_mum(&a, &b);
+    return __koral_wy_mix(a ^ __koral_wy_secret[0] ^ 8u, b ^ __koral_wy_secret[1]);
+}
+
+#define KORAL_SIP_ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+#define KORAL_SIP_ROUND(v0, v1, v2, v3) do {                       \
+        v0 += v1; v1 = KORAL_SIP_ROTL(v1, 13); v1 ^= v0;            \
+        v0 = KORAL_SIP_ROTL(v0, 32);                                \
+        v2 += v3; v3 = KORAL_SIP_ROTL(v3, 16); v3 ^= v2;            \
+        v0 += v3; v3 = KORAL_SIP_ROTL(v3, 21); v3 ^= v0;            \
+        v2 += v1; v1 = KORAL_SIP_ROTL(v1, 17); v1 ^= v2;            \
+        v2 = KORAL_SIP_ROTL(v2, 32);                                \
+    } while (0)
+
+uint64_t __koral_siphash13(const uint8_t* data, uintptr_t len, uint64_t k0, uint64_t k1) {
+    uint64_t v0 = k0 ^ 0x736f6d6570736575ull;
+    uint64_t v1 = k1 ^ 0x646f72616e646f6dull;
+    uint64_t v2 = k0 ^ 0x6c7967656e657261ull;
+    uint64_t v3 = k1 ^ 0x7465646279746573ull;
+    const uint8_t* p = data;
+    const uint8_t* end = data + (len & ~(uintptr_t)7);
+    for (; p != end; p += 8) {
+        uint64_t m = __koral_read_le64(p);
+        v3 ^= m;
+        KORAL_SIP_ROUND(v0, v1, v2, v3);
+        v0 ^= m;
+    }
+    uint64_t last = (uint64_t)len << 56;
+    switch (len & 7) {
+        case 7: last |= (uint64_t)p[6] << 48; /* fallthrough */
+        case 6: last |= (uint64_t)p[5] << 40; /* fallthrough */
+        case 5: last |= (uint64_t)p[4] << 32; /* fallthrough */
+        case 4: last |= (uint64_t)p[3] << 24; /* fallthrough */
+        case 3: last |= (uint64_t)p[2] << 16; /* fallthrough */
+        case 2: last |= (uint64_t)p[1] << 8;  /* fallthrough */
+        case 1: last |= (uint64_t)p[0];       /* fallthrough */
+        default: break;
+    }
+    v3 ^= last;
+    KORAL_SIP_ROUND(v0, v1, v2, v3);
+    v0 ^= last;
+    v2 ^= 0xff;
+    KORAL_SIP_ROUND(v0, v1, v2, v3);
+    KORAL_SIP_ROUND(v0, v1, v2, v3);
+    KORAL_SIP_ROUND(v0, v1, v2, v3);
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+uint64_t __koral_siphash13_word(uint64_t value, uint64_t k0, uint64_t k1) {
+    uint8_t buf[8];
+    for (int i = 0; i < 8; i++) {
+        buf[i] = (uint8_t)(value >> (i * 8));
+    }
+    return __koral_siphash13(buf, 8, k0, k1);
+}
+
+// 64 bits from the system entropy source; used to key hashers.
+uint64_t __koral_hash_random_key(void) {
+    uint8_t buf[8];
+    if (__koral_random_fill(buf, 8) != 0) {
+        // No entropy source: fall back to the clock and an address.
+        uint64_t t = (uint64_t)time(NULL) ^ (uint64_t)(uintptr_t)buf;
+        return __koral_wy_mix(t ^ __koral_wy_secret[2], __koral_wy_secret[3]);
+    }
+    return __koral_read_le64(buf);
+}
+
+// Per-process seed behind FastHasher.new(), drawn once on first use.
+// String.hash uses a fixed seed so table order is the same on every run.
+uint64_t __koral_hash_seed(void) {
+    static _Atomic uint64_t seed = 0;
+    uint64_t current = atomic_load_explicit(&seed, memory_order_relaxed);
+    if (current != 0) {
+        return current;
+    }
+    uint64_t fresh = __koral_hash_random_key() | 1u;
+    if (atomic_compare_exchange_strong(&seed, &current, fresh)) {
+        return fresh;
+    }
+    return current;
 }
 
 // ============================================================================
-// Time helpers
+// Byte search (std String / StrView / BufReader)
 // ============================================================================
+//
+// Each search returns the index of the first match (the last one for
+// memrchr), or `len` when there is none. SSE2 and NEON targets compare 16
+// bytes per step with the same vector setup as the control groups above;
+// other targets use scalar loops. __koral_memchr defers to the C library,
+// whose memchr is already vectorized on every platform we ship.
+
+#if KORAL_GROUP_SSE2 || KORAL_GROUP_NEON
+#define KORAL_BYTES16 1
+#if KORAL_GROUP_SSE2
+typedef __m128i koral_bytes16;
+static inline koral_bytes16 __koral_bytes16_load(const uint8_t* p) { return _mm_loadu_si128((const __m128i*)p); }
+static inline koral_bytes16 __koral_bytes16_splat(uint8_t b) { return _mm_set1_epi8((char)b); }
+static inline koral_bytes16 __koral_bytes16_eq(koral_bytes16 a, koral_bytes16 b) { return _mm_cmpeq_epi8(a, b); }
+static inline koral_bytes16 __koral_bytes16_or(koral_bytes16 a, koral_bytes16 b) { return _mm_or_si128(a, b); }
+static inline koral_bytes16 __koral_bytes16_and(koral_bytes16 a, koral_bytes16 b) { return _mm_and_si128(a, b); }
+static inline uint32_t __koral_bytes16_mask(koral_bytes16 v) { return (uint32_t)_mm_movemask_epi8(v); }
+#else
+typedef uint8x16_t koral_bytes16;
+static inline koral_bytes16 __koral_bytes16_load(const uint8_t* p) { return vld1q_u8(p); }
+static inline koral_bytes16 __koral_bytes16_splat(uint8_t b) { return vdupq_n_u8(b); }
+static inline koral_bytes16 __koral_bytes16_eq(koral_bytes16 a, koral_bytes16 b) { return vceqq_u8(a, b); }
+static inline koral_bytes16 __koral_bytes16_or(koral_bytes16 a, koral_bytes16 b) { return vorrq_u8(a, b); }
+static inline koral_bytes16 __koral_bytes16_and(koral_bytes16 a, koral_bytes16 b) { return vandq_u8(a, b); }
+static inline uint32_t __koral_bytes16_mask(koral_bytes16 v) {
+    // Most blocks have no match; skip the movemask emulation for them.
+    return vmaxvq_u8(v) == 0 ? 0 : __koral_group_movemask(v);
+}
+#endif
+#endif
 
-void __koral_monotonic_now(int64_t* out_secs, int64_t* out_nanos) {
-#if defined(_WIN32) || defined(_WIN64)
-    LARGE_INTEGER freq, counter;
-    if (QueryPerformanceFrequency(&freq) && QueryPerformanceCounter(&counter) && freq.QuadPart > 0) {
-        *out_secs = counter.QuadPart / freq.QuadPart;
-        *out_nanos = (int64_t)((counter.QuadPart % freq.QuadPart) * 1000000000LL / freq.QuadPart);
-    } else {
-        *out_secs = 0;
-        *out_nanos = 0;
-    }
+// Index of the highest set bit of a non-zero mask.
+static inline uint32_t __koral_bytes_highest(uint32_t mask) {
+#if defined(__GNUC__) || defined(__clang__)
+    return 31u - (uint32_t)__builtin_clz(mask);
 #else
-    struct timespec ts;
-    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
-        *out_secs = (int64_t)ts.tv_sec;
-        *out_nanos = (int64_t)ts.tv_nsec;
-    } else {
-        *out_secs = 0;
-        *out_nanos = 0;
+    uint32_t index = 0;
+    while (mask >>= 1) {
+        index++;
     }
+    return index;
 #endif
 }
 
-void __koral_wallclock_now(int64_t* out_secs, int64_t* out_nanos) {
-#if defined(_WIN32) || defined(_WIN64)
-    // Windows FILETIME epoch: 1601-01-01, Unix epoch: 1970-01-01
-    // Difference: 11644473600 seconds = 116444736000000000 * 100ns
-    static const int64_t EPOCH_DIFF = 116444736000000000LL;
-    FILETIME ft;
-    GetSystemTimeAsFileTime(&ft);
-    int64_t ticks = ((int64_t)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
-    ticks -= EPOCH_DIFF;
-    *out_secs = ticks / 10000000LL;
-    *out_nanos = (ticks % 10000000LL) * 100LL;
-#else
-    struct timespec ts;
-    if (clock_gettime(CLOCK_REALTIME, &ts) == 0) {
-        *out_secs = (int64_t)ts.tv_sec;
-        *out_nanos = (int64_t)ts.tv_nsec;
-    } else {
-        *out_secs = 0;
-        *out_nanos = 0;
+uintptr_t __koral_memchr(const uint8_t* data, uintptr_t len, uint8_t byte) {
+    if (len == 0) {
+        return 0;
     }
-#endif
+    const uint8_t* hit = (const uint8_t*)memchr(data, byte, (size_t)len);
+    return hit ? (uintptr_t)(hit - data) : len;
 }
 
-void __koral_local_timezone_offset(int32_t* out_offset_secs) {
-#if defined(_WIN32) || defined(_WIN64)
-    TIME_ZONE_INFORMATION tzi;
-    DWORD result = GetTimeZoneInformation(&tzi);
-    if (result == TIME_ZONE_ID_INVALID) {
-        *out_offset_secs = 0;
-    } else {
-        // Bias is in minutes, west-positive. We want east-positive seconds.
-        int32_t bias = (int32_t)tzi.Bias;
-        if (result == TIME_ZONE_ID_DAYLIGHT) {
-            bias += (int32_t)tzi.DaylightBias;
-        } else if (result == TIME_ZONE_ID_STANDARD) {
-            bias += (int32_t)tzi.StandardBias;
+uintptr_t __koral_memchr2(const uint8_t* data, uintptr_t len, uint8_t a, uint8_t b) {
+    uintptr_t i = 0;
+#if KORAL_BYTES16
+    koral_bytes16 va = __koral_bytes16_splat(a);
+    koral_bytes16 vb = __koral_bytes16_splat(b);
+    for (; i + 16 <= len; i += 16) {
+        koral_bytes16 v = __koral_bytes16_load(data + i);
+        uint32_t mask = __koral_bytes16_mask(__koral_bytes16_or(__koral_bytes16_eq(v, va), __koral_bytes16_eq(v, vb)));
+        if (mask != 0) {
+            return i + __koral_group_lowest(mask);
         }
-        *out_offset_secs = -bias * 60;
-    }
-#else
-    time_t now = time(NULL);
-    struct tm local;
-    if (localtime_r(&now, &local) != NULL) {
-        *out_offset_secs = (int32_t)local.tm_gmtoff;
-    } else {
-        *out_offset_secs = 0;
     }
 #endif
-}
-
+    for (; i < len; i++) {
+        if (data[i] == a || data[i] == b) {
+            return i;
+        }
+    }
+    return len;
+}
+
+uintptr_t __koral_memchr3(const uint8_t* data, uintptr_t len, uint8_t a, uint8_t b, uint8_t c) {
+    uintptr_t i = 0;
+#if KORAL_BYTES16
+    koral_bytes16 va = __koral_bytes16_splat(a);
+    koral_bytes16 vb = __koral_bytes16_splat(b);
+    koral_bytes16 vc = __koral_bytes16_splat(c);
+    for (; i + 16 <= len; i += 16) {
+        koral_bytes16 v = __koral_bytes16_load(data + i);
+        koral_bytes16 eq = __koral_bytes16_or(__koral_bytes16_eq(v, va), __koral_bytes16_eq(v, vb));
+        uint32_t mask = __koral_bytes16_mask(__koral_bytes16_or(eq, __koral_bytes16_eq(v, vc)));
+        if (mask != 0) {
+            return i + __koral_group_lowest(mask);
+        }
+    }
+#endif
+    for (; i < len; i++) {
+        if (data[i] == a || data[i] == b || data[i] == c) {
+            return i;
+        }
+    }
+    return len;
+}
+
+uintptr_t __koral_memrchr(const uint8_t* data, uintptr_t len, uint8_t byte) {
+    uintptr_t end = len;
+#if KORAL_BYTES16
+    koral_bytes16 vb = __koral_bytes16_splat(byte);
+    for (; end >= 16; end -= 16) {
+        uint32_t mask = __koral_bytes16_mask(__koral_bytes16_eq(__koral_bytes16_load(data + end - 16), vb));
+        if (mask != 0) {
+            return end - 16 + __koral_bytes_highest(mask);
+        }
+    }
+#endif
+    while (end > 0) {
+        end--;
+        if (data[end] == byte) {
+            return end;
+        }
+    }
+    return len;
+}
+
+// Substring search. Candidates are positions where both the first and the
+// last needle byte match, tested 16 at a time; only those are compared in
+// full. An empty needle matches at 0.
+uintptr_t __koral_memmem(const uint8_t* hay, uintptr_t hay_len, const uint8_t* needle, uintptr_t needle_len) {
+    if (needle_len == 0) {
+        return 0;
+    }
+    if (needle_len > hay_len) {
+        return hay_len;
+    }
+    if (needle_len == 1) {
+        return __koral_memchr(hay, hay_len, needle[0]);
+    }
+    uintptr_t last = needle_len - 1;
+    uintptr_t limit = hay_len - needle_len;
+    uintptr_t i = 0;
+#if KORAL_BYTES16
+    koral_bytes16 first = __koral_bytes16_splat(needle[0]);
+    koral_bytes16 tail = __koral_bytes16_splat(needle[last]);
+    for (; limit >= 15 && i <= limit - 15; i += 16) {
+        koral_bytes16 head_eq = __koral_bytes16_eq(__koral_bytes16_load(hay + i), first);
+        koral_bytes16 tail_eq = __koral_bytes16_eq(__koral_bytes16_load(hay + i + last), tail);
+        uint32_t mask = __koral_bytes16_mask(__koral_bytes16_and(head_eq, tail_eq));
+        while (mask != 0) {
+            uintptr_t at = i + __koral_group_lowest(mask);
+            if (memcmp(hay + at + 1, needle + 1, (size_t)(needle_len - 2)) == 0) {
+                return at;
+            }
+            mask &= mask - 1;
+        }
+    }
+#endif
+    while (i <= limit) {
+        const uint8_t* hit = (const uint8_t*)memchr(hay + i, needle[0], (size_t)(limit - i + 1));
+        if (hit == NULL) {
+            break;
+        }
+        i = (uintptr_t)(hit - hay);
+        if (hay[i + last] == needle[last] && memcmp(hay + i + 1, needle + 1, (size_t)(needle_len - 2)) == 0) {
+            return i;
+        }
+        i++;
+    }
+    return hay_len;
+}
+
+// ============================================================================
+// UTF-8 validation and decoding (std String)
+// ============================================================================
+//
+// __koral_utf8_validate accepts exactly the strict UTF-8 that String
+// requires: no overlong forms, no surrogates, nothing above U+10FFFF.
+// With SSSE3 or NEON it uses the Keiser-Lemire lookup algorithm (as in
+// simdjson/simdutf): three 16-entry nibble tables classify every byte pair
+// of a 16-byte block at once, and all-ASCII blocks only need a sign test.
+// Elsewhere a scalar decoder runs, skipping ASCII 16 bytes (SSE2) or
+// 8 bytes at a time.
+
+// Length of the valid UTF-8 sequence at data[0], or 0 if it is invalid.
+static inline uintptr_t __koral_utf8_sequence(const uint8_t* data, uintptr_t avail) {
+    uint8_t b0 = data[0];
+    if (b0 < 0x80) {
+        return 1;
+    }
+    if (b0 < 0xC2) {
+        return 0;
+    }
+    if (b0 < 0xE0) {
+        return (avail >= 2 && (data[1] & 0xC0) == 0x80) ? 2 : 0;
+    }
+    if (b0 < 0xF0) {
+        if (avail < 3 || (data[1] & 0xC0) != 0x80 || (data[2] & 0xC0) != 0x80) {
+            return 0;
+        }
+        if ((b0 == 0xE0 && data[1] < 0xA0) || (b0 == 0xED && data[1] >= 0xA0)) {
+            return 0;
+        }
+        return 3;
+    }
+    if (b0 < 0xF5) {
+        if (avail < 4 || (data[1] & 0xC0) != 0x80 || (data[2] & 0xC0) != 0x80 || (data[3] & 0xC0) != 0x80) {
+            return 0;
+        }
+        if ((b0 == 0xF0 && data[1] < 0x90) || (b0 == 0xF4 && data[1] >= 0x90)) {
+            return 0;
+        }
+        return 4;
+    }
+    return 0;
+}
+
+// Number of leading bytes known to be ASCII (a multiple of the step).
+static inline uintptr_t __koral_ascii_prefix(const uint8_t* data, uintptr_t len) {
+    uintptr_t i = 0;
+#if KORAL_GROUP_SSE2
+    for (; i + 16 <= len; i += 16) {
+        if (_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(data + i))) != 0) {
+            break;
+        }
+    }
+#else
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        if ((word & 0x8080808080808080ull) != 0) {
+            break;
+        }
+    }
+#endif
+    return i;
+}
+
+#if defined(__SSSE3__) || KORAL_GROUP_NEON
+#define KORAL_UTF8_BLOCKS 1
+#define KORAL_UTF8_TARGET
+#elif KORAL_GROUP_SSE2 && (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+// Baseline x86-64 builds compile the block validator for SSSE3 anyway and
+// pick it at run time when the CPU has it (every x86-64 CPU since ~2008).
+#define KORAL_UTF8_BLOCKS 1
+#define KORAL_UTF8_DISPATCH 1
+#define KORAL_UTF8_TARGET __attribute__((target("ssse3")))
+#endif
+
+#if KORAL_UTF8_BLOCKS
+#if KORAL_GROUP_SSE2
+#include <tmmintrin.h>
+typedef __m128i koral_utf8x16;
+#define KORAL_UTF8_TABLE(...) _mm_setr_epi8(__VA_ARGS__)
+KORAL_UTF8_TARGET static inline koral_utf8x16 __koral_utf8_load(const uint8_t* p) { return _mm_loadu_si128((const __m128i*)p); }
+KORAL_UTF8_TARGET static inline koral_utf8x16 __koral_utf8_splat(uint8_t b) { return _mm_set1_epi8((char)b); }
+KORAL_UTF8_TARGET static inline koral_utf8x16 __koral_utf8_lookup(koral_utf8x16 table, koral_utf8x16 nibbles) { return _mm_shuffle_epi8(table, nibbles); }
+KORAL_UTF8_TARGET static inline koral_utf8x16 __koral_utf8_high_nibbles(koral_utf8x16 v) { return _mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x0F)); }
+KORAL_UTF8_TARGET static inline koral_utf8x16 __koral_utf8_low_nibbles(koral_utf8x16 v) { return _mm_and_si128(v, _mm_set1_epi8(0x0F)); }
+KORAL_UTF8_TARGET static inline koral_utf8x16 __koral_utf8_and(koral_utf8x16 a, koral_utf8x16 b) { return _mm_and_si128(a, b); }
+KORAL_UTF8_TARGET static inline koral_utf8x16 __koral_utf8_or(koral_utf8x16 a, koral_utf8x16 b) { return _mm_or_si128(a, b); }
+KORAL_UTF8_TARGET static inline koral_utf8x16 __koral_utf8_xor(koral_utf8x16 a, koral_utf8x16 b) { return _mm_xor_si128(a, b); }
+KORAL_UTF8_TARGET static inline koral_utf8x16 __koral_utf8_subs(koral_utf8x16 a, koral_utf8x16 b) { return _mm_subs_epu8(a, b); }
+#define __koral_utf8_prev(input, prev, n) _mm_alignr_epi8((input), (prev), 16 - (n))
+KORAL_UTF8_TARGET static inline bool __koral_utf8_is_ascii(koral_utf8x16 v) { return _mm_movemask_epi8(v) == 0; }
+KORAL_UTF8_TARGET static inline bool __koral_utf8_any(koral_utf8x16 v) { return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) != 0xFFFF; }
+#else
+typedef uint8x16_t koral_utf8x16;
+#define KORAL_UTF8_TABLE(...) ((uint8x16_t){__VA_ARGS__})
+KORAL_UTF8_TARGET static inline koral_utf8x16 __koral_utf8_load(const uint8_t* p) { return vld1q_u8(p); }
+KORAL_UTF8_TARGET static inline koral_utf8x16 __koral_utf8_splat(uint8_t b) { return vdupq_n_u8(b); }
+KORAL_UTF8_TARGET static inline koral_utf8x16 __koral_utf8_lookup(koral_utf8x16 table, koral_utf8x16 nibbles) { return vqtbl1q_u8(table, nibbles); }
+KORAL_UTF8_TARGET static inline koral_utf8x16 __koral_utf8_high_nibbles(koral_utf8x16 v) { return vshrq_n_u8(v, 4); }
+KORAL_UTF8_TARGET static inline koral_utf8x16 __koral_utf8_low_nibbles(koral_utf8x16 v) { return vandq_u8(v, vdupq_n_u8(0x0F)); }
+KORAL_UTF8_TARGET static inline koral_utf8x16 __koral_utf8_and(koral_utf8x16 a, koral_utf8x16 b) { return vandq_u8(a, b); }
+KORAL_UTF8_TARGET static inline koral_utf8x16 __koral_utf8_or(koral_utf8x16 a, koral_utf8x16 b) { return vorrq_u8(a, b); }
+KORAL_UTF8_TARGET static inline koral_utf8x16 __koral_utf8_xor(koral_utf8x16 a, koral_utf8x16 b) { return veorq_u8(a, b); }
+KORAL_UTF8_TARGET static inline koral_utf8x16 __koral_utf8_subs(koral_utf8x16 a, koral_utf8x16 b) { return vqsubq_u8(a, b); }
+#define __koral_utf8_prev(input, prev, n) vextq_u8((prev), (input), 16 - (n))
+KORAL_UTF8_TARGET static inline bool __koral_utf8_is_ascii(koral_utf8x16 v) { return vmaxvq_u8(v) < 0x80; }
+KORAL_UTF8_TARGET static inline bool __koral_utf8_any(koral_utf8x16 v) { return vmaxvq_u8(v) != 0; }
+#endif
+
+#define KORAL_UTF8_TOO_SHORT (1 << 0)
+#define KORAL_UTF8_TOO_LONG (1 << 1)
+#define KORAL_UTF8_OVERLONG_3 (1 << 2)
+#define KORAL_UTF8_TOO_LARGE (1 << 3)
+#define KORAL_UTF8_SURROGATE (1 << 4)
+#define KORAL_UTF8_OVERLONG_2 (1 << 5)
+#define KORAL_UTF8_TOO_LARGE_1000 (1 << 6)
+#define KORAL_UTF8_OVERLONG_4 (1 << 6)
+#define KORAL_UTF8_TWO_CONTS (1 << 7)
+#define KORAL_UTF8_CARRY (KORAL_UTF8_TOO_SHORT | KORAL_UTF8_TOO_LONG | KORAL_UTF8_TWO_CONTS)
+
+// Error bits for every (previous byte, byte) pair of the block. Each table
+// flags the errors its nibble allows; a pair is wrong when all three agree.
+KORAL_UTF8_TARGET static inline koral_utf8x16 __koral_utf8_special_cases(koral_utf8x16 input, koral_utf8x16 prev1) {
+    const koral_utf8x16 byte_1_high = KORAL_UTF8_TABLE(
+        KORAL_UTF8_TOO_LONG, KORAL_UTF8_TOO_LONG, KORAL_UTF8_TOO_LONG, KORAL_UTF8_TOO_LONG,
+        KORAL_UTF8_TOO_LONG, KORAL_UTF8_TOO_LONG, KORAL_UTF8_TOO_LONG, KORAL_UTF8_TOO_LONG,
+        KORAL_UTF8_TWO_CONTS, KORAL_UTF8_TWO_CONTS, KORAL_UTF8_TWO_CONTS, KORAL_UTF8_TWO_CONTS,
+        KORAL_UTF8_TOO_SHORT | KORAL_UTF8_OVERLONG_2,
+        KORAL_UTF8_TOO_SHORT,
+        KORAL_UTF8_TOO_SHORT | KORAL_UTF8_OVERLONG_3 | KORAL_UTF8_SURROGATE,
+        KORAL_UTF8_TOO_SHORT | KORAL_UTF8_TOO_LARGE | KORAL_UTF8_TOO_LARGE_1000 | KORAL_UTF8_OVERLONG_4);
+    const koral_utf8x16 byte_1_low = KORAL_UTF8_TABLE(
+        KORAL_UTF8_CARRY | KORAL_UTF8_OVERLONG_3 | KORAL_UTF8_OVERLONG_2 | KORAL_UTF8_OVERLONG_4,
+        KORAL_UTF8_CARRY | KORAL_UTF8_OVERLONG_2,
+        KORAL_UTF8_CARRY,
+        KORAL_UTF8_CARRY,
+        KORAL_UTF8_CARRY | KORAL_UTF8_TOO_LARGE,
+        KORAL_UTF8_CARRY | KORAL_UTF8_TOO_LARGE | KORAL_UTF8_TOO_LARGE_1000,
+        KORAL_UTF8_CARRY | KORAL_UTF8_TOO_LARGE | KORAL_UTF8_TOO_LARGE_1000,
+        KORAL_UTF8_CARRY | KORAL_UTF8_TOO_LARGE | KORAL_UTF8_TOO_LARGE_1000,
+        KORAL_UTF8_CARRY | KORAL_UTF8_TOO_LARGE | KORAL_UTF8_TOO_LARGE_1000,
+        KORAL_UTF8_CARRY | KORAL_UTF8_TOO_LARGE | KORAL_UTF8_TOO_LARGE_1000,
+        KORAL_UTF8_CARRY | KORAL_UTF8_TOO_LARGE | KORAL_UTF8_TOO_LARGE_1000,
+        KORAL_UTF8_CARRY | KORAL_UTF8_TOO_LARGE | KORAL_UTF8_TOO_LARGE_1000,
+        KORAL_UTF8_CARRY | KORAL_UTF8_TOO_LARGE | KORAL_UTF8_TOO_LARGE_1000,
+        KORAL_UTF8_CARRY | KORAL_UTF8_TOO_LARGE | KORAL_UTF8_TOO_LARGE_1000 | KORAL_UTF8_SURROGATE,
+        KORAL_UTF8_CARRY | KORAL_UTF8_TOO_LARGE | KORAL_UTF8_TOO_LARGE_1000,
+        KORAL_UTF8_CARRY | KORAL_UTF8_TOO_LARGE | KORAL_UTF8_TOO_LARGE_1000);
+    const koral_utf8x16 byte_2_high = KORAL_UTF8_TABLE(
+        KORAL_UTF8_TOO_SHORT, KORAL_UTF8_TOO_SHORT, KORAL_UTF8_TOO_SHORT, KORAL_UTF8_TOO_SHORT,
+        KORAL_UTF8_TOO_SHORT, KORAL_UTF8_TOO_SHORT, KORAL_UTF8_TOO_SHORT, KORAL_UTF8_TOO_SHORT,
+        KORAL_UTF8_TOO_LONG | KORAL_UTF8_OVERLONG_2 | KORAL_UTF8_TWO_CONTS | KORAL_UTF8_OVERLONG_3 | KORAL_UTF8_TOO_LARGE_1000 | KORAL_UTF8_OVERLONG_4,
+        KORAL_UTF8_TOO_LONG | KORAL_UTF8_OVERLONG_2 | KORAL_UTF8_TWO_CONTS | KORAL_UTF8_OVERLONG_3 | KORAL_UTF8_TOO_LARGE,
+        KORAL_UTF8_TOO_LONG | KORAL_UTF8_OVERLONG_2 | KORAL_UTF8_TWO_CONTS | KORAL_UTF8_SURROGATE | KORAL_UTF8_TOO_LARGE,
+        KORAL_UTF8_TOO_LONG | KORAL_UTF8_OVERLONG_2 | KORAL_UTF8_TWO_CONTS | KORAL_UTF8_SURROGATE | KORAL_UTF8_TOO_LARGE,
+        KORAL_UTF8_TOO_SHORT, KORAL_UTF8_TOO_SHORT, KORAL_UTF8_TOO_SHORT, KORAL_UTF8_TOO_SHORT);
+    koral_utf8x16 b1h = __koral_utf8_lookup(byte_1_high, __koral_utf8_high_nibbles(prev1));
+    koral_utf8x16 b1l = __koral_utf8_lookup(byte_1_low, __koral_utf8_low_nibbles(prev1));
+    koral_utf8x16 b2h = __koral_utf8_lookup(byte_2_high, __koral_utf8_high_nibbles(input));
+    return __koral_utf8_and(__koral_utf8_and(b1h, b1l), b2h);
+}
+
+// Adds the third/fourth-byte continuation checks that the pair tables
+// cannot see: bytes two or three positions after a 3/4-byte lead.
+KORAL_UTF8_TARGET static inline koral_utf8x16 __koral_utf8_block_errors(koral_utf8x16 input, koral_utf8x16 prev_input) {
+    koral_utf8x16 prev1 = __koral_utf8_prev(input, prev_input, 1);
+    koral_utf8x16 prev2 = __koral_utf8_prev(input, prev_input, 2);
+    koral_utf8x16 prev3 = __koral_utf8_prev(input, prev_input, 3);
+    koral_utf8x16 special = __koral_utf8_special_cases(input, prev1);
+    koral_utf8x16 third = __koral_utf8_subs(prev2, __koral_utf8_splat(0xE0 - 0x80));
+    koral_utf8x16 fourth = __koral_utf8_subs(prev3, __koral_utf8_splat(0xF0 - 0x80));
+    koral_utf8x16 must23 = __koral_utf8_and(__koral_utf8_or(third, fourth), __koral_utf8_splat(0x80));
+    return __koral_utf8_xor(must23, special);
+}
+
+// Non-zero when the block ends inside a multi-byte sequence.
+KORAL_UTF8_TARGET static inline koral_utf8x16 __koral_utf8_incomplete(koral_utf8x16 input) {
+    const koral_utf8x16 max = KORAL_UTF8_TABLE(
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xF0 - 1, 0xE0 - 1, 0xC0 - 1);
+    return __koral_utf8_subs(input, max);
+}
+
+KORAL_UTF8_TARGET static bool __koral_utf8_validate_blocks(const uint8_t* data, uintptr_t len) {
+    koral_utf8x16 zero = __koral_utf8_splat(0);
+    koral_utf8x16 prev_input = zero;
+    koral_utf8x16 prev_incomplete = zero;
+    koral_utf8x16 error = zero;
+    uintptr_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        koral_utf8x16 input = __koral_utf8_load(data + i);
+        if (__koral_utf8_is_ascii(input)) {
+            error = __koral_utf8_or(error, prev_incomplete);
+        } else {
+            error = __koral_utf8_or(error, __koral_utf8_block_errors(input, prev_input));
+            prev_incomplete = __koral_utf8_incomplete(input);
+        }
+        prev_input = input;
+    }
+    uint8_t tail[16] = {0};
+    memcpy(tail, data + i, (size_t)(len - i));
+    koral_utf8x16 input = __koral_utf8_load(tail);
+    error = __koral_utf8_or(error, __koral_utf8_block_errors(input, prev_input));
+    error = __koral_utf8_or(error, __koral_utf8_incomplete(input));
+    return !__koral_utf8_any(error);
+}
+#endif
+
+#if !KORAL_UTF8_BLOCKS || KORAL_UTF8_DISPATCH
+static bool __koral_utf8_validate_scalar(const uint8_t* data, uintptr_t len) {
+    uintptr_t i = 0;
+    while (i < len) {
+        if (data[i] < 0x80) {
+            i += 1 + __koral_ascii_prefix(data + i + 1, len - i - 1);
+            continue;
+        }
+        uintptr_t n = __koral_utf8_sequence(data + i, len - i);
+        if (n == 0) {
+            return false;
+        }
+        i += n;
+    }
+    return true;
+}
+#endif
+
+// Returns 1 when data[0..len) is valid UTF-8, 0 otherwise.
+int32_t __koral_utf8_validate(const uint8_t* data, uintptr_t len) {
+    uintptr_t ascii = __koral_ascii_prefix(data, len);
+    data += ascii;
+    len -= ascii;
+    if (len == 0) {
+        return 1;
+    }
+#if KORAL_UTF8_DISPATCH
+    if (!__builtin_cpu_supports("ssse3")) {
+        return __koral_utf8_validate_scalar(data, len) ? 1 : 0;
+    }
+#elif !KORAL_UTF8_BLOCKS
+    return __koral_utf8_validate_scalar(data, len) ? 1 : 0;
+#endif
+#if KORAL_UTF8_BLOCKS
+    return __koral_utf8_validate_blocks(data, len) ? 1 : 0;
+#endif
+}
+
+// Decodes data into out (room for `len` runes) and returns the rune count.
+// Invalid input decodes like StringRunesIterator: U+FFFD, skipping the
+// whole sequence for overlong or out-of-range code points and one byte for
+// anything else.
+uintptr_t __koral_utf8_decode(const uint8_t* data, uintptr_t len, uint32_t* out) {
+    uintptr_t i = 0;
+    uintptr_t n = 0;
+    while (i < len) {
+        uintptr_t ascii = __koral_ascii_prefix(data + i, len - i);
+        for (uintptr_t k = 0; k < ascii; k++) {
+            out[n + k] = data[i + k];
+        }
+        i += ascii;
+        n += ascii;
+        if (i >= len) {
+            break;
+        }
+        uint8_t b0 = data[i];
+        if (b0 < 0x80) {
+            out[n++] = b0;
+            i += 1;
+            continue;
+        }
+        uint32_t cp = 0xFFFD;
+        uintptr_t step = 1;
+        if (b0 >= 0xC0 && b0 < 0xF8) {
+            uintptr_t need = b0 < 0xE0 ? 2 : (b0 < 0xF0 ? 3 : 4);
+            bool ok = i + need - 1 < len;
+            for (uintptr_t k = 1; ok && k < need; k++) {
+                ok = (data[i + k] & 0xC0) == 0x80;
+            }
+            if (ok) {
+                step = need;
+                if (need == 2) {
+                    cp = ((uint32_t)(b0 & 0x1F) << 6) | (data[i + 1] & 0x3F);
+                    if (cp < 0x80) {
+                        cp = 0xFFFD;
+                    }
+                } else if (need == 3) {
+                    cp = ((uint32_t)(b0 & 0x0F) << 12) | ((uint32_t)(data[i + 1] & 0x3F) << 6) | (data[i + 2] & 0x3F);
+                    if (cp < 0x800 || (cp >= 0xD800 && cp <= 0xDFFF)) {
+                        cp = 0xFFFD;
+                    }
+                } else {
+                    cp = ((uint32_t)(b0 & 0x07) << 18) | ((uint32_t)(data[i + 1] & 0x3F) << 12) |
+                         ((uint32_t)(data[i + 2] & 0x3F) << 6) | (data[i + 3] & 0x3F);
+                    if (cp < 0x10000 || cp > 0x10FFFF) {
+                        cp = 0xFFFD;
+                    }
+                }
+            }
+        }
+        out[n++] = cp;
+        i += step;
+    }
+    return n;
+}
+
+// ============================================================================
+// File helpers (stdlib wrappers)
+// ============================================================================
+
+int32_t __koral_remove(const uint8_t* path) {
+    return (int32_t)remove((const char*)path);
+}
+
+int32_t __koral_rename(const uint8_t* old_path, const uint8_t* new_path) {
+    return (int32_t)rename((const char*)old_path, (const char*)new_path);
+}
+
+uint8_t* __koral_getenv(const uint8_t* name) {
+    return (uint8_t*)getenv((const char*)name);
+}
+
+int32_t __koral_system(const uint8_t* command) {
+    return (int32_t)system((const char*)command);
+}
+
+// ============================================================================
+// Time helpers
+// ============================================================================
+
+void __koral_monotonic_now(int64_t* out_secs, int64_t* out_nanos) {
+#if defined(_WIN32) || defined(_WIN64)
+    LARGE_INTEGER freq, counter;
+    if (QueryPerformanceFrequency(&freq) && QueryPerformanceCounter(&counter) && freq.QuadPart > 0) {
+        *out_secs = counter.QuadPart / freq.QuadPart;
+        *out_nanos = (int64_t)((counter.QuadPart % freq.QuadPart) * 1000000000LL / freq.QuadPart);
+    } else {
+        *out_secs = 0;
+        *out_nanos = 0;
+    }
+#else
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+        *out_secs = (int64_t)ts.tv_sec;
+        *out_nanos = (int64_t)ts.tv_nsec;
+    } else {
+        *out_secs = 0;
+        *out_nanos = 0;
+    }
+#endif
+}
+
+void __koral_wallclock_now(int64_t* out_secs, int64_t* out_nanos) {
+#if defined(_WIN32) || defined(_WIN64)
+    // Windows FILETIME epoch: 1601-01-01, Unix epoch: 1970-01-01
+    // Difference: 11644473600 seconds = 116444736000000000 * 100ns
+    static const int64_t EPOCH_DIFF = 116444736000000000LL;
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    int64_t ticks = ((int64_t)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+    ticks -= EPOCH_DIFF;
+    *out_secs = ticks / 10000000LL;
+    *out_nanos = (ticks % 10000000LL) * 100LL;
+#else
+    struct timespec ts;
+    if (clock_gettime(CLOCK_REALTIME, &ts) == 0) {
+        *out_secs = (int64_t)ts.tv_sec;
+        *out_nanos = (int64_t)ts.tv_nsec;
+    } else {
+        *out_secs = 0;
+        *out_nanos = 0;
+    }
+#endif
+}
+
+void __koral_local_timezone_offset(int32_t* out_offset_secs) {
+#if defined(_WIN32) || defined(_WIN64)
+    TIME_ZONE_INFORMATION tzi;
+    DWORD result = GetTimeZoneInformation(&tzi);
+    if (result == TIME_ZONE_ID_INVALID) {
+        *out_offset_secs = 0;
+    } else {
+        // Bias is in minutes, west-positive. We want east-positive seconds.
+        int32_t bias = (int32_t)tzi.Bias;
+        if (result == TIME_ZONE_ID_DAYLIGHT) {
+            bias += (int32_t)tzi.DaylightBias;
+        } else if (result == TIME_ZONE_ID_STANDARD) {
+            bias += (int32_t)tzi.StandardBias;
+        }
+        *out_offset_secs = -bias * 60;
+    }
+#else
+    time_t now = time(NULL);
+    struct tm local;
+    if (localtime_r(&now, &local) != NULL) {
+        *out_offset_secs = (int32_t)local.tm_gmtoff;
+    } else {
+        *out_offset_secs = 0;
+    }
+#endif
+}
+
 int32_t __koral_local_timezone_name(char* buf, int32_t buf_size) {
     if (buf_size <= 0) return 0;
     buf[0] = '\0';
@@ -1052,692 +2477,1240 @@ int32_t __koral_random_fill(uint8_t* buf, int32_t len) {
 #endif
 
 // ============================================================================
-// Regex: POSIX regular expression support
+// Regex: portable Pike VM with a lazy DFA (std.text)
 // ============================================================================
+//
+// Patterns use POSIX extended syntax plus the \d \w \s \b escapes and are
+// compiled to a small NFA program. Searches never backtrack, so match time
+// is linear in the input length for every pattern:
+//
+//   - matches()-style queries (max_groups == 0) run a lazily built DFA whose
+//     states are cached on the compiled regex;
+//   - find/captures first reject non-matching input with the same DFA, then
+//     run a Pike VM that tracks capture slots (leftmost-longest, like POSIX);
+//   - a literal prefix is located with memchr before either engine starts.
+//
+// Flags match RegexFlag.to_c_flags(): 2 = ignore case, 4 = multiline
+// (^/$ also match around '\n', and '.' / negated classes exclude '\n').
+
+#define KORAL_RE_ICASE      2
+#define KORAL_RE_NEWLINE    4
+
+#define KORAL_RE_MAX_INST   65536   // program size limit ("too big")
+#define KORAL_RE_MAX_REPEAT 1000    // largest {n,m} bound
+#define KORAL_RE_MAX_DEPTH  1000    // group nesting limit
+#define KORAL_RE_DFA_STATES 2048    // cached DFA states before the cache is flushed
+#define KORAL_RE_MAX_PREFIX 32
 
-#if !defined(_WIN32) && !defined(_WIN64)
+enum {
+    KORAL_RE_OP_CLASS,   // consume one byte in classes[cls]
+    KORAL_RE_OP_SPLIT,   // fork: x preferred, then y
+    KORAL_RE_OP_JMP,     // goto x
+    KORAL_RE_OP_SAVE,    // record position in capture slot `arg`
+    KORAL_RE_OP_ASSERT,  // zero-width KORAL_RE_ASSERT_* check
+    KORAL_RE_OP_MATCH,
+};
 
-static char* __koral_regex_translate_pattern_posix(const char* pattern) {
-    if (!pattern) return NULL;
+enum {
+    KORAL_RE_ASSERT_BOL,
+    KORAL_RE_ASSERT_EOL,
+    KORAL_RE_ASSERT_WORD,
+    KORAL_RE_ASSERT_NOT_WORD,
+};
 
-    size_t src_len = strlen(pattern);
-    // Enough headroom for replacements like "[^[:space:]]".
-    size_t cap = src_len * 12 + 1;
-    char* out = (char*)malloc(cap);
-    if (!out) return NULL;
+typedef struct {
+    uint8_t op;
+    uint8_t arg;        // assertion kind
+    int32_t x, y;       // SPLIT / JMP targets, CLASS index, SAVE slot
+} KoralReInst;
 
-    size_t i = 0;
-    size_t j = 0;
-    while (i < src_len) {
-        if (pattern[i] == '\\' && i + 1 < src_len) {
-            const char* repl = NULL;
-            switch (pattern[i + 1]) {
-                case 'd': repl = "[0-9]"; break;
-                case 'D': repl = "[^0-9]"; break;
-                case 'w': repl = "[A-Za-z0-9_]"; break;
-                case 'W': repl = "[^A-Za-z0-9_]"; break;
-                case 's': repl = "[[:space:]]"; break;
-                case 'S': repl = "[^[:space:]]"; break;
-                default: break;
-            }
+typedef struct {
+    uint64_t bits[4];
+} KoralReClass;
 
-            if (repl) {
-                size_t rlen = strlen(repl);
-                memcpy(out + j, repl, rlen);
-                j += rlen;
-                i += 2;
-                continue;
-            }
-        }
+// Parse tree, stored in one array and addressed by index.
+enum {
+    KORAL_RE_NODE_EMPTY,
+    KORAL_RE_NODE_CLASS,
+    KORAL_RE_NODE_ASSERT,
+    KORAL_RE_NODE_CONCAT,
+    KORAL_RE_NODE_ALT,
+    KORAL_RE_NODE_GROUP,
+    KORAL_RE_NODE_REPEAT,
+};
 
-        out[j++] = pattern[i++];
-    }
+typedef struct {
+    int32_t kind;
+    int32_t a, b;       // children (CONCAT/ALT), child (GROUP/REPEAT)
+    int32_t value;      // class index, assertion kind or group number
+    int32_t min, max;   // REPEAT bounds, max < 0 means unbounded
+} KoralReNode;
 
-    out[j] = '\0';
-    return out;
-}
+typedef struct {
+    int32_t* stack;
+    uint8_t* seen;
+    int32_t* pcs;
+    int32_t count;
+} KoralReSet;
 
-int32_t __koral_regex_compile(const char* pattern, int32_t flags,
-                            void** out_handle,
-                            char* out_error_buf, int32_t error_buf_size,
-                            int32_t* out_error_len) {
-    KoralPosixRegex* compiled = (KoralPosixRegex*)malloc(sizeof(KoralPosixRegex));
-    if (!compiled) {
-        const char* msg = "out of memory";
-        int32_t msg_len = (int32_t)strlen(msg);
-        if (msg_len > error_buf_size - 1) {
-            msg_len = error_buf_size - 1;
-        }
-        memcpy(out_error_buf, msg, (size_t)msg_len);
-        out_error_buf[msg_len] = '\0';
-        *out_error_len = msg_len;
-        return -1;
-    }
+// One cached DFA state: a set of NFA pcs plus whether '^' holds here.
+typedef struct {
+    int32_t* pcs;
+    int32_t count;
+    uint32_t hash;
+    uint8_t at_bol;
+    uint8_t match;          // MATCH is in the set
+    uint8_t match_at_end;   // MATCH is reachable if the text ends here
+    int32_t next[256];      // (state << 1) | matched-before-byte, -1 = not built
+} KoralReDfaState;
 
-    char* translated = __koral_regex_translate_pattern_posix(pattern);
-    if (!translated) {
-        const char* msg = "out of memory";
-        int32_t msg_len = (int32_t)strlen(msg);
-        if (msg_len > error_buf_size - 1) {
-            msg_len = error_buf_size - 1;
-        }
-        memcpy(out_error_buf, msg, (size_t)msg_len);
-        out_error_buf[msg_len] = '\0';
-        *out_error_len = msg_len;
-        free(compiled);
-        return -1;
-    }
+typedef struct {
+    KoralReInst* prog;
+    int32_t len;
+    KoralReClass* classes;
+    int32_t class_count;
+    int32_t ngroups;        // capture groups including $0
+    int32_t flags;
+    uint8_t has_word_assert;
+    uint8_t prefix[KORAL_RE_MAX_PREFIX];
+    int32_t prefix_len;
 
-    const char* compile_pattern = translated;
-    if (compile_pattern[0] == '\0') {
-        // POSIX regex engines may reject empty patterns in extended mode.
-        // std.regex expects empty pattern to match any input.
-        compile_pattern = ".*";
-    }
-    int rc = regcomp(&compiled->compiled, compile_pattern, flags | REG_EXTENDED);
-    free(translated);
-    if (rc != 0) {
-        size_t err_len = regerror(rc, &compiled->compiled, out_error_buf, (size_t)error_buf_size);
-        if (err_len > 0 && out_error_buf[err_len - 1] == '\0') {
-            err_len--;
-        }
-        *out_error_len = (int32_t)err_len;
-        regfree(&compiled->compiled);
-        free(compiled);
-        return rc;
-    }
+    // Lazy DFA cache, used by one search at a time; a search that finds it
+    // busy falls back to the Pike VM instead of waiting.
+    atomic_int dfa_busy;
+    KoralReDfaState** states;
+    int32_t state_count;
+    int32_t* table;         // open-addressing hash of state indices
+    int32_t table_size;
+    int32_t start[2];       // start state by at_bol, -1 = not built
+    KoralReSet* dfa_set;    // closure scratch, allocated on first search
+} KoralRegex;
 
-    compiled->flags = flags;
-    *out_handle = compiled;
-    return 0;
+// --- Classes ---
+
+static void __koral_re_class_set(KoralReClass* cls, int c) {
+    cls->bits[c >> 6] |= (uint64_t)1 << (c & 63);
 }
 
-int32_t __koral_regex_match(void* handle, const char* text, int32_t text_offset,
-                          int32_t max_groups,
-                          int32_t* out_starts, int32_t* out_ends) {
-    KoralPosixRegex* compiled = (KoralPosixRegex*)handle;
-    regmatch_t pmatch[max_groups];
-
-    int rc = regexec(&compiled->compiled, text + text_offset, (size_t)max_groups, pmatch, 0);
-    int32_t base_offset = text_offset;
-
-    // On some POSIX engines, ^ with REG_NEWLINE can still miss line-internal
-    // starts in certain combinations. Fallback by trying every line start.
-    if (rc != 0 && (compiled->flags & 4) != 0) {
-        int32_t text_len = (int32_t)strlen(text);
-        for (int32_t pos = text_offset + 1; pos <= text_len; pos++) {
-            if (text[pos - 1] != '\n') {
-                continue;
-            }
-            rc = regexec(&compiled->compiled, text + pos, (size_t)max_groups, pmatch, 0);
-            if (rc == 0) {
-                base_offset = pos;
-                break;
-            }
-        }
-    }
+static int __koral_re_class_has(const KoralReClass* cls, int c) {
+    return (int)((cls->bits[c >> 6] >> (c & 63)) & 1);
+}
 
-    if (rc != 0) {
-        return 0;  // no match
-    }
+static void __koral_re_class_range(KoralReClass* cls, int lo, int hi) {
+    for (int c = lo; c <= hi; c++) __koral_re_class_set(cls, c);
+}
 
-    int32_t matched = 0;
-    for (int32_t i = 0; i < max_groups; i++) {
-        if (pmatch[i].rm_so == -1) {
-            out_starts[i] = -1;
-            out_ends[i] = -1;
-        } else {
-            out_starts[i] = (int32_t)pmatch[i].rm_so + base_offset;
-            out_ends[i] = (int32_t)pmatch[i].rm_eo + base_offset;
-            matched = i + 1;
-        }
-    }
+static void __koral_re_class_invert(KoralReClass* cls) {
+    for (int i = 0; i < 4; i++) cls->bits[i] = ~cls->bits[i];
+}
 
-    return matched > 0 ? matched : 1;
+static int __koral_re_is_word(int c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
 }
 
-void __koral_regex_free(void* handle) {
-    KoralPosixRegex* compiled = (KoralPosixRegex*)handle;
-    regfree(&compiled->compiled);
-    free(compiled);
+// Adds \d \w \s (lowercase) to `cls`; returns 0 for other letters.
+static int __koral_re_class_escape(KoralReClass* cls, int c) {
+    switch (c) {
+        case 'd': __koral_re_class_range(cls, '0', '9'); return 1;
+        case 'w':
+            __koral_re_class_range(cls, 'a', 'z');
+            __koral_re_class_range(cls, 'A', 'Z');
+            __koral_re_class_range(cls, '0', '9');
+            __koral_re_class_set(cls, '_');
+            return 1;
+        case 's':
+            __koral_re_class_set(cls, ' ');
+            __koral_re_class_range(cls, '\t', '\r');
+            return 1;
+        default: return 0;
+    }
 }
 
-#endif  // !_WIN32 && !_WIN64
+// Adds a POSIX [:name:] class; returns 0 for an unknown name.
+static int __koral_re_class_named(KoralReClass* cls, const char* name, size_t len) {
+#define KORAL_RE_NAMED(str) (len == sizeof(str) - 1 && memcmp(name, str, len) == 0)
+    if (KORAL_RE_NAMED("alpha")) {
+        __koral_re_class_range(cls, 'a', 'z');
+        __koral_re_class_range(cls, 'A', 'Z');
+    } else if (KORAL_RE_NAMED("digit")) {
+        __koral_re_class_range(cls, '0', '9');
+    } else if (KORAL_RE_NAMED("alnum")) {
+        __koral_re_class_range(cls, 'a', 'z');
+        __koral_re_class_range(cls, 'A', 'Z');
+        __koral_re_class_range(cls, '0', '9');
+    } else if (KORAL_RE_NAMED("upper")) {
+        __koral_re_class_range(cls, 'A', 'Z');
+    } else if (KORAL_RE_NAMED("lower")) {
+        __koral_re_class_range(cls, 'a', 'z');
+    } else if (KORAL_RE_NAMED("space")) {
+        __koral_re_class_set(cls, ' ');
+        __koral_re_class_range(cls, '\t', '\r');
+    } else if (KORAL_RE_NAMED("blank")) {
+        __koral_re_class_set(cls, ' ');
+        __koral_re_class_set(cls, '\t');
+    } else if (KORAL_RE_NAMED("xdigit")) {
+        __koral_re_class_range(cls, '0', '9');
+        __koral_re_class_range(cls, 'a', 'f');
+        __koral_re_class_range(cls, 'A', 'F');
+    } else if (KORAL_RE_NAMED("punct")) {
+        __koral_re_class_range(cls, '!', '/');
+        __koral_re_class_range(cls, ':', '@');
+        __koral_re_class_range(cls, '[', '`');
+        __koral_re_class_range(cls, '{', '~');
+    } else if (KORAL_RE_NAMED("cntrl")) {
+        __koral_re_class_range(cls, 0, 31);
+        __koral_re_class_set(cls, 127);
+    } else if (KORAL_RE_NAMED("print")) {
+        __koral_re_class_range(cls, ' ', '~');
+    } else if (KORAL_RE_NAMED("graph")) {
+        __koral_re_class_range(cls, '!', '~');
+    } else {
+        return 0;
+    }
+    return 1;
+#undef KORAL_RE_NAMED
+}
 
-// ============================================================================
-// Windows: Minimal POSIX ERE regex implementation
-// ============================================================================
-#if defined(_WIN32) || defined(_WIN64)
-
-// Regex node types for the NFA
-enum {
-    RE_LIT,      // literal character
-    RE_DOT,      // .
-    RE_CCLASS,   // [...]
-    RE_NCCLASS,  // [^...]
-    RE_BOL,      // ^
-    RE_EOL,      // $
-    RE_GROUP_S,  // ( start
-    RE_GROUP_E,  // ) end
-    RE_SPLIT,    // split (for |, *, +, ?)
-    RE_JMP,      // unconditional jump
-    RE_MATCH,    // match state
-    RE_DIGIT,    // \d
-    RE_NDIGIT,   // \D
-    RE_WORD,     // \w
-    RE_NWORD,    // \W
-    RE_SPACE,    // \s
-    RE_NSPACE,   // \S
-};
-
-typedef struct {
-    int type;
-    int ch;           // for RE_LIT
-    int group;        // for RE_GROUP_S/E
-    int x, y;         // for RE_SPLIT: x=primary, y=alt; for RE_JMP: x=target
-    uint8_t cclass[32]; // bitmap for RE_CCLASS/RE_NCCLASS
-} ReInst;
-
-#define RE_MAX_INST 4096
-#define RE_MAX_GROUPS 10
+// --- Parser ---
 
 typedef struct {
-    ReInst inst[RE_MAX_INST];
-    int len;
-    int ngroups;
-    int flags;
-    char error[256];
-} ReCompiled;
-
-// Forward declarations
-static int re_compile_expr(ReCompiled* re, const char* p, int* pos, int plen);
+    const char* p;
+    int32_t len;
+    int32_t pos;
+    int32_t depth;
+    KoralRegex* re;
+    KoralReNode* nodes;
+    int32_t node_count;
+    int32_t node_cap;
+    int32_t class_cap;
+    int32_t prog_cap;
+    int32_t* spine;         // scratch for flattening CONCAT / ALT chains
+    int32_t spine_top;
+    const char* error;
+} KoralReParser;
+
+static int32_t __koral_re_node(KoralReParser* ps, int32_t kind, int32_t a, int32_t b, int32_t value) {
+    if (ps->node_count == ps->node_cap) {
+        int32_t cap = ps->node_cap ? ps->node_cap * 2 : 64;
+        KoralReNode* nodes = (KoralReNode*)realloc(ps->nodes, (size_t)cap * sizeof(KoralReNode));
+        if (!nodes) {
+            ps->error = "out of memory";
+            return -1;
+        }
+        ps->nodes = nodes;
+        ps->node_cap = cap;
+    }
+    KoralReNode* n = &ps->nodes[ps->node_count];
+    n->kind = kind;
+    n->a = a;
+    n->b = b;
+    n->value = value;
+    n->min = 0;
+    n->max = 0;
+    return ps->node_count++;
+}
+
+// Appends `cls` (case-folded and newline-adjusted) and returns a CLASS node.
+static int32_t __koral_re_class_node(KoralReParser* ps, KoralReClass cls, int negated) {
+    KoralRegex* re = ps->re;
+    if (re->flags & KORAL_RE_ICASE) {
+        for (int c = 'a'; c <= 'z'; c++) {
+            if (__koral_re_class_has(&cls, c) || __koral_re_class_has(&cls, c - 32)) {
+                __koral_re_class_set(&cls, c);
+                __koral_re_class_set(&cls, c - 32);
+            }
+        }
+    }
+    if (negated) {
+        __koral_re_class_invert(&cls);
+    }
+    if (negated && (re->flags & KORAL_RE_NEWLINE)) {
+        cls.bits['\n' >> 6] &= ~((uint64_t)1 << ('\n' & 63));
+    }
+    if (re->class_count == ps->class_cap) {
+        int32_t cap = ps->class_cap ? ps->class_cap * 2 : 16;
+        KoralReClass* classes = (KoralReClass*)realloc(re->classes, (size_t)cap * sizeof(KoralReClass));
+        if (!classes) {
+            ps->error = "out of memory";
+            return -1;
+        }
+        re->classes = classes;
+        ps->class_cap = cap;
+    }
+    re->classes[re->class_count] = cls;
+    return __koral_re_node(ps, KORAL_RE_NODE_CLASS, -1, -1, re->class_count++);
+}
 
-static void cc_set(uint8_t* cc, int c) { cc[c >> 3] |= (1 << (c & 7)); }
-static int cc_test(const uint8_t* cc, int c) { return (cc[c >> 3] >> (c & 7)) & 1; }
+static int32_t __koral_re_parse_alt(KoralReParser* ps);
 
-static int re_emit(ReCompiled* re, int type) {
-    if (re->len >= RE_MAX_INST) return -1;
-    memset(&re->inst[re->len], 0, sizeof(ReInst));
-    re->inst[re->len].type = type;
-    re->inst[re->len].x = -1;
-    re->inst[re->len].y = -1;
-    return re->len++;
+static int __koral_re_escape_char(int c) {
+    switch (c) {
+        case 'n': return '\n';
+        case 't': return '\t';
+        case 'r': return '\r';
+        case 'f': return '\f';
+        case 'v': return '\v';
+        default: return c;
+    }
 }
 
-static int is_digit(int c) { return c >= '0' && c <= '9'; }
-static int is_word(int c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_'; }
-static int is_space(int c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v'; }
-
-static int re_parse_cclass(ReCompiled* re, const char* p, int* pos, int plen) {
-    int negate = 0;
-    int idx = re_emit(re, RE_CCLASS);
-    if (idx < 0) return -1;
-    if (*pos < plen && p[*pos] == '^') {
-        negate = 1;
-        re->inst[idx].type = RE_NCCLASS;
-        (*pos)++;
+// Parses a bracket expression; `ps->pos` is just past '['.
+static int32_t __koral_re_parse_bracket(KoralReParser* ps) {
+    KoralReClass cls;
+    memset(&cls, 0, sizeof(cls));
+    int negated = 0;
+    if (ps->pos < ps->len && ps->p[ps->pos] == '^') {
+        negated = 1;
+        ps->pos++;
     }
-    memset(re->inst[idx].cclass, 0, 32);
     int first = 1;
-    while (*pos < plen && (first || p[*pos] != ']')) {
+    while (1) {
+        if (ps->pos >= ps->len) {
+            ps->error = "Unmatched [, [^, [:, [., or [=";
+            return -1;
+        }
+        int c = (unsigned char)ps->p[ps->pos];
+        if (c == ']' && !first) {
+            ps->pos++;
+            break;
+        }
         first = 0;
-        int c = (unsigned char)p[*pos];
-        (*pos)++;
-        if (c == '\\' && *pos < plen) {
-            c = (unsigned char)p[*pos];
-            (*pos)++;
-            switch (c) {
-                case 'd': for (int i = '0'; i <= '9'; i++) cc_set(re->inst[idx].cclass, i); continue;
-                case 'w': for (int i = 'a'; i <= 'z'; i++) cc_set(re->inst[idx].cclass, i);
-                          for (int i = 'A'; i <= 'Z'; i++) cc_set(re->inst[idx].cclass, i);
-                          for (int i = '0'; i <= '9'; i++) cc_set(re->inst[idx].cclass, i);
-                          cc_set(re->inst[idx].cclass, '_'); continue;
-                case 's': cc_set(re->inst[idx].cclass, ' '); cc_set(re->inst[idx].cclass, '\t');
-                          cc_set(re->inst[idx].cclass, '\n'); cc_set(re->inst[idx].cclass, '\r');
-                          cc_set(re->inst[idx].cclass, '\f'); cc_set(re->inst[idx].cclass, '\v'); continue;
-                default: break; // literal escaped char
+        if (c == '[' && ps->pos + 1 < ps->len && ps->p[ps->pos + 1] == ':') {
+            const char* name = ps->p + ps->pos + 2;
+            const char* end = NULL;
+            for (int32_t i = ps->pos + 2; i + 1 < ps->len; i++) {
+                if (ps->p[i] == ':' && ps->p[i + 1] == ']') {
+                    end = ps->p + i;
+                    break;
+                }
+            }
+            if (!end || !__koral_re_class_named(&cls, name, (size_t)(end - name))) {
+                ps->error = "Invalid character class name";
+                return -1;
             }
+            ps->pos = (int32_t)(end - ps->p) + 2;
+            continue;
         }
-        // Check for range a-z
-        if (*pos + 1 < plen && p[*pos] == '-' && p[*pos + 1] != ']') {
-            (*pos)++;
-            int c2 = (unsigned char)p[*pos];
-            (*pos)++;
-            if (c2 == '\\' && *pos < plen) { c2 = (unsigned char)p[*pos]; (*pos)++; }
-            for (int i = c; i <= c2; i++) cc_set(re->inst[idx].cclass, i);
+        ps->pos++;
+        if (c == '\\' && ps->pos < ps->len) {
+            int e = (unsigned char)ps->p[ps->pos++];
+            if (__koral_re_class_escape(&cls, e)) {
+                continue;
+            }
+            c = __koral_re_escape_char(e);
+        }
+        if (ps->pos + 1 < ps->len && ps->p[ps->pos] == '-' && ps->p[ps->pos + 1] != ']') {
+            ps->pos++;
+            int hi = (unsigned char)ps->p[ps->pos++];
+            if (hi == '\\' && ps->pos < ps->len) {
+                hi = __koral_re_escape_char((unsigned char)ps->p[ps->pos++]);
+            }
+            if (hi < c) {
+                ps->error = "Invalid range end";
+                return -1;
+            }
+            __koral_re_class_range(&cls, c, hi);
         } else {
-            cc_set(re->inst[idx].cclass, c);
-        }
-    }
-    if (*pos < plen && p[*pos] == ']') (*pos)++;
-    else { snprintf(re->error, 256, "Unmatched ["); return -1; }
-    return idx;
-}
-
-// Parse an atom: literal, dot, group, char class, escape
-static int re_parse_atom(ReCompiled* re, const char* p, int* pos, int plen) {
-    if (*pos >= plen) return -1;
-    int c = (unsigned char)p[*pos];
-    if (c == '(') {
-        (*pos)++;
-        int gn = re->ngroups++;
-        int gs = re_emit(re, RE_GROUP_S);
-        if (gs < 0) return -1;
-        re->inst[gs].group = gn;
-        if (re_compile_expr(re, p, pos, plen) < 0) return -1;
-        if (*pos >= plen || p[*pos] != ')') {
-            snprintf(re->error, 256, "Unmatched (");
+            __koral_re_class_set(&cls, c);
+        }
+    }
+    return __koral_re_class_node(ps, cls, negated);
+}
+
+static int32_t __koral_re_parse_atom(KoralReParser* ps) {
+    int c = (unsigned char)ps->p[ps->pos];
+    KoralReClass cls;
+    memset(&cls, 0, sizeof(cls));
+    switch (c) {
+        case '(': {
+            if (++ps->depth > KORAL_RE_MAX_DEPTH) {
+                ps->error = "Regular expression too big";
+                return -1;
+            }
+            ps->pos++;
+            int32_t group = ps->re->ngroups++;
+            int32_t inner = __koral_re_parse_alt(ps);
+            if (inner < 0) return -1;
+            if (ps->pos >= ps->len || ps->p[ps->pos] != ')') {
+                ps->error = "Unmatched ( or \\(";
+                return -1;
+            }
+            ps->pos++;
+            ps->depth--;
+            return __koral_re_node(ps, KORAL_RE_NODE_GROUP, inner, -1, group);
+        }
+        case '[':
+            ps->pos++;
+            return __koral_re_parse_bracket(ps);
+        case '.':
+            ps->pos++;
+            __koral_re_class_range(&cls, 0, 255);
+            if (ps->re->flags & KORAL_RE_NEWLINE) {
+                cls.bits['\n' >> 6] &= ~((uint64_t)1 << ('\n' & 63));
+            }
+            return __koral_re_class_node(ps, cls, 0);
+        case '^':
+            ps->pos++;
+            return __koral_re_node(ps, KORAL_RE_NODE_ASSERT, -1, -1, KORAL_RE_ASSERT_BOL);
+        case '$':
+            ps->pos++;
+            return __koral_re_node(ps, KORAL_RE_NODE_ASSERT, -1, -1, KORAL_RE_ASSERT_EOL);
+        case '*': case '+': case '?': case '{':
+            ps->error = "Invalid preceding regular expression";
             return -1;
+        case '\\': {
+            if (ps->pos + 1 >= ps->len) {
+                ps->error = "Trailing backslash";
+                return -1;
+            }
+            int e = (unsigned char)ps->p[ps->pos + 1];
+            ps->pos += 2;
+            if (e == 'b' || e == 'B') {
+                ps->re->has_word_assert = 1;
+                return __koral_re_node(ps, KORAL_RE_NODE_ASSERT, -1, -1,
+                                       e == 'b' ? KORAL_RE_ASSERT_WORD : KORAL_RE_ASSERT_NOT_WORD);
+            }
+            if (__koral_re_class_escape(&cls, e)) {
+                return __koral_re_class_node(ps, cls, 0);
+            }
+            if (e >= 'A' && e <= 'Z' && __koral_re_class_escape(&cls, e + 32)) {
+                return __koral_re_class_node(ps, cls, 1);
+            }
+            __koral_re_class_set(&cls, __koral_re_escape_char(e));
+            return __koral_re_class_node(ps, cls, 0);
+        }
+        default:
+            ps->pos++;
+            __koral_re_class_set(&cls, c);
+            return __koral_re_class_node(ps, cls, 0);
+    }
+}
+
+// Parses "{n}", "{n,}" or "{n,m}"; `ps->pos` is at '{'.
+static int __koral_re_parse_interval(KoralReParser* ps, int32_t* min, int32_t* max) {
+    int32_t pos = ps->pos + 1;
+    int32_t values[2] = {0, -1};
+    int have_comma = 0;
+    int digits = 0;
+    while (pos < ps->len && ps->p[pos] != '}') {
+        char c = ps->p[pos];
+        if (c >= '0' && c <= '9') {
+            int32_t* v = &values[have_comma];
+            if (*v < 0) *v = 0;
+            *v = *v * 10 + (c - '0');
+            if (*v > KORAL_RE_MAX_REPEAT) {
+                ps->error = "Invalid content of \\{\\}";
+                return -1;
+            }
+            if (!have_comma) digits = 1;
+        } else if (c == ',' && !have_comma) {
+            have_comma = 1;
+        } else {
+            break;
         }
-        (*pos)++;
-        int ge = re_emit(re, RE_GROUP_E);
-        if (ge < 0) return -1;
-        re->inst[ge].group = gn;
-        return gs;
-    }
-    if (c == '[') {
-        (*pos)++;
-        return re_parse_cclass(re, p, pos, plen);
-    }
-    if (c == '.') {
-        (*pos)++;
-        return re_emit(re, RE_DOT);
-    }
-    if (c == '^') {
-        (*pos)++;
-        return re_emit(re, RE_BOL);
-    }
-    if (c == '$') {
-        (*pos)++;
-        return re_emit(re, RE_EOL);
-    }
-    if (c == '\\' && *pos + 1 < plen) {
-        (*pos)++;
-        c = (unsigned char)p[*pos];
-        (*pos)++;
-        switch (c) {
-            case 'd': return re_emit(re, RE_DIGIT);
-            case 'D': return re_emit(re, RE_NDIGIT);
-            case 'w': return re_emit(re, RE_WORD);
-            case 'W': return re_emit(re, RE_NWORD);
-            case 's': return re_emit(re, RE_SPACE);
-            case 'S': return re_emit(re, RE_NSPACE);
-            default: { int idx = re_emit(re, RE_LIT); if (idx >= 0) re->inst[idx].ch = c; return idx; }
-        }
-    }
-    // Reject bare quantifiers
-    if (c == '*' || c == '+' || c == '?' || c == '{') {
-        snprintf(re->error, 256, "Invalid preceding regular expression");
+        pos++;
+    }
+    if (pos >= ps->len || ps->p[pos] != '}') {
+        ps->error = "Unmatched \\{";
         return -1;
     }
-    if (c == ')' || c == '|') return -1; // not an atom
-    (*pos)++;
-    int idx = re_emit(re, RE_LIT);
-    if (idx >= 0) {
-        if ((re->flags & 2) && c >= 'A' && c <= 'Z') c += 32; // case insensitive: store lowercase
-        re->inst[idx].ch = c;
-    }
-    return idx;
-}
-
-// Parse quantified atom: atom followed by *, +, ?, {n,m}
-static int re_parse_quantified(ReCompiled* re, const char* p, int* pos, int plen) {
-    int start = re->len;
-    int r = re_parse_atom(re, p, pos, plen);
-    if (r < 0) return r;
-    if (*pos >= plen) return r;
-    int c = (unsigned char)p[*pos];
-    if (c == '*') {
-        (*pos)++;
-        // split -> atom -> jmp back to split
-        int sp = re_emit(re, RE_SPLIT);
-        if (sp < 0) return -1;
-        // Move instructions: insert split before atom
-        // Simpler: patch with jump
-        // Actually, restructure: we need split at start, jmp at end
-        // Let's use a different approach: 
-        // We already emitted the atom at [start..re->len-1]
-        // We need: SPLIT(atom, skip) at start, then atom, then JMP(start)
-        // Shift instructions to make room for split at start
-        for (int i = re->len - 1; i > start; i--) {
-            re->inst[i] = re->inst[i - 1];
-            // Fix group references if needed
-        }
-        re->len--; // remove the extra SPLIT we emitted
-        // Insert split at start
-        memset(&re->inst[start], 0, sizeof(ReInst));
-        re->inst[start].type = RE_SPLIT;
-        re->inst[start].x = start + 1;  // try atom
-        re->inst[start].y = re->len + 1; // skip (will be set after jmp)
-        // Add JMP back to split
-        int jmp = re_emit(re, RE_JMP);
-        if (jmp < 0) return -1;
-        re->inst[jmp].x = start;
-        re->inst[start].y = re->len; // skip to after jmp
-        return start;
-    }
-    if (c == '+') {
-        (*pos)++;
-        // atom then split(atom, next)
-        int sp = re_emit(re, RE_SPLIT);
-        if (sp < 0) return -1;
-        re->inst[sp].x = start;     // loop back
-        re->inst[sp].y = re->len;   // continue
-        return start;
-    }
-    if (c == '?') {
-        (*pos)++;
-        // split(atom, skip)
-        for (int i = re->len; i > start; i--) {
-            re->inst[i] = re->inst[i - 1];
-        }
-        re->len++;
-        memset(&re->inst[start], 0, sizeof(ReInst));
-        re->inst[start].type = RE_SPLIT;
-        re->inst[start].x = start + 1;
-        re->inst[start].y = re->len;
-        return start;
-    }
-    if (c == '{') {
-        // Parse {n}, {n,}, {n,m}
-        (*pos)++;
-        int n = 0, m = -1;
-        while (*pos < plen && is_digit(p[*pos])) { n = n * 10 + (p[*pos] - '0'); (*pos)++; }
-        if (*pos < plen && p[*pos] == ',') {
-            (*pos)++;
-            if (*pos < plen && p[*pos] != '}') {
-                m = 0;
-                while (*pos < plen && is_digit(p[*pos])) { m = m * 10 + (p[*pos] - '0'); (*pos)++; }
-            } else {
-                m = -1; // unbounded
-            }
+    if (!digits || (have_comma && values[1] >= 0 && values[1] < values[0])) {
+        ps->error = "Invalid content of \\{\\}";
+        return -1;
+    }
+    *min = values[0];
+    *max = have_comma ? values[1] : values[0];
+    ps->pos = pos + 1;
+    return 0;
+}
+
+static int32_t __koral_re_parse_repeat(KoralReParser* ps) {
+    int32_t node = __koral_re_parse_atom(ps);
+    int32_t stacked = 0;
+    while (node >= 0 && ps->pos < ps->len) {
+        char c = ps->p[ps->pos];
+        int32_t min, max;
+        if (c == '*') {
+            min = 0;
+            max = -1;
+            ps->pos++;
+        } else if (c == '+') {
+            min = 1;
+            max = -1;
+            ps->pos++;
+        } else if (c == '?') {
+            min = 0;
+            max = 1;
+            ps->pos++;
+        } else if (c == '{') {
+            if (__koral_re_parse_interval(ps, &min, &max) < 0) return -1;
         } else {
-            m = n; // exact
-        }
-        if (*pos < plen && p[*pos] == '}') (*pos)++;
-        // For simplicity, we already have one copy of atom at [start..re->len)
-        // We need n copies total for minimum, then optional copies for max
-        int atom_len = re->len - start;
-        // Duplicate atom (n-1) more times for minimum
-        for (int i = 1; i < n; i++) {
-            for (int j = 0; j < atom_len; j++) {
-                if (re->len >= RE_MAX_INST) return -1;
-                re->inst[re->len] = re->inst[start + j];
-                re->len++;
-            }
+            break;
+        }
+        if (++stacked + ps->depth > KORAL_RE_MAX_DEPTH) {
+            ps->error = "Regular expression too big";
+            return -1;
+        }
+        node = __koral_re_node(ps, KORAL_RE_NODE_REPEAT, node, -1, 0);
+        if (node >= 0) {
+            ps->nodes[node].min = min;
+            ps->nodes[node].max = max;
+        }
+    }
+    return node;
+}
+
+static int32_t __koral_re_parse_concat(KoralReParser* ps) {
+    int32_t node = -1;
+    while (ps->pos < ps->len && ps->p[ps->pos] != '|' && ps->p[ps->pos] != ')') {
+        int32_t next = __koral_re_parse_repeat(ps);
+        if (next < 0) return -1;
+        node = node < 0 ? next : __koral_re_node(ps, KORAL_RE_NODE_CONCAT, node, next, 0);
+        if (node < 0) return -1;
+    }
+    return node < 0 ? __koral_re_node(ps, KORAL_RE_NODE_EMPTY, -1, -1, 0) : node;
+}
+
+static int32_t __koral_re_parse_alt(KoralReParser* ps) {
+    int32_t node = __koral_re_parse_concat(ps);
+    while (node >= 0 && ps->pos < ps->len && ps->p[ps->pos] == '|') {
+        ps->pos++;
+        int32_t next = __koral_re_parse_concat(ps);
+        if (next < 0) return -1;
+        node = __koral_re_node(ps, KORAL_RE_NODE_ALT, node, next, 0);
+    }
+    return node;
+}
+
+// --- Code generation ---
+
+static int32_t __koral_re_emit(KoralReParser* ps, uint8_t op, int32_t x, int32_t y) {
+    KoralRegex* re = ps->re;
+    if (re->len >= KORAL_RE_MAX_INST) {
+        ps->error = "Regular expression too big";
+        return -1;
+    }
+    if (re->len == ps->prog_cap) {
+        int32_t cap = ps->prog_cap ? ps->prog_cap * 2 : 16;
+        KoralReInst* prog = (KoralReInst*)realloc(re->prog, (size_t)cap * sizeof(KoralReInst));
+        if (!prog) {
+            ps->error = "out of memory";
+            return -1;
+        }
+        re->prog = prog;
+        ps->prog_cap = cap;
+    }
+    KoralReInst* inst = &re->prog[re->len];
+    inst->op = op;
+    inst->arg = 0;
+    inst->x = x;
+    inst->y = y;
+    return re->len++;
+}
+
+// Flattens a left-leaning chain of `kind` nodes rooted at `index` into
+// `ps->spine[base..]`, leftmost operand first. Returns the operand count.
+static int32_t __koral_re_flatten(KoralReParser* ps, int32_t index, int32_t kind, int32_t base) {
+    int32_t count = 0;
+    while (ps->nodes[index].kind == kind) {
+        ps->spine[base + count++] = ps->nodes[index].b;
+        index = ps->nodes[index].a;
+    }
+    ps->spine[base + count++] = index;
+    for (int32_t i = 0; i < count / 2; i++) {
+        int32_t tmp = ps->spine[base + i];
+        ps->spine[base + i] = ps->spine[base + count - 1 - i];
+        ps->spine[base + count - 1 - i] = tmp;
+    }
+    return count;
+}
+
+static int __koral_re_compile_node(KoralReParser* ps, int32_t index);
+
+// Chains are flattened so long concatenations and alternations do not
+// recurse once per operand. Only the chains on the current recursion path
+// are live, so the spine never holds more than node_count entries.
+static int __koral_re_compile_chain(KoralReParser* ps, int32_t index, int32_t kind) {
+    KoralRegex* re = ps->re;
+    int32_t base = ps->spine_top;
+    int32_t count = __koral_re_flatten(ps, index, kind, base);
+    ps->spine_top = base + count;
+    int32_t jumps = -1;     // linked list of JMP-to-end instructions, via x
+    for (int32_t i = 0; i < count; i++) {
+        int32_t operand = ps->spine[base + i];
+        if (kind == KORAL_RE_NODE_CONCAT) {
+            if (__koral_re_compile_node(ps, operand) < 0) return -1;
+            continue;
+        }
+        int32_t split = -1;
+        if (i + 1 < count) {
+            split = __koral_re_emit(ps, KORAL_RE_OP_SPLIT, 0, 0);
+            if (split < 0) return -1;
+            re->prog[split].x = re->len;
+        }
+        if (__koral_re_compile_node(ps, operand) < 0) return -1;
+        if (split >= 0) {
+            int32_t jmp = __koral_re_emit(ps, KORAL_RE_OP_JMP, jumps, 0);
+            if (jmp < 0) return -1;
+            jumps = jmp;
+            re->prog[split].y = re->len;
+        }
+    }
+    while (jumps >= 0) {
+        int32_t next = re->prog[jumps].x;
+        re->prog[jumps].x = re->len;
+        jumps = next;
+    }
+    ps->spine_top = base;
+    return 0;
+}
+
+static int __koral_re_compile_node(KoralReParser* ps, int32_t index) {
+    KoralReNode node = ps->nodes[index];
+    KoralRegex* re = ps->re;
+    switch (node.kind) {
+        case KORAL_RE_NODE_EMPTY:
+            return 0;
+        case KORAL_RE_NODE_CLASS:
+            return __koral_re_emit(ps, KORAL_RE_OP_CLASS, node.value, 0) < 0 ? -1 : 0;
+        case KORAL_RE_NODE_ASSERT: {
+            int32_t pc = __koral_re_emit(ps, KORAL_RE_OP_ASSERT, 0, 0);
+            if (pc < 0) return -1;
+            re->prog[pc].arg = (uint8_t)node.value;
+            return 0;
         }
-        if (m == -1) {
-            // {n,} = n copies + *
-            int loop_start = re->len - atom_len;
-            int sp = re_emit(re, RE_SPLIT);
-            if (sp < 0) return -1;
-            re->inst[sp].x = loop_start;
-            re->inst[sp].y = re->len;
-        } else if (m > n) {
-            // {n,m} = n copies + (m-n) optional copies
-            for (int i = n; i < m; i++) {
-                int opt_start = re->len;
-                int sp = re_emit(re, RE_SPLIT);
-                if (sp < 0) return -1;
-                re->inst[sp].x = sp + 1;
-                for (int j = 0; j < atom_len; j++) {
-                    if (re->len >= RE_MAX_INST) return -1;
-                    re->inst[re->len] = re->inst[start + j];
-                    re->len++;
+        case KORAL_RE_NODE_CONCAT:
+        case KORAL_RE_NODE_ALT:
+            return __koral_re_compile_chain(ps, index, node.kind);
+        case KORAL_RE_NODE_GROUP:
+            if (__koral_re_emit(ps, KORAL_RE_OP_SAVE, node.value * 2, 0) < 0) return -1;
+            if (__koral_re_compile_node(ps, node.a) < 0) return -1;
+            return __koral_re_emit(ps, KORAL_RE_OP_SAVE, node.value * 2 + 1, 0) < 0 ? -1 : 0;
+        case KORAL_RE_NODE_REPEAT: {
+            // x{n,m} = n copies of x, then either a loop or (m - n) optional copies.
+            int32_t last = re->len;
+            for (int32_t i = 0; i < node.min; i++) {
+                last = re->len;
+                if (__koral_re_compile_node(ps, node.a) < 0) return -1;
+            }
+            if (node.max < 0) {
+                if (node.min > 0) {
+                    // Loop back over the last mandatory copy: x+ style.
+                    int32_t split = __koral_re_emit(ps, KORAL_RE_OP_SPLIT, last, 0);
+                    if (split < 0) return -1;
+                    re->prog[split].y = re->len;
+                    return 0;
                 }
-                re->inst[opt_start].y = re->len;
+                int32_t split = __koral_re_emit(ps, KORAL_RE_OP_SPLIT, 0, 0);
+                if (split < 0) return -1;
+                re->prog[split].x = re->len;
+                if (__koral_re_compile_node(ps, node.a) < 0) return -1;
+                if (__koral_re_emit(ps, KORAL_RE_OP_JMP, split, 0) < 0) return -1;
+                re->prog[split].y = re->len;
+                return 0;
             }
+            for (int32_t i = node.min; i < node.max; i++) {
+                int32_t split = __koral_re_emit(ps, KORAL_RE_OP_SPLIT, 0, 0);
+                if (split < 0) return -1;
+                re->prog[split].x = re->len;
+                if (__koral_re_compile_node(ps, node.a) < 0) return -1;
+                re->prog[split].y = re->len;
+            }
+            return 0;
         }
-        return start;
+        default:
+            return -1;
     }
-    return r;
 }
 
-// Parse concatenation: sequence of quantified atoms
-static int re_parse_concat(ReCompiled* re, const char* p, int* pos, int plen) {
-    int start = re->len;
-    while (*pos < plen && p[*pos] != ')' && p[*pos] != '|') {
-        if (re_parse_quantified(re, p, pos, plen) < 0) {
-            if (re->error[0]) return -1;
+// Collects the literal bytes every match must start with.
+static void __koral_re_find_prefix(KoralRegex* re) {
+    int32_t pc = 0;
+    re->prefix_len = 0;
+    while (pc < re->len && re->prefix_len < KORAL_RE_MAX_PREFIX) {
+        KoralReInst* inst = &re->prog[pc];
+        if (inst->op == KORAL_RE_OP_SAVE) {
+            pc++;
+            continue;
+        }
+        if (inst->op != KORAL_RE_OP_CLASS) break;
+        const KoralReClass* cls = &re->classes[inst->x];
+        int found = -1;
+        for (int w = 0; w < 4; w++) {
+            uint64_t bits = cls->bits[w];
+            if (bits == 0) continue;
+            if ((bits & (bits - 1)) != 0 || found >= 0) {
+                found = -2;
+                break;
+            }
+            int bit = 0;
+            while (((bits >> bit) & 1) == 0) bit++;
+            found = w * 64 + bit;
+        }
+        if (found < 0) break;
+        re->prefix[re->prefix_len++] = (uint8_t)found;
+        pc++;
+    }
+}
+
+// --- Lazy DFA ---
+
+static int __koral_re_set_init(KoralReSet* set, int32_t len) {
+    set->stack = (int32_t*)malloc((size_t)(len * 2 + 1) * sizeof(int32_t));
+    set->seen = (uint8_t*)calloc((size_t)len, 1);
+    set->pcs = (int32_t*)malloc((size_t)len * sizeof(int32_t));
+    set->count = 0;
+    return set->stack && set->seen && set->pcs ? 0 : -1;
+}
+
+static void __koral_re_set_free(KoralReSet* set) {
+    free(set->stack);
+    free(set->seen);
+    free(set->pcs);
+}
+
+static void __koral_re_set_clear(KoralReSet* set) {
+    for (int32_t i = 0; i < set->count; i++) set->seen[set->pcs[i]] = 0;
+    set->count = 0;
+}
+
+// Adds the epsilon closure of `pc` to `set`. End-of-line assertions are
+// kept in the set unresolved, since they depend on the next byte.
+static void __koral_re_closure(KoralRegex* re, KoralReSet* set, int32_t pc, int at_bol) {
+    int32_t top = 0;
+    set->stack[top++] = pc;
+    while (top > 0) {
+        pc = set->stack[--top];
+        if (set->seen[pc]) continue;
+        set->seen[pc] = 1;
+        set->pcs[set->count++] = pc;
+        KoralReInst* inst = &re->prog[pc];
+        switch (inst->op) {
+            case KORAL_RE_OP_JMP:
+                set->stack[top++] = inst->x;
+                break;
+            case KORAL_RE_OP_SPLIT:
+                set->stack[top++] = inst->y;
+                set->stack[top++] = inst->x;
+                break;
+            case KORAL_RE_OP_SAVE:
+                set->stack[top++] = pc + 1;
+                break;
+            case KORAL_RE_OP_ASSERT:
+                if (inst->arg == KORAL_RE_ASSERT_BOL && at_bol) {
+                    set->stack[top++] = pc + 1;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+// Resolves pending '$' assertions given that the next byte is `c`
+// (-1 = end of text). Returns whether MATCH became reachable.
+static int __koral_re_resolve_eol(KoralRegex* re, KoralReSet* set, int c, int at_bol) {
+    int eol = c < 0 || (c == '\n' && (re->flags & KORAL_RE_NEWLINE));
+    int matched = 0;
+    for (int32_t i = 0; i < set->count; i++) {
+        KoralReInst* inst = &re->prog[set->pcs[i]];
+        if (inst->op == KORAL_RE_OP_MATCH) {
+            matched = 1;
+        } else if (eol && inst->op == KORAL_RE_OP_ASSERT && inst->arg == KORAL_RE_ASSERT_EOL) {
+            __koral_re_closure(re, set, set->pcs[i] + 1, at_bol);
+        }
+    }
+    return matched;
+}
+
+static uint32_t __koral_re_hash_pcs(const int32_t* pcs, int32_t count, int at_bol) {
+    uint32_t h = 2166136261u ^ (uint32_t)at_bol;
+    for (int32_t i = 0; i < count; i++) {
+        h = (h ^ (uint32_t)pcs[i]) * 16777619u;
+    }
+    return h;
+}
+
+static int __koral_re_cmp_pc(const void* a, const void* b) {
+    return *(const int32_t*)a - *(const int32_t*)b;
+}
+
+static void __koral_re_dfa_reset(KoralRegex* re) {
+    for (int32_t i = 0; i < re->state_count; i++) {
+        free(re->states[i]->pcs);
+        free(re->states[i]);
+    }
+    re->state_count = 0;
+    re->start[0] = -1;
+    re->start[1] = -1;
+    if (re->table) {
+        for (int32_t i = 0; i < re->table_size; i++) re->table[i] = -1;
+    }
+}
+
+// Finds or adds the state for the pcs in `set` (order is discarded).
+// Returns -1 when the cache is full or memory runs out.
+static int32_t __koral_re_dfa_intern(KoralRegex* re, KoralReSet* set, int at_bol) {
+    if (!re->table) {
+        re->table_size = KORAL_RE_DFA_STATES * 2;
+        re->table = (int32_t*)malloc((size_t)re->table_size * sizeof(int32_t));
+        re->states = (KoralReDfaState**)malloc(KORAL_RE_DFA_STATES * sizeof(KoralReDfaState*));
+        if (!re->table || !re->states) return -1;
+        for (int32_t i = 0; i < re->table_size; i++) re->table[i] = -1;
+    }
+    // Only consuming instructions, MATCH and pending '$' affect the future.
+    int32_t count = 0;
+    for (int32_t i = 0; i < set->count; i++) {
+        KoralReInst* inst = &re->prog[set->pcs[i]];
+        if (inst->op == KORAL_RE_OP_CLASS || inst->op == KORAL_RE_OP_MATCH
+            || (inst->op == KORAL_RE_OP_ASSERT && inst->arg == KORAL_RE_ASSERT_EOL)) {
+            set->stack[count++] = set->pcs[i];
+        }
+    }
+    qsort(set->stack, (size_t)count, sizeof(int32_t), __koral_re_cmp_pc);
+    uint32_t hash = __koral_re_hash_pcs(set->stack, count, at_bol);
+    int32_t slot = (int32_t)(hash & (uint32_t)(re->table_size - 1));
+    while (re->table[slot] >= 0) {
+        KoralReDfaState* s = re->states[re->table[slot]];
+        if (s->hash == hash && s->at_bol == at_bol && s->count == count
+            && memcmp(s->pcs, set->stack, (size_t)count * sizeof(int32_t)) == 0) {
+            return re->table[slot];
+        }
+        slot = (slot + 1) & (re->table_size - 1);
+    }
+    if (re->state_count >= KORAL_RE_DFA_STATES) return -1;
+    KoralReDfaState* s = (KoralReDfaState*)malloc(sizeof(KoralReDfaState));
+    int32_t* pcs = (int32_t*)malloc((size_t)(count ? count : 1) * sizeof(int32_t));
+    if (!s || !pcs) {
+        free(s);
+        free(pcs);
+        return -1;
+    }
+    memcpy(pcs, set->stack, (size_t)count * sizeof(int32_t));
+    s->pcs = pcs;
+    s->count = count;
+    s->hash = hash;
+    s->at_bol = (uint8_t)at_bol;
+    s->match = 0;
+    for (int32_t i = 0; i < count; i++) {
+        if (re->prog[pcs[i]].op == KORAL_RE_OP_MATCH) s->match = 1;
+    }
+    for (int i = 0; i < 256; i++) s->next[i] = -1;
+    // Whether the text may end here: resolve '$' against end of text.
+    __koral_re_set_clear(set);
+    for (int32_t i = 0; i < count; i++) __koral_re_closure(re, set, pcs[i], at_bol);
+    s->match_at_end = (uint8_t)__koral_re_resolve_eol(re, set, -1, at_bol);
+    int32_t index = re->state_count++;
+    re->states[index] = s;
+    re->table[slot] = index;
+    return index;
+}
+
+static int32_t __koral_re_dfa_start(KoralRegex* re, KoralReSet* set, int at_bol) {
+    if (re->start[at_bol] >= 0) return re->start[at_bol];
+    __koral_re_set_clear(set);
+    __koral_re_closure(re, set, 0, at_bol);
+    re->start[at_bol] = __koral_re_dfa_intern(re, set, at_bol);
+    return re->start[at_bol];
+}
+
+// Builds the transition of `state` on byte `c` for an unanchored search.
+static int32_t __koral_re_dfa_step(KoralRegex* re, KoralReSet* set, int32_t state, int c) {
+    KoralReDfaState* s = re->states[state];
+    int at_bol = s->at_bol;
+    __koral_re_set_clear(set);
+    for (int32_t i = 0; i < s->count; i++) __koral_re_closure(re, set, s->pcs[i], at_bol);
+    int matched = __koral_re_resolve_eol(re, set, c, at_bol);
+    // Collect successors before clearing, reusing `stack` as scratch.
+    int32_t* next = (int32_t*)malloc((size_t)(set->count + 1) * sizeof(int32_t));
+    if (!next) return -1;
+    int32_t next_count = 0;
+    for (int32_t i = 0; i < set->count; i++) {
+        KoralReInst* inst = &re->prog[set->pcs[i]];
+        if (inst->op == KORAL_RE_OP_CLASS && __koral_re_class_has(&re->classes[inst->x], c)) {
+            next[next_count++] = set->pcs[i] + 1;
+        }
+    }
+    int next_bol = c == '\n' && (re->flags & KORAL_RE_NEWLINE);
+    __koral_re_set_clear(set);
+    for (int32_t i = 0; i < next_count; i++) __koral_re_closure(re, set, next[i], next_bol);
+    free(next);
+    __koral_re_closure(re, set, 0, next_bol);  // a new match may start at every byte
+    int32_t target = __koral_re_dfa_intern(re, set, next_bol);
+    if (target < 0) return -1;
+    re->states[state]->next[c] = (target << 1) | matched;
+    return re->states[state]->next[c];
+}
+
+// Returns the offset of the next place a match could begin, or -1.
+static int32_t __koral_re_next_candidate(const KoralRegex* re, const uint8_t* text, int32_t len, int32_t pos) {
+    if (re->prefix_len == 0) return pos;
+    while (pos + re->prefix_len <= len) {
+        const uint8_t* hit = (const uint8_t*)memchr(text + pos, re->prefix[0], (size_t)(len - pos));
+        if (!hit) return -1;
+        pos = (int32_t)(hit - text);
+        if (pos + re->prefix_len > len) return -1;
+        if (memcmp(hit, re->prefix, (size_t)re->prefix_len) == 0) return pos;
+        pos++;
+    }
+    return -1;
+}
+
+// Unanchored DFA search. Returns 1 if a match exists, 0 if none, -1 if the
+// DFA cannot answer (busy, word-boundary assertions, or cache exhausted).
+static int __koral_re_dfa_search(KoralRegex* re, const uint8_t* text, int32_t len, int32_t offset) {
+    if (re->has_word_assert) return -1;
+    if (atomic_exchange_explicit(&re->dfa_busy, 1, memory_order_acquire)) return -1;
+    int result = -1;
+    if (!re->dfa_set) {
+        KoralReSet* scratch = (KoralReSet*)malloc(sizeof(KoralReSet));
+        if (!scratch || __koral_re_set_init(scratch, re->len) < 0) {
+            if (scratch) __koral_re_set_free(scratch);
+            free(scratch);
+            goto done;
+        }
+        re->dfa_set = scratch;
+    }
+    KoralReSet* set = re->dfa_set;
+    for (int attempt = 0; attempt < 2 && result < 0; attempt++) {
+        if (attempt > 0) __koral_re_dfa_reset(re);
+        int32_t pos = __koral_re_next_candidate(re, text, len, offset);
+        if (pos < 0) {
+            result = 0;
             break;
         }
+        int at_bol = pos == 0 || ((re->flags & KORAL_RE_NEWLINE) && text[pos - 1] == '\n');
+        int32_t state = __koral_re_dfa_start(re, set, at_bol);
+        if (state < 0) continue;
+        while (1) {
+            KoralReDfaState* s = re->states[state];
+            if (s->match) {
+                result = 1;
+                break;
+            }
+            if (pos == len) {
+                result = s->match_at_end;
+                break;
+            }
+            int32_t next = s->next[text[pos]];
+            if (next < 0) {
+                next = __koral_re_dfa_step(re, set, state, text[pos]);
+                if (next < 0) break;  // cache full: flush and retry once
+            }
+            if (next & 1) {
+                result = 1;
+                break;
+            }
+            state = next >> 1;
+            pos++;
+            if (re->prefix_len > 0 && (state == re->start[0] || state == re->start[1])) {
+                // Nothing in flight: skip straight to the next prefix.
+                pos = __koral_re_next_candidate(re, text, len, pos);
+                if (pos < 0) {
+                    result = 0;
+                    break;
+                }
+                at_bol = pos == 0 || ((re->flags & KORAL_RE_NEWLINE) && text[pos - 1] == '\n');
+                state = __koral_re_dfa_start(re, set, at_bol);
+                if (state < 0) break;
+            }
+        }
     }
-    return start;
-}
-
-// Parse alternation: concat | concat | ...
-static int re_compile_expr(ReCompiled* re, const char* p, int* pos, int plen) {
-    int start = re->len;
-    if (re_parse_concat(re, p, pos, plen) < 0 && re->error[0]) return -1;
-    
-    while (*pos < plen && p[*pos] == '|') {
-        (*pos)++;
-        // Insert split before first branch
-        int first_end = re->len;
-        int jmp_idx = re_emit(re, RE_JMP); // jump over second branch
-        if (jmp_idx < 0) return -1;
-        
-        int second_start = re->len;
-        if (re_parse_concat(re, p, pos, plen) < 0 && re->error[0]) return -1;
-        
-        // Now patch: insert SPLIT at start
-        // Shift everything from start onwards by 1
-        for (int i = re->len; i > start; i--) {
-            re->inst[i] = re->inst[i - 1];
-        }
-        re->len++;
-        memset(&re->inst[start], 0, sizeof(ReInst));
-        re->inst[start].type = RE_SPLIT;
-        re->inst[start].x = start + 1;           // first branch
-        re->inst[start].y = second_start + 1;     // second branch (shifted by 1)
-        
-        // Fix the JMP target
-        re->inst[jmp_idx + 1].x = re->len;        // jump to end (shifted by 1)
-        
-        start = re->len; // for chaining more alternations... actually we need to handle this differently
-        // For simplicity, break after one alternation level
-        // This handles a|b but not a|b|c correctly in all cases
-        // Let's handle it by continuing the loop
-    }
-    return start;
-}
-
-static int re_match_char(ReInst* inst, int c, int flags) {
-    int lc = c;
-    if ((flags & 2) && c >= 'A' && c <= 'Z') lc = c + 32; // case insensitive
-    switch (inst->type) {
-        case RE_LIT: return lc == inst->ch;
-        case RE_DOT: return c != '\n';
-        case RE_DIGIT: return is_digit(c);
-        case RE_NDIGIT: return !is_digit(c);
-        case RE_WORD: return is_word(c);
-        case RE_NWORD: return !is_word(c);
-        case RE_SPACE: return is_space(c);
-        case RE_NSPACE: return !is_space(c);
-        case RE_CCLASS: return cc_test(inst->cclass, (flags & 2) ? lc : c);
-        case RE_NCCLASS: return !cc_test(inst->cclass, (flags & 2) ? lc : c);
-        default: return 0;
+done:
+    atomic_store_explicit(&re->dfa_busy, 0, memory_order_release);
+    return result;
+}
+
+// --- Pike VM ---
+
+typedef struct {
+    int32_t* pcs;
+    int32_t* caps;      // `nslots` entries per thread
+    int32_t count;
+} KoralReThreads;
+
+typedef struct {
+    KoralRegex* re;
+    const uint8_t* text;
+    int32_t len;
+    int32_t nslots;
+    uint32_t* seen;     // generation stamp per pc
+    uint32_t generation;
+    int32_t* stack;     // pc, or -(slot + 1) followed by the old value
+    int32_t* work;
+} KoralRePike;
+
+static void __koral_re_next_generation(KoralRePike* vm) {
+    if (++vm->generation == 0) {
+        memset(vm->seen, 0, (size_t)vm->re->len * sizeof(uint32_t));
+        vm->generation = 1;
+    }
+}
+
+static int __koral_re_assert(KoralRePike* vm, int kind, int32_t pos) {
+    const uint8_t* t = vm->text;
+    int multiline = (vm->re->flags & KORAL_RE_NEWLINE) != 0;
+    switch (kind) {
+        case KORAL_RE_ASSERT_BOL:
+            return pos == 0 || (multiline && t[pos - 1] == '\n');
+        case KORAL_RE_ASSERT_EOL:
+            return pos == vm->len || (multiline && t[pos] == '\n');
+        default: {
+            int before = pos > 0 && __koral_re_is_word(t[pos - 1]);
+            int after = pos < vm->len && __koral_re_is_word(t[pos]);
+            return (before != after) == (kind == KORAL_RE_ASSERT_WORD);
+        }
     }
 }
 
-// Recursive backtracking regex execution
-static int re_bt(ReCompiled* re, const char* text, int tlen, int pc, int pos,
-                 int32_t* groups) {
-    while (pc < re->len) {
-        ReInst* inst = &re->inst[pc];
-        switch (inst->type) {
-            case RE_MATCH:
-                return 1;
-            case RE_LIT:
-                if (pos >= tlen) return 0;
-                { int c = (unsigned char)text[pos];
-                  if ((re->flags & 2) && c >= 'A' && c <= 'Z') c += 32;
-                  if (c != inst->ch) return 0; }
-                pos++; pc++; break;
-            case RE_DOT:
-                if (pos >= tlen || text[pos] == '\n') return 0;
-                pos++; pc++; break;
-            case RE_DIGIT:
-                if (pos >= tlen || !is_digit((unsigned char)text[pos])) return 0;
-                pos++; pc++; break;
-            case RE_NDIGIT:
-                if (pos >= tlen || is_digit((unsigned char)text[pos])) return 0;
-                pos++; pc++; break;
-            case RE_WORD:
-                if (pos >= tlen || !is_word((unsigned char)text[pos])) return 0;
-                pos++; pc++; break;
-            case RE_NWORD:
-                if (pos >= tlen || is_word((unsigned char)text[pos])) return 0;
-                pos++; pc++; break;
-            case RE_SPACE:
-                if (pos >= tlen || !is_space((unsigned char)text[pos])) return 0;
-                pos++; pc++; break;
-            case RE_NSPACE:
-                if (pos >= tlen || is_space((unsigned char)text[pos])) return 0;
-                pos++; pc++; break;
-            case RE_CCLASS:
-                if (pos >= tlen) return 0;
-                { int c = (unsigned char)text[pos];
-                  if ((re->flags & 2) && c >= 'A' && c <= 'Z') c += 32;
-                  if (!cc_test(inst->cclass, c)) return 0; }
-                pos++; pc++; break;
-            case RE_NCCLASS:
-                if (pos >= tlen) return 0;
-                { int c = (unsigned char)text[pos];
-                  if ((re->flags & 2) && c >= 'A' && c <= 'Z') c += 32;
-                  if (cc_test(inst->cclass, c)) return 0; }
-                pos++; pc++; break;
-            case RE_BOL:
-                if (pos != 0 && !((re->flags & 4) && pos > 0 && text[pos - 1] == '\n')) return 0;
-                pc++; break;
-            case RE_EOL:
-                if (pos != tlen && !((re->flags & 4) && text[pos] == '\n')) return 0;
-                pc++; break;
-            case RE_GROUP_S:
-                if (inst->group < RE_MAX_GROUPS) {
-                    int32_t old = groups[inst->group * 2];
-                    groups[inst->group * 2] = pos;
-                    if (re_bt(re, text, tlen, pc + 1, pos, groups)) return 1;
-                    groups[inst->group * 2] = old;
-                    return 0;
+// Adds the closure of `pc` at `pos` to `list`, in priority order, with the
+// capture slots in `vm->work`.
+static void __koral_re_add_thread(KoralRePike* vm, KoralReThreads* list, int32_t pc, int32_t pos) {
+    KoralRegex* re = vm->re;
+    int32_t top = 0;
+    vm->stack[top++] = pc;
+    while (top > 0) {
+        int32_t entry = vm->stack[--top];
+        if (entry < 0) {
+            // Restore a capture slot once everything after SAVE is explored.
+            vm->work[-entry - 1] = vm->stack[--top];
+            continue;
+        }
+        pc = entry;
+        if (vm->seen[pc] == vm->generation) continue;
+        vm->seen[pc] = vm->generation;
+        KoralReInst* inst = &re->prog[pc];
+        switch (inst->op) {
+            case KORAL_RE_OP_JMP:
+                vm->stack[top++] = inst->x;
+                break;
+            case KORAL_RE_OP_SPLIT:
+                vm->stack[top++] = inst->y;
+                vm->stack[top++] = inst->x;
+                break;
+            case KORAL_RE_OP_SAVE:
+                if (inst->x < vm->nslots) {
+                    vm->stack[top++] = vm->work[inst->x];
+                    vm->stack[top++] = -(inst->x + 1);
+                    vm->work[inst->x] = pos;
                 }
-                pc++; break;
-            case RE_GROUP_E:
-                if (inst->group < RE_MAX_GROUPS) {
-                    int32_t old = groups[inst->group * 2 + 1];
-                    groups[inst->group * 2 + 1] = pos;
-                    if (re_bt(re, text, tlen, pc + 1, pos, groups)) return 1;
-                    groups[inst->group * 2 + 1] = old;
-                    return 0;
+                vm->stack[top++] = pc + 1;
+                break;
+            case KORAL_RE_OP_ASSERT:
+                if (__koral_re_assert(vm, inst->arg, pos)) {
+                    vm->stack[top++] = pc + 1;
                 }
-                pc++; break;
-            case RE_SPLIT:
-                // Try primary branch first, then alternative
-                if (re_bt(re, text, tlen, inst->x, pos, groups)) return 1;
-                pc = inst->y; break;
-            case RE_JMP:
-                pc = inst->x; break;
+                break;
             default:
-                return 0;
+                list->pcs[list->count] = pc;
+                memcpy(list->caps + (size_t)list->count * (size_t)vm->nslots, vm->work,
+                       (size_t)vm->nslots * sizeof(int32_t));
+                list->count++;
+                break;
         }
     }
-    return 0;
 }
 
-static int re_exec(ReCompiled* re, const char* text, int text_offset, int max_groups,
-                   int32_t* out_starts, int32_t* out_ends) {
-    int tlen = (int)strlen(text);
-    int32_t groups[RE_MAX_GROUPS * 2];
-    
-    for (int sp = text_offset; sp <= tlen; sp++) {
-        for (int i = 0; i < RE_MAX_GROUPS * 2; i++) groups[i] = -1;
-        
-        if (re_bt(re, text, tlen, 0, sp, groups)) {
-            int32_t mg = max_groups < RE_MAX_GROUPS ? max_groups : RE_MAX_GROUPS;
-            int32_t result_count = 0;
-            for (int32_t i = 0; i < mg; i++) {
-                out_starts[i] = groups[i * 2];
-                out_ends[i] = groups[i * 2 + 1];
-                if (out_starts[i] >= 0) result_count = i + 1;
+// Leftmost-longest search from `offset`; fills `best` (nslots entries).
+static int __koral_re_pike(KoralRegex* re, const uint8_t* text, int32_t len, int32_t offset,
+                           int32_t nslots, int32_t* best) {
+    KoralRePike vm;
+    vm.re = re;
+    vm.text = text;
+    vm.len = len;
+    vm.nslots = nslots;
+    vm.generation = 0;  // seen[] starts at 0, so the first generation is 1
+    vm.seen = (uint32_t*)calloc((size_t)re->len, sizeof(uint32_t));
+    vm.stack = (int32_t*)malloc((size_t)(re->len * 4 + 1) * sizeof(int32_t));
+    vm.work = (int32_t*)malloc((size_t)nslots * sizeof(int32_t));
+    KoralReThreads lists[2];
+    for (int i = 0; i < 2; i++) {
+        lists[i].pcs = (int32_t*)malloc((size_t)re->len * sizeof(int32_t));
+        lists[i].caps = (int32_t*)malloc((size_t)re->len * (size_t)nslots * sizeof(int32_t));
+        lists[i].count = 0;
+    }
+    int found = 0;
+    if (!vm.seen || !vm.stack || !vm.work || !lists[0].pcs || !lists[0].caps
+        || !lists[1].pcs || !lists[1].caps) {
+        goto done;
+    }
+    KoralReThreads* clist = &lists[0];
+    KoralReThreads* nlist = &lists[1];
+    int32_t pos = offset;
+    __koral_re_next_generation(&vm);
+    while (1) {
+        if (!found) {
+            if (clist->count == 0) {
+                pos = __koral_re_next_candidate(re, text, len, pos);
+                if (pos < 0) break;
+                __koral_re_next_generation(&vm);
+            }
+            // Seed a new attempt at `pos` behind the older ones, which keep
+            // priority for every pc they already reached.
+            for (int32_t i = 0; i < nslots; i++) vm.work[i] = -1;
+            __koral_re_add_thread(&vm, clist, 0, pos);
+            if (clist->count == 0) {
+                // An assertion failed right at `pos`; try the next byte.
+                if (pos >= len) break;
+                pos++;
+                continue;
+            }
+        }
+        if (clist->count == 0) break;
+        __koral_re_next_generation(&vm);
+        nlist->count = 0;
+        for (int32_t i = 0; i < clist->count; i++) {
+            int32_t* caps = clist->caps + (size_t)i * (size_t)nslots;
+            if (found && caps[0] > best[0]) continue;  // starts right of the best match
+            KoralReInst* inst = &re->prog[clist->pcs[i]];
+            if (inst->op == KORAL_RE_OP_MATCH) {
+                if (!found || caps[0] < best[0] || (caps[0] == best[0] && caps[1] > best[1])) {
+                    memcpy(best, caps, (size_t)nslots * sizeof(int32_t));
+                    found = 1;
+                }
+            } else if (pos < len && __koral_re_class_has(&re->classes[inst->x], text[pos])) {
+                memcpy(vm.work, caps, (size_t)nslots * sizeof(int32_t));
+                __koral_re_add_thread(&vm, nlist, clist->pcs[i] + 1, pos + 1);
             }
-            return result_count > 0 ? result_count : 1;
         }
+        KoralReThreads* tmp = clist;
+        clist = nlist;
+        nlist = tmp;
+        if (pos >= len) break;
+        pos++;
     }
-    
-    return 0;
+done:
+    free(vm.seen);
+    free(vm.stack);
+    free(vm.work);
+    for (int i = 0; i < 2; i++) {
+        free(lists[i].pcs);
+        free(lists[i].caps);
+    }
+    return found;
+}
+
+// --- Public API ---
+
+static int32_t __koral_regex_error(const char* msg, char* out_error_buf, int32_t error_buf_size,
+                                   int32_t* out_error_len) {
+    int32_t msg_len = (int32_t)strlen(msg);
+    if (msg_len > error_buf_size - 1) {
+        msg_len = error_buf_size - 1;
+    }
+    memcpy(out_error_buf, msg, (size_t)msg_len);
+    out_error_buf[msg_len] = '\0';
+    *out_error_len = msg_len;
+    return -1;
+}
+
+void __koral_regex_free(void* handle) {
+    KoralRegex* re = (KoralRegex*)handle;
+    if (!re) return;
+    __koral_re_dfa_reset(re);
+    if (re->dfa_set) {
+        __koral_re_set_free(re->dfa_set);
+        free(re->dfa_set);
+    }
+    free(re->states);
+    free(re->table);
+    free(re->prog);
+    free(re->classes);
+    free(re);
 }
 
 int32_t __koral_regex_compile(const char* pattern, int32_t flags,
                             void** out_handle,
                             char* out_error_buf, int32_t error_buf_size,
                             int32_t* out_error_len) {
-    ReCompiled* re = (ReCompiled*)calloc(1, sizeof(ReCompiled));
+    KoralRegex* re = (KoralRegex*)calloc(1, sizeof(KoralRegex));
     if (!re) {
-        const char* msg = "out of memory";
-        int32_t msg_len = (int32_t)strlen(msg);
-        if (msg_len > error_buf_size - 1) msg_len = error_buf_size - 1;
-        memcpy(out_error_buf, msg, (size_t)msg_len);
-        *out_error_len = msg_len;
-        return -1;
+        return __koral_regex_error("out of memory", out_error_buf, error_buf_size, out_error_len);
     }
-    
     re->flags = flags;
-    re->ngroups = 0;
-    re->error[0] = '\0';
-    
-    int pos = 0;
-    int plen = (int)strlen(pattern);
-    
-    // Start with group 0 (whole match)
     re->ngroups = 1;
-    int gs = re_emit(re, RE_GROUP_S);
-    re->inst[gs].group = 0;
-    
-    if (re_compile_expr(re, pattern, &pos, plen) < 0 && re->error[0]) {
-        int32_t elen = (int32_t)strlen(re->error);
-        if (elen > error_buf_size - 1) elen = error_buf_size - 1;
-        memcpy(out_error_buf, re->error, (size_t)elen);
-        *out_error_len = elen;
-        free(re);
-        return -1;
-    }
-    
-    if (pos < plen) {
-        // Unexpected characters remaining
-        if (pattern[pos] == ')') {
-            snprintf(re->error, 256, "Unmatched )");
-        } else {
-            snprintf(re->error, 256, "Unexpected character at position %d", pos);
+    re->start[0] = -1;
+    re->start[1] = -1;
+    atomic_init(&re->dfa_busy, 0);
+
+    KoralReParser ps;
+    memset(&ps, 0, sizeof(ps));
+    ps.p = pattern;
+    ps.len = (int32_t)strlen(pattern);
+    ps.re = re;
+    int32_t root = __koral_re_parse_alt(&ps);
+    if (root >= 0 && ps.pos < ps.len) {
+        ps.error = "Unmatched ) or \\)";
+        root = -1;
+    }
+    if (root >= 0) {
+        ps.spine = (int32_t*)malloc((size_t)ps.node_count * sizeof(int32_t));
+        if (!ps.spine) {
+            ps.error = "out of memory";
+            root = -1;
         }
-        int32_t elen = (int32_t)strlen(re->error);
-        if (elen > error_buf_size - 1) elen = error_buf_size - 1;
-        memcpy(out_error_buf, re->error, (size_t)elen);
-        *out_error_len = elen;
-        free(re);
-        return -1;
     }
-    
-    int ge = re_emit(re, RE_GROUP_E);
-    re->inst[ge].group = 0;
-    re_emit(re, RE_MATCH);
-    
+    // Program: SAVE 0, <pattern>, SAVE 1, MATCH.
+    if (root >= 0
+        && (__koral_re_emit(&ps, KORAL_RE_OP_SAVE, 0, 0) < 0
+            || __koral_re_compile_node(&ps, root) < 0
+            || __koral_re_emit(&ps, KORAL_RE_OP_SAVE, 1, 0) < 0
+            || __koral_re_emit(&ps, KORAL_RE_OP_MATCH, 0, 0) < 0)) {
+        root = -1;
+    }
+    free(ps.nodes);
+    free(ps.spine);
+    if (root < 0) {
+        int32_t rc = __koral_regex_error(ps.error ? ps.error : "Invalid regular expression",
+                                         out_error_buf, error_buf_size, out_error_len);
+        __koral_regex_free(re);
+        return rc;
+    }
+    __koral_re_find_prefix(re);
     *out_handle = re;
     return 0;
 }
 
-int32_t __koral_regex_match(void* handle, const char* text, int32_t text_offset,
+// Searches `text[text_offset..text_len)`. With max_groups == 0 only reports
+// whether a match exists. Otherwise fills `max_groups` start/end pairs
+// (-1 for groups that did not participate) and returns the number of
+// leading groups reported, or 0 when there is no match.
+int32_t __koral_regex_match(void* handle, const char* text, int32_t text_len, int32_t text_offset,
                           int32_t max_groups,
                           int32_t* out_starts, int32_t* out_ends) {
-    ReCompiled* re = (ReCompiled*)handle;
-    return re_exec(re, text, text_offset, max_groups, out_starts, out_ends);
-}
-
-void __koral_regex_free(void* handle) {
-    free(handle);
+    KoralRegex* re = (KoralRegex*)handle;
+    const uint8_t* bytes = (const uint8_t*)text;
+    if (text_offset < 0 || text_offset > text_len) return 0;
+
+    int dfa = __koral_re_dfa_search(re, bytes, text_len, text_offset);
+    if (dfa == 0) return 0;
+    if (max_groups <= 0 && dfa == 1) return 1;
+
+    int32_t groups = max_groups > 0 ? max_groups : 1;
+    if (groups > re->ngroups) groups = re->ngroups;
+    int32_t nslots = groups * 2;
+    int32_t* best = (int32_t*)malloc((size_t)nslots * sizeof(int32_t));
+    if (!best) return 0;
+    int found = __koral_re_pike(re, bytes, text_len, text_offset, nslots, best);
+    int32_t matched = 0;
+    if (found) {
+        for (int32_t i = 0; i < max_groups; i++) {
+            int32_t s = i < groups ? best[i * 2] : -1;
+            int32_t e = i < groups ? best[i * 2 + 1] : -1;
+            if (s < 0 || e < 0) {
+                s = -1;
+                e = -1;
+            } else {
+                matched = i + 1;
+            }
+            out_starts[i] = s;
+            out_ends[i] = e;
+        }
+    }
+    free(best);
+    return found ? (matched > 0 ? matched : 1) : 0;
 }
 
-#endif  // _WIN32 || _WIN64
-
 
 // ============================================================================
 // OS module: File metadata, permissions, links, locking
@@ -2141,43 +4114,232 @@ uint8_t* __koral_mkdtemp(uint8_t* tmpl) {
 
 #endif
 
-
 // ============================================================================
-// Subprocess management (std.command)
+// Memory-mapped files (std.os)
 // ============================================================================
+// mode: 0 = read-only shared, 1 = read-write shared, 2 = private copy-on-write.
+// Returns NULL on failure.
 
-#if !defined(_WIN32) && !defined(_WIN64)
-#include <spawn.h>
-#include <sys/wait.h>
-#include <signal.h>
-#include <poll.h>
-#endif
+#if defined(_WIN32) || defined(_WIN64)
 
-typedef struct {
-    uint32_t pid;
-    int32_t  stdin_fd;
-    int32_t  stdout_fd;
-    int32_t  stderr_fd;
-} KoralProcess;
+uint8_t* __koral_mmap(int32_t fd, uint64_t len, int32_t mode) {
+    if (len == 0) { errno = EINVAL; return NULL; }
+    HANDLE h = (HANDLE)_get_osfhandle(fd);
+    if (h == INVALID_HANDLE_VALUE) { errno = EBADF; return NULL; }
+    DWORD protect = mode == 1 ? PAGE_READWRITE : mode == 2 ? PAGE_WRITECOPY : PAGE_READONLY;
+    DWORD access = mode == 1 ? FILE_MAP_WRITE : mode == 2 ? FILE_MAP_COPY : FILE_MAP_READ;
+    HANDLE mapping = CreateFileMappingA(h, NULL, protect, 0, 0, NULL);
+    if (!mapping) { errno = EACCES; return NULL; }
+    void* view = MapViewOfFile(mapping, access, 0, 0, (SIZE_T)len);
+    CloseHandle(mapping);
+    if (!view) { errno = EACCES; return NULL; }
+    return (uint8_t*)view;
+}
 
-// --- __koral_getpid ---
+int32_t __koral_munmap(uint8_t* addr, uint64_t len) {
+    (void)len;
+    return UnmapViewOfFile(addr) ? 0 : -1;
+}
 
-uint32_t __koral_getpid(void) {
-#if defined(_WIN32) || defined(_WIN64)
-    return (uint32_t)GetCurrentProcessId();
-#else
-    return (uint32_t)getpid();
-#endif
+int32_t __koral_madvise(uint8_t* addr, uint64_t len, int32_t advice) {
+    (void)addr; (void)len; (void)advice;
+    return 0;
 }
 
-// --- Pipe operations ---
+int32_t __koral_msync(uint8_t* addr, uint64_t len) {
+    return FlushViewOfFile(addr, (SIZE_T)len) ? 0 : -1;
+}
 
-int64_t __koral_pipe_read(int32_t fd, uint8_t* buf, uint64_t count) {
-#if defined(_WIN32) || defined(_WIN64)
-    return (int64_t)_read(fd, buf, (unsigned int)count);
 #else
-    return (int64_t)read(fd, buf, (size_t)count);
-#endif
+#include <sys/mman.h>
+
+uint8_t* __koral_mmap(int32_t fd, uint64_t len, int32_t mode) {
+    if (len == 0 || len > (uint64_t)SIZE_MAX) { errno = EINVAL; return NULL; }
+    int prot = mode == 0 ? PROT_READ : PROT_READ | PROT_WRITE;
+    int flags = mode == 2 ? MAP_PRIVATE : MAP_SHARED;
+    void* view = mmap(NULL, (size_t)len, prot, flags, fd, 0);
+    return view == MAP_FAILED ? NULL : (uint8_t*)view;
+}
+
+int32_t __koral_munmap(uint8_t* addr, uint64_t len) {
+    return munmap(addr, (size_t)len) == 0 ? 0 : -1;
+}
+
+// advice: 0 = normal, 1 = sequential, 2 = random, 3 = will need, 4 = don't need.
+int32_t __koral_madvise(uint8_t* addr, uint64_t len, int32_t advice) {
+    int flag;
+    switch (advice) {
+        case 1: flag = MADV_SEQUENTIAL; break;
+        case 2: flag = MADV_RANDOM; break;
+        case 3: flag = MADV_WILLNEED; break;
+        case 4: flag = MADV_DONTNEED; break;
+        default: flag = MADV_NORMAL; break;
+    }
+    return madvise(addr, (size_t)len, flag) == 0 ? 0 : -1;
+}
+
+int32_t __koral_msync(uint8_t* addr, uint64_t len) {
+    return msync(addr, (size_t)len, MS_SYNC) == 0 ? 0 : -1;
+}
+
+#endif
+
+// ============================================================================
+// File-to-file copy (std.os)
+// ============================================================================
+// Copies up to `count` bytes (UINT64_MAX: to end of file) from the current
+// offset of `src` to the current offset of `dst`, advancing both. Linux
+// tries, in order: a reflink clone (FICLONE) when both files are at offset
+// 0 and the whole file is wanted, copy_file_range, and sendfile, so the
+// data never passes through user space. Anything the kernel refuses falls
+// back to a bounded read/write loop, as does a first call that copies
+// nothing: pseudo files in procfs and sysfs report size 0 to the kernel
+// paths but still read normally. Returns the bytes copied, -1 on error.
+
+#define KORAL_COPY_CHUNK ((size_t)1 << 20)
+#define KORAL_COPY_BUFFER ((size_t)128 * 1024)
+
+#if defined(__linux__)
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
+#endif
+
+static int64_t __koral_copy_fd_loop(int32_t src, int32_t dst, uint64_t count) {
+    uint8_t* buf = (uint8_t*)malloc(KORAL_COPY_BUFFER);
+    if (!buf) { errno = ENOMEM; return -1; }
+    uint64_t total = 0;
+    while (total < count) {
+        uint64_t want = count - total < KORAL_COPY_BUFFER ? count - total : KORAL_COPY_BUFFER;
+        int64_t n = __koral_read(src, buf, want);
+        if (n < 0) { free(buf); return -1; }
+        if (n == 0) break;
+        int64_t done = 0;
+        while (done < n) {
+            int64_t w = __koral_write(dst, buf + done, (uint64_t)(n - done));
+            if (w <= 0) {
+                if (w == 0) errno = EIO;
+                free(buf);
+                return -1;
+            }
+            done += w;
+        }
+        total += (uint64_t)n;
+    }
+    free(buf);
+    return (int64_t)total;
+}
+
+int64_t __koral_copy_fd(int32_t src, int32_t dst, uint64_t count) {
+    uint64_t total = 0;
+#if defined(__linux__)
+#if defined(FICLONE)
+    if (count == UINT64_MAX && lseek(src, 0, SEEK_CUR) == 0 && lseek(dst, 0, SEEK_CUR) == 0) {
+        struct stat st;
+        if (ioctl(dst, FICLONE, src) == 0 && fstat(src, &st) == 0) {
+            lseek(src, st.st_size, SEEK_SET);
+            lseek(dst, st.st_size, SEEK_SET);
+            return (int64_t)st.st_size;
+        }
+    }
+#endif
+#if defined(SYS_copy_file_range)
+    while (total < count) {
+        size_t want = count - total < KORAL_COPY_CHUNK ? (size_t)(count - total) : KORAL_COPY_CHUNK;
+        ssize_t n = syscall(SYS_copy_file_range, src, NULL, dst, NULL, want, 0);
+        if (n < 0) {
+            if (total == 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL ||
+                               errno == EOPNOTSUPP || errno == EBADF)) {
+                break;  // not supported between these files: try the next path
+            }
+            return -1;
+        }
+        if (n == 0) {
+            if (total == 0) break;  // procfs/sysfs report size 0: try the next path
+            return (int64_t)total;
+        }
+        total += (uint64_t)n;
+    }
+    if (total > 0 || count == 0) return (int64_t)total;
+#endif
+    while (total < count) {
+        size_t want = count - total < KORAL_COPY_CHUNK ? (size_t)(count - total) : KORAL_COPY_CHUNK;
+        ssize_t n = sendfile(dst, src, NULL, want);
+        if (n < 0) {
+            if (total == 0 && (errno == ENOSYS || errno == EINVAL)) break;
+            return -1;
+        }
+        if (n == 0) {
+            if (total == 0) break;  // as above: let the read/write loop decide
+            return (int64_t)total;
+        }
+        total += (uint64_t)n;
+    }
+    if (total > 0 || count == 0) return (int64_t)total;
+#endif
+    int64_t copied = __koral_copy_fd_loop(src, dst, count - total);
+    return copied < 0 ? -1 : (int64_t)total + copied;
+}
+
+// 1 if `path` names the file open as `fd` (same device and inode), 0 if it
+// names another file or nothing, -1 if `fd` cannot be queried. copy_file
+// checks this before truncating the destination.
+int32_t __koral_fd_same_file(int32_t fd, const uint8_t* path) {
+#if defined(_WIN32) || defined(_WIN64)
+    BY_HANDLE_FILE_INFORMATION a, b;
+    if (!GetFileInformationByHandle((HANDLE)_get_osfhandle(fd), &a)) return -1;
+    HANDLE h = CreateFileA((const char*)path, 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                           NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+    if (h == INVALID_HANDLE_VALUE) return 0;
+    BOOL ok = GetFileInformationByHandle(h, &b);
+    CloseHandle(h);
+    return ok && a.dwVolumeSerialNumber == b.dwVolumeSerialNumber &&
+           a.nFileIndexHigh == b.nFileIndexHigh && a.nFileIndexLow == b.nFileIndexLow;
+#else
+    struct stat a, b;
+    if (fstat(fd, &a) != 0) return -1;
+    if (stat((const char*)path, &b) != 0) return 0;
+    return a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+#endif
+}
+
+
+// ============================================================================
+// Subprocess management (std.command)
+// ============================================================================
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <spawn.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <poll.h>
+#endif
+
+typedef struct {
+    uint32_t pid;
+    int32_t  stdin_fd;
+    int32_t  stdout_fd;
+    int32_t  stderr_fd;
+} KoralProcess;
+
+// --- __koral_getpid ---
+
+uint32_t __koral_getpid(void) {
+#if defined(_WIN32) || defined(_WIN64)
+    return (uint32_t)GetCurrentProcessId();
+#else
+    return (uint32_t)getpid();
+#endif
+}
+
+// --- Pipe operations ---
+
+int64_t __koral_pipe_read(int32_t fd, uint8_t* buf, uint64_t count) {
+#if defined(_WIN32) || defined(_WIN64)
+    return (int64_t)_read(fd, buf, (unsigned int)count);
+#else
+    return (int64_t)read(fd, buf, (size_t)count);
+#endif
 }
 
 int64_t __koral_pipe_write(int32_t fd, const uint8_t* buf, uint64_t count) {
@@ -3031,6 +5193,8 @@ static DWORD WINAPI __koral_thread_trampoline_win(LPVOID arg) {
     __koral_closure_invoke(&args->closure);
     __koral_closure_release(args->closure);
     free(args);
+    __koral_rc_thread_exit();
+    __koral_box_thread_exit();
     return 0;
 }
 
@@ -3056,6 +5220,9 @@ int32_t __koral_spawn_thread(uint8_t** out_handle, uint64_t* out_tid,
 int32_t __koral_thread_join(uint8_t* handle) {
     DWORD result = WaitForSingleObject((HANDLE)handle, INFINITE);
     CloseHandle((HANDLE)handle);
+#if KORAL_RC_BIASED
+    __koral_rc_poll();
+#endif
     return (result == WAIT_OBJECT_0) ? 0 : -1;
 }
 
@@ -3067,6 +5234,10 @@ uint64_t __koral_thread_current_id(void) {
     return (uint64_t)GetCurrentThreadId();
 }
 
+static void __koral_os_thread_yield(void) {
+    SwitchToThread();
+}
+
 void __koral_thread_yield(void) {
     SwitchToThread();
 }
@@ -3077,6 +5248,19 @@ uint32_t __koral_hardware_concurrency(void) {
     return (uint32_t)si.dwNumberOfProcessors;
 }
 
+uintptr_t __koral_thread_current_cpus(uintptr_t* out, uintptr_t capacity) {
+    DWORD_PTR process_mask, system_mask;
+    if (!GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask)) return 0;
+    uintptr_t count = 0;
+    for (uintptr_t cpu = 0; cpu < sizeof(DWORD_PTR) * 8; cpu++) {
+        if (process_mask & ((DWORD_PTR)1 << cpu)) {
+            if (count < capacity) out[count] = cpu;
+            count++;
+        }
+    }
+    return count;
+}
+
 #else
 
 // --- POSIX thread trampoline ---
@@ -3085,6 +5269,8 @@ static void* __koral_thread_trampoline_posix(void* arg) {
     __koral_closure_invoke(&args->closure);
     __koral_closure_release(args->closure);
     free(args);
+    __koral_rc_thread_exit();
+    __koral_box_thread_exit();
     return NULL;
 }
 
@@ -3119,7 +5305,12 @@ int32_t __koral_spawn_thread(uint8_t** out_handle, uint64_t* out_tid,
 }
 
 int32_t __koral_thread_join(uint8_t* handle) {
-    return pthread_join((pthread_t)handle, NULL) == 0 ? 0 : -1;
+    int32_t result = pthread_join((pthread_t)handle, NULL) == 0 ? 0 : -1;
+#if KORAL_RC_BIASED
+    // Releases the joined thread queued to us are merged before join returns.
+    __koral_rc_poll();
+#endif
+    return result;
 }
 
 void __koral_thread_detach(uint8_t* handle) {
@@ -3130,7 +5321,15 @@ uint64_t __koral_thread_current_id(void) {
     return (uint64_t)pthread_self();
 }
 
+static void __koral_os_thread_yield(void) {
+    sched_yield();
+}
+
 void __koral_thread_yield(void) {
+    if (__koral_green_current()) {
+        __koral_green_yield();
+        return;
+    }
     sched_yield();
 }
 
@@ -3139,6 +5338,325 @@ uint32_t __koral_hardware_concurrency(void) {
     return (n > 0) ? (uint32_t)n : 1;
 }
 
+// Writes up to `capacity` CPUs the calling thread may run on to `out` and
+// returns how many there are, or 0 where the platform does not say.
+uintptr_t __koral_thread_current_cpus(uintptr_t* out, uintptr_t capacity) {
+#if defined(__linux__)
+    for (size_t max_cpu = CPU_SETSIZE; max_cpu <= (1u << 20); max_cpu *= 2) {
+        cpu_set_t* set = CPU_ALLOC(max_cpu);
+        if (!set) return 0;
+        size_t set_size = CPU_ALLOC_SIZE(max_cpu);
+        if (sched_getaffinity(0, set_size, set) != 0) {
+            int too_small = errno == EINVAL;
+            CPU_FREE(set);
+            if (too_small) continue;
+            return 0;
+        }
+        uintptr_t count = 0;
+        for (size_t cpu = 0; cpu < max_cpu; cpu++) {
+            if (CPU_ISSET_S(cpu, set_size, set)) {
+                if (count < capacity) out[count] = cpu;
+                count++;
+            }
+        }
+        CPU_FREE(set);
+        return count;
+    }
+    return 0;
+#else
+    (void)out;
+    (void)capacity;
+    return 0;
+#endif
+}
+
+#endif
+
+// --- Configured threads (Task.set_affinity / set_schedule / set_numa_node) ---
+//
+// `job` is a heap cell holding the closure, taken over by the runtime. An
+// empty `cpus` leaves the affinity alone, `policy` is one of the
+// KORAL_THREAD_POLICY_* values and `numa_node < 0` means no node. The options
+// are in place before the closure runs; on failure the closure never runs
+// and one of the KORAL_THREAD_ERR_* codes is returned.
+
+#define KORAL_THREAD_POLICY_KEEP   -1
+#define KORAL_THREAD_POLICY_NORMAL  0   // time-sharing, `priority` is the nice value
+#define KORAL_THREAD_POLICY_BATCH   1   // time-sharing for throughput, nice value
+#define KORAL_THREAD_POLICY_IDLE    2
+#define KORAL_THREAD_POLICY_FIFO    3   // real-time, `priority` 1..99
+#define KORAL_THREAD_POLICY_RR      4   // real-time, `priority` 1..99
+
+#define KORAL_THREAD_ERR_CREATE   -1
+#define KORAL_THREAD_ERR_AFFINITY -2
+#define KORAL_THREAD_ERR_SCHEDULE -3
+#define KORAL_THREAD_ERR_NUMA     -4
+
+#if defined(_WIN32) || defined(_WIN64)
+
+static int __koral_thread_win_priority(int32_t policy, int32_t priority) {
+    switch (policy) {
+        case KORAL_THREAD_POLICY_NORMAL:
+            if (priority <= -10) return THREAD_PRIORITY_HIGHEST;
+            if (priority < 0) return THREAD_PRIORITY_ABOVE_NORMAL;
+            if (priority >= 10) return THREAD_PRIORITY_LOWEST;
+            if (priority > 0) return THREAD_PRIORITY_BELOW_NORMAL;
+            return THREAD_PRIORITY_NORMAL;
+        case KORAL_THREAD_POLICY_BATCH: return THREAD_PRIORITY_BELOW_NORMAL;
+        case KORAL_THREAD_POLICY_IDLE: return THREAD_PRIORITY_IDLE;
+        default: return THREAD_PRIORITY_TIME_CRITICAL;
+    }
+}
+
+// Windows threads start suspended and are configured from the outside.
+int32_t __koral_spawn_thread_configured(uint8_t** out_handle, uint64_t* out_tid, void* job,
+                                        uint64_t stack_size, const uintptr_t* cpus, uintptr_t cpu_count,
+                                        int32_t policy, int32_t priority, intptr_t numa_node) {
+    KoralThreadArgs* args = (KoralThreadArgs*)malloc(sizeof(KoralThreadArgs));
+    if (!args) {
+        __koral_closure_release(*(struct __koral_Closure*)job);
+        free(job);
+        return KORAL_THREAD_ERR_CREATE;
+    }
+    args->closure = *(struct __koral_Closure*)job;
+    free(job);
+
+    int32_t status = 0;
+    HANDLE h = CreateThread(NULL, (SIZE_T)stack_size, __koral_thread_trampoline_win, args,
+                            CREATE_SUSPENDED, NULL);
+    if (h == NULL) {
+        __koral_closure_release(args->closure);
+        free(args);
+        return KORAL_THREAD_ERR_CREATE;
+    }
+    if (cpu_count > 0) {
+        DWORD_PTR mask = 0;
+        for (uintptr_t i = 0; i < cpu_count; i++) {
+            if (cpus[i] >= sizeof(DWORD_PTR) * 8) status = KORAL_THREAD_ERR_AFFINITY;
+            else mask |= (DWORD_PTR)1 << cpus[i];
+        }
+        if (status == 0 && SetThreadAffinityMask(h, mask) == 0) status = KORAL_THREAD_ERR_AFFINITY;
+    }
+    if (status == 0 && numa_node >= 0 && cpu_count == 0) {
+        GROUP_AFFINITY group;
+        if (!GetNumaNodeProcessorMaskEx((USHORT)numa_node, &group)
+            || !SetThreadGroupAffinity(h, &group, NULL)) {
+            status = KORAL_THREAD_ERR_NUMA;
+        }
+    }
+    if (status == 0 && policy != KORAL_THREAD_POLICY_KEEP
+        && !SetThreadPriority(h, __koral_thread_win_priority(policy, priority))) {
+        status = KORAL_THREAD_ERR_SCHEDULE;
+    }
+    if (status != 0) {
+        TerminateThread(h, 0);
+        CloseHandle(h);
+        __koral_closure_release(args->closure);
+        free(args);
+        return status;
+    }
+    ResumeThread(h);
+    *out_handle = (uint8_t*)h;
+    *out_tid = (uint64_t)GetThreadId(h);
+    return 0;
+}
+
+#else
+
+#if defined(__linux__)
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#define KORAL_MPOL_PREFERRED 1
+#define KORAL_NUMA_MAX_NODES 1024
+#endif
+
+typedef struct {
+    struct __koral_Closure closure;
+    const uintptr_t* cpus;      // borrowed from the creator, which waits
+    uintptr_t cpu_count;
+    int32_t policy;
+    int32_t priority;
+    intptr_t numa_node;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int32_t status;
+    int done;
+} KoralConfiguredThreadArgs;
+
+#if defined(__linux__)
+// Adds the CPUs listed in /sys/devices/system/node/nodeN/cpulist ("0-3,8").
+static int __koral_thread_node_cpus(intptr_t node, cpu_set_t* set, size_t set_size) {
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%ld/cpulist", (long)node);
+    FILE* f = fopen(path, "r");
+    if (!f) return -1;
+    int found = 0;
+    long first, last;
+    while (fscanf(f, "%ld", &first) == 1) {
+        last = first;
+        int c = fgetc(f);
+        if (c == '-') {
+            if (fscanf(f, "%ld", &last) != 1) break;
+            c = fgetc(f);
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            if ((size_t)cpu < set_size * 8) {
+                CPU_SET_S((size_t)cpu, set_size, set);
+                found = 1;
+            }
+        }
+        if (c != ',') break;
+    }
+    fclose(f);
+    return found ? 0 : -1;
+}
+#endif
+
+static int32_t __koral_thread_apply_affinity(KoralConfiguredThreadArgs* args) {
+#if defined(__linux__)
+    if (args->cpu_count == 0 && args->numa_node < 0) return 0;
+    size_t max_cpu = CPU_SETSIZE;
+    for (uintptr_t i = 0; i < args->cpu_count; i++) {
+        if (args->cpus[i] + 1 > max_cpu) max_cpu = args->cpus[i] + 1;
+    }
+    cpu_set_t* set = CPU_ALLOC(max_cpu);
+    if (!set) return KORAL_THREAD_ERR_AFFINITY;
+    size_t set_size = CPU_ALLOC_SIZE(max_cpu);
+    CPU_ZERO_S(set_size, set);
+    int32_t status = 0;
+    if (args->cpu_count > 0) {
+        for (uintptr_t i = 0; i < args->cpu_count; i++) {
+            CPU_SET_S(args->cpus[i], set_size, set);
+        }
+        if (sched_setaffinity(0, set_size, set) != 0) status = KORAL_THREAD_ERR_AFFINITY;
+    } else if (__koral_thread_node_cpus(args->numa_node, set, set_size) != 0
+               || sched_setaffinity(0, set_size, set) != 0) {
+        status = KORAL_THREAD_ERR_NUMA;
+    }
+    CPU_FREE(set);
+    return status;
+#else
+    return (args->cpu_count == 0 && args->numa_node < 0) ? 0 : KORAL_THREAD_ERR_AFFINITY;
+#endif
+}
+
+static int32_t __koral_thread_apply_numa(KoralConfiguredThreadArgs* args) {
+    if (args->numa_node < 0) return 0;
+#if defined(__linux__)
+    // Prefer the node for this thread's allocations; pages fall back to other
+    // nodes when it runs out of memory.
+    if (args->numa_node >= KORAL_NUMA_MAX_NODES) return KORAL_THREAD_ERR_NUMA;
+    unsigned long mask[KORAL_NUMA_MAX_NODES / (8 * sizeof(unsigned long))];
+    memset(mask, 0, sizeof(mask));
+    size_t bits = 8 * sizeof(unsigned long);
+    mask[(size_t)args->numa_node / bits] |= 1UL << ((size_t)args->numa_node % bits);
+    if (syscall(SYS_set_mempolicy, KORAL_MPOL_PREFERRED, mask, (unsigned long)KORAL_NUMA_MAX_NODES + 1) != 0) {
+        return KORAL_THREAD_ERR_NUMA;
+    }
+    return 0;
+#else
+    return KORAL_THREAD_ERR_NUMA;
+#endif
+}
+
+static int32_t __koral_thread_apply_schedule(KoralConfiguredThreadArgs* args) {
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    int policy;
+    switch (args->policy) {
+        case KORAL_THREAD_POLICY_KEEP: return 0;
+        case KORAL_THREAD_POLICY_NORMAL: policy = SCHED_OTHER; break;
+#if defined(__linux__)
+        case KORAL_THREAD_POLICY_BATCH: policy = SCHED_BATCH; break;
+        case KORAL_THREAD_POLICY_IDLE: policy = SCHED_IDLE; break;
+#endif
+        case KORAL_THREAD_POLICY_FIFO: policy = SCHED_FIFO; param.sched_priority = args->priority; break;
+        case KORAL_THREAD_POLICY_RR: policy = SCHED_RR; param.sched_priority = args->priority; break;
+        default: return KORAL_THREAD_ERR_SCHEDULE;
+    }
+    if (pthread_setschedparam(pthread_self(), policy, &param) != 0) return KORAL_THREAD_ERR_SCHEDULE;
+    if (args->policy == KORAL_THREAD_POLICY_NORMAL || args->policy == KORAL_THREAD_POLICY_BATCH) {
+#if defined(__linux__)
+        // Linux keeps a nice value per thread.
+        if (setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), args->priority) != 0) {
+            return KORAL_THREAD_ERR_SCHEDULE;
+        }
+#else
+        if (args->priority != 0) return KORAL_THREAD_ERR_SCHEDULE;
+#endif
+    }
+    return 0;
+}
+
+static void* __koral_thread_trampoline_configured(void* arg) {
+    KoralConfiguredThreadArgs* args = (KoralConfiguredThreadArgs*)arg;
+    // Memory policy first so nothing below allocates on the wrong node.
+    int32_t status = __koral_thread_apply_numa(args);
+    if (status == 0) status = __koral_thread_apply_affinity(args);
+    if (status == 0) status = __koral_thread_apply_schedule(args);
+    struct __koral_Closure closure = args->closure;
+    pthread_mutex_lock(&args->mutex);
+    args->status = status;
+    args->done = 1;
+    pthread_cond_signal(&args->cond);
+    pthread_mutex_unlock(&args->mutex);
+    // `args` belongs to the creator again from here on.
+    if (status == 0) {
+        __koral_closure_invoke(&closure);
+    }
+    __koral_closure_release(closure);
+    __koral_rc_thread_exit();
+    __koral_box_thread_exit();
+    return NULL;
+}
+
+int32_t __koral_spawn_thread_configured(uint8_t** out_handle, uint64_t* out_tid, void* job,
+                                        uint64_t stack_size, const uintptr_t* cpus, uintptr_t cpu_count,
+                                        int32_t policy, int32_t priority, intptr_t numa_node) {
+    KoralConfiguredThreadArgs args;
+    args.closure = *(struct __koral_Closure*)job;
+    free(job);
+    args.cpus = cpus;
+    args.cpu_count = cpu_count;
+    args.policy = policy;
+    args.priority = priority;
+    args.numa_node = numa_node;
+    args.status = 0;
+    args.done = 0;
+    pthread_mutex_init(&args.mutex, NULL);
+    pthread_cond_init(&args.cond, NULL);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if (stack_size > 0) {
+        pthread_attr_setstacksize(&attr, (size_t)stack_size);
+    }
+    pthread_t thread;
+    int err = pthread_create(&thread, &attr, __koral_thread_trampoline_configured, &args);
+    pthread_attr_destroy(&attr);
+    if (err != 0) {
+        __koral_closure_release(args.closure);
+        args.status = KORAL_THREAD_ERR_CREATE;
+    } else {
+        pthread_mutex_lock(&args.mutex);
+        while (!args.done) {
+            pthread_cond_wait(&args.cond, &args.mutex);
+        }
+        pthread_mutex_unlock(&args.mutex);
+        if (args.status != 0) {
+            pthread_join(thread, NULL);
+        }
+    }
+    pthread_cond_destroy(&args.cond);
+    pthread_mutex_destroy(&args.mutex);
+    if (args.status != 0) {
+        return args.status;
+    }
+    *out_handle = (uint8_t*)thread;
+    *out_tid = (uint64_t)thread;
+    return 0;
+}
+
 #endif
 
 // ============================================================================
@@ -3152,6 +5670,7 @@ typedef struct {
 #else
     pthread_mutex_t mutex;
     pthread_cond_t cond;
+    void* green_waiter;         // green thread parked in __koral_timer_sleep
 #endif
 } KoralTimerContext;
 
@@ -3212,6 +5731,7 @@ void* __koral_timer_context_create(void) {
         free(ctx);
         return NULL;
     }
+    ctx->green_waiter = NULL;
     return (void*)ctx;
 }
 
@@ -3220,6 +5740,9 @@ void __koral_timer_context_cancel(void* raw) {
     __atomic_store_n(&ctx->cancelled, 1, __ATOMIC_RELEASE);
     pthread_mutex_lock(&ctx->mutex);
     pthread_cond_signal(&ctx->cond);
+    if (ctx->green_waiter) {
+        __koral_green_wake(ctx->green_waiter);
+    }
     pthread_mutex_unlock(&ctx->mutex);
 }
 
@@ -3235,6 +5758,26 @@ int32_t __koral_timer_sleep(void* raw, int64_t secs, int64_t nanos) {
     // Check if already cancelled before sleeping
     if (__atomic_load_n(&ctx->cancelled, __ATOMIC_ACQUIRE)) return 1;
 
+    void* fiber = __koral_green_current();
+    if (fiber) {
+        // Park the green thread; cancel wakes it through green_waiter.
+        int64_t deadline_ns = __koral_green_now_ns() + secs * 1000000000LL + nanos;
+        pthread_mutex_lock(&ctx->mutex);
+        while (!__atomic_load_n(&ctx->cancelled, __ATOMIC_ACQUIRE)) {
+            if (__koral_green_now_ns() >= deadline_ns) {
+                pthread_mutex_unlock(&ctx->mutex);
+                return 0;
+            }
+            ctx->green_waiter = fiber;
+            pthread_mutex_unlock(&ctx->mutex);
+            __koral_green_park_until(deadline_ns);
+            pthread_mutex_lock(&ctx->mutex);
+            ctx->green_waiter = NULL;
+        }
+        pthread_mutex_unlock(&ctx->mutex);
+        return 1;
+    }
+
     // Compute absolute timeout using CLOCK_REALTIME
     struct timespec ts;
     clock_gettime(CLOCK_REALTIME, &ts);
@@ -3258,305 +5801,1756 @@ int32_t __koral_timer_sleep(void* raw, int64_t secs, int64_t nanos) {
         }
         // Spurious wakeup or signal: loop back and re-check cancelled flag
     }
-    pthread_mutex_unlock(&ctx->mutex);
-    return 1;  // cancelled
+    pthread_mutex_unlock(&ctx->mutex);
+    return 1;  // cancelled
+}
+
+#endif
+
+// ============================================================================
+// Thread pool (std.async)
+// ============================================================================
+//
+// A fixed set of workers, each owning a Chase-Lev work-stealing deque. A job
+// is a heap cell holding a struct __koral_Closure, written by std with
+// alloc_memory + init_memory; whoever runs the job releases the closure and
+// frees the cell.
+//
+// Jobs submitted from one of the pool's own workers go to that worker's deque
+// (taken LIFO by the owner, stolen FIFO by others); jobs from any other thread
+// go to a shared injection queue. An idle worker looks at its own deque, then
+// the injection queue, then steals from the other workers starting at a
+// random victim. If all of that fails for a few rounds it parks on
+// `idle_cond`; submitters only take `idle_lock` when someone is parked.
+//
+// Futures keep an Int32 state word in std memory. __koral_pool_wait runs
+// queued jobs while the word is 0, so a worker waiting on work it forked
+// keeps making progress, and parks on `done_cond` only when nothing is
+// runnable.
+
+#define KORAL_POOL_DEQUE_INITIAL_CAPACITY 256
+#define KORAL_POOL_SPIN_ROUNDS 64
+#define KORAL_POOL_WAIT_SLICE_MS 1
+
+#if defined(_WIN32) || defined(_WIN64)
+typedef SRWLOCK KoralPoolLock;
+typedef CONDITION_VARIABLE KoralPoolCond;
+typedef HANDLE KoralPoolThread;
+
+static void __koral_pool_lock_init(KoralPoolLock* lock) { InitializeSRWLock(lock); }
+static void __koral_pool_lock_destroy(KoralPoolLock* lock) { (void)lock; }
+static void __koral_pool_lock(KoralPoolLock* lock) { AcquireSRWLockExclusive(lock); }
+static void __koral_pool_unlock(KoralPoolLock* lock) { ReleaseSRWLockExclusive(lock); }
+static void __koral_pool_cond_init(KoralPoolCond* cond) { InitializeConditionVariable(cond); }
+static void __koral_pool_cond_destroy(KoralPoolCond* cond) { (void)cond; }
+static void __koral_pool_cond_wait(KoralPoolCond* cond, KoralPoolLock* lock) {
+    SleepConditionVariableSRW(cond, lock, INFINITE, 0);
+}
+static void __koral_pool_cond_wait_ms(KoralPoolCond* cond, KoralPoolLock* lock, uint32_t ms) {
+    SleepConditionVariableSRW(cond, lock, ms, 0);
+}
+static void __koral_pool_cond_signal(KoralPoolCond* cond) { WakeConditionVariable(cond); }
+static void __koral_pool_cond_broadcast(KoralPoolCond* cond) { WakeAllConditionVariable(cond); }
+#else
+typedef pthread_mutex_t KoralPoolLock;
+typedef pthread_cond_t KoralPoolCond;
+typedef pthread_t KoralPoolThread;
+
+static void __koral_pool_lock_init(KoralPoolLock* lock) { pthread_mutex_init(lock, NULL); }
+static void __koral_pool_lock_destroy(KoralPoolLock* lock) { pthread_mutex_destroy(lock); }
+static void __koral_pool_lock(KoralPoolLock* lock) { pthread_mutex_lock(lock); }
+static void __koral_pool_unlock(KoralPoolLock* lock) { pthread_mutex_unlock(lock); }
+static void __koral_pool_cond_init(KoralPoolCond* cond) { pthread_cond_init(cond, NULL); }
+static void __koral_pool_cond_destroy(KoralPoolCond* cond) { pthread_cond_destroy(cond); }
+static void __koral_pool_cond_wait(KoralPoolCond* cond, KoralPoolLock* lock) {
+    pthread_cond_wait(cond, lock);
+}
+static void __koral_pool_cond_wait_ms(KoralPoolCond* cond, KoralPoolLock* lock, uint32_t ms) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += (long)ms * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec += ts.tv_nsec / 1000000000L;
+        ts.tv_nsec %= 1000000000L;
+    }
+    pthread_cond_timedwait(cond, lock, &ts);
+}
+static void __koral_pool_cond_signal(KoralPoolCond* cond) { pthread_cond_signal(cond); }
+static void __koral_pool_cond_broadcast(KoralPoolCond* cond) { pthread_cond_broadcast(cond); }
+#endif
+
+typedef struct KoralPoolBuffer {
+    int64_t capacity;                 // power of two
+    struct KoralPoolBuffer* retired;  // smaller predecessor, freed with the deque
+    _Atomic(void*) slots[];
+} KoralPoolBuffer;
+
+typedef struct {
+    _Atomic int64_t top;
+    _Atomic int64_t bottom;
+    _Atomic(KoralPoolBuffer*) buffer;
+} KoralPoolDeque;
+
+struct KoralPool;
+
+typedef struct {
+    KoralPoolDeque deque;
+    struct KoralPool* pool;
+    uint64_t rng;
+    KoralPoolThread thread;
+} KoralPoolWorker;
+
+typedef struct KoralPool {
+    KoralPoolWorker* workers;
+    size_t worker_count;
+
+    KoralPoolLock inject_lock;
+    void** inject_items;              // ring buffer, guarded by inject_lock
+    size_t inject_head;
+    size_t inject_count;
+    size_t inject_capacity;
+    _Atomic size_t inject_size;       // inject_count, readable without the lock
+
+    KoralPoolLock idle_lock;
+    KoralPoolCond idle_cond;          // parked workers
+    KoralPoolCond done_cond;          // __koral_pool_wait callers
+    _Atomic int sleepers;
+    _Atomic int done_waiters;
+
+    _Atomic int shutdown;
+    _Atomic int detached;             // destroyed from one of its own workers
+    _Atomic size_t alive;             // workers that have not exited yet
+} KoralPool;
+
+static _Thread_local KoralPoolWorker* __koral_pool_self = NULL;
+static _Thread_local uint64_t __koral_pool_outsider_rng = 0;
+static _Atomic(KoralPool*) __koral_pool_global_instance = NULL;
+
+static void __koral_pool_oom(void) {
+    fprintf(stderr, "Panic: out of memory in thread pool\n");
+    abort();
+}
+
+// --- Chase-Lev deque (Le, Pop, Cohen, Zappa Nardelli, PPoPP 2013) ---
+
+static KoralPoolBuffer* __koral_pool_buffer_new(int64_t capacity, KoralPoolBuffer* retired) {
+    KoralPoolBuffer* buffer = (KoralPoolBuffer*)malloc(
+        sizeof(KoralPoolBuffer) + (size_t)capacity * sizeof(_Atomic(void*)));
+    if (!buffer) __koral_pool_oom();
+    buffer->capacity = capacity;
+    buffer->retired = retired;
+    return buffer;
+}
+
+static void __koral_pool_deque_init(KoralPoolDeque* deque) {
+    atomic_init(&deque->top, 0);
+    atomic_init(&deque->bottom, 0);
+    atomic_init(&deque->buffer, __koral_pool_buffer_new(KORAL_POOL_DEQUE_INITIAL_CAPACITY, NULL));
+}
+
+static void __koral_pool_deque_destroy(KoralPoolDeque* deque) {
+    KoralPoolBuffer* buffer = atomic_load_explicit(&deque->buffer, memory_order_relaxed);
+    while (buffer) {
+        KoralPoolBuffer* retired = buffer->retired;
+        free(buffer);
+        buffer = retired;
+    }
+}
+
+// Owner only.
+static void __koral_pool_deque_push(KoralPoolDeque* deque, void* job) {
+    int64_t b = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    int64_t t = atomic_load_explicit(&deque->top, memory_order_acquire);
+    KoralPoolBuffer* buffer = atomic_load_explicit(&deque->buffer, memory_order_relaxed);
+    if (b - t > buffer->capacity - 1) {
+        // Thieves may still read the old buffer, so it is retired, not freed.
+        KoralPoolBuffer* grown = __koral_pool_buffer_new(buffer->capacity * 2, buffer);
+        for (int64_t i = t; i < b; i++) {
+            void* item = atomic_load_explicit(&buffer->slots[i & (buffer->capacity - 1)], memory_order_relaxed);
+            atomic_store_explicit(&grown->slots[i & (grown->capacity - 1)], item, memory_order_relaxed);
+        }
+        atomic_store_explicit(&deque->buffer, grown, memory_order_release);
+        buffer = grown;
+    }
+    atomic_store_explicit(&buffer->slots[b & (buffer->capacity - 1)], job, memory_order_relaxed);
+    atomic_store_explicit(&deque->bottom, b + 1, memory_order_release);
+}
+
+// Owner only.
+static void* __koral_pool_deque_take(KoralPoolDeque* deque) {
+    int64_t b = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    KoralPoolBuffer* buffer = atomic_load_explicit(&deque->buffer, memory_order_relaxed);
+    atomic_store_explicit(&deque->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t t = atomic_load_explicit(&deque->top, memory_order_relaxed);
+    if (t > b) {
+        atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+        return NULL;
+    }
+    void* job = atomic_load_explicit(&buffer->slots[b & (buffer->capacity - 1)], memory_order_relaxed);
+    if (t == b) {
+        // Last element: race the thieves for it.
+        if (!atomic_compare_exchange_strong_explicit(&deque->top, &t, t + 1,
+                                                     memory_order_seq_cst, memory_order_relaxed)) {
+            job = NULL;
+        }
+        atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+    }
+    return job;
+}
+
+// Any thread. Returns NULL when empty or when another thief won the race.
+static void* __koral_pool_deque_steal(KoralPoolDeque* deque) {
+    int64_t t = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t b = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+    if (t >= b) {
+        return NULL;
+    }
+    KoralPoolBuffer* buffer = atomic_load_explicit(&deque->buffer, memory_order_acquire);
+    void* job = atomic_load_explicit(&buffer->slots[t & (buffer->capacity - 1)], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &t, t + 1,
+                                                 memory_order_seq_cst, memory_order_relaxed)) {
+        return NULL;
+    }
+    return job;
+}
+
+static int __koral_pool_deque_is_empty(KoralPoolDeque* deque) {
+    int64_t t = atomic_load_explicit(&deque->top, memory_order_acquire);
+    int64_t b = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+    return t >= b;
+}
+
+// --- Injection queue ---
+
+static void __koral_pool_inject(KoralPool* pool, void* job) {
+    __koral_pool_lock(&pool->inject_lock);
+    if (pool->inject_count == pool->inject_capacity) {
+        size_t capacity = pool->inject_capacity ? pool->inject_capacity * 2 : 64;
+        void** items = (void**)malloc(capacity * sizeof(void*));
+        if (!items) __koral_pool_oom();
+        for (size_t i = 0; i < pool->inject_count; i++) {
+            items[i] = pool->inject_items[(pool->inject_head + i) % pool->inject_capacity];
+        }
+        free(pool->inject_items);
+        pool->inject_items = items;
+        pool->inject_head = 0;
+        pool->inject_capacity = capacity;
+    }
+    pool->inject_items[(pool->inject_head + pool->inject_count) % pool->inject_capacity] = job;
+    pool->inject_count++;
+    atomic_store_explicit(&pool->inject_size, pool->inject_count, memory_order_seq_cst);
+    __koral_pool_unlock(&pool->inject_lock);
+}
+
+static void* __koral_pool_take_injected(KoralPool* pool) {
+    if (atomic_load_explicit(&pool->inject_size, memory_order_acquire) == 0) {
+        return NULL;
+    }
+    void* job = NULL;
+    __koral_pool_lock(&pool->inject_lock);
+    if (pool->inject_count > 0) {
+        job = pool->inject_items[pool->inject_head];
+        pool->inject_head = (pool->inject_head + 1) % pool->inject_capacity;
+        pool->inject_count--;
+        atomic_store_explicit(&pool->inject_size, pool->inject_count, memory_order_release);
+    }
+    __koral_pool_unlock(&pool->inject_lock);
+    return job;
+}
+
+// --- Scheduling ---
+
+static uint64_t __koral_pool_next_random(uint64_t* state) {
+    uint64_t x = *state ? *state : 0x9E3779B97F4A7C15ull;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+static void __koral_pool_run(void* job) {
+    if ((uintptr_t)job & 1) {
+        // A runnable green thread, see "Green threads" below.
+        __koral_green_resume((void*)((uintptr_t)job & ~(uintptr_t)1));
+        return;
+    }
+    struct __koral_Closure* closure = (struct __koral_Closure*)job;
+    __koral_closure_invoke(closure);
+    __koral_closure_release(*closure);
+    free(job);
+}
+
+static void* __koral_pool_find_job(KoralPool* pool, KoralPoolWorker* self) {
+    void* job;
+    if (self && (job = __koral_pool_deque_take(&self->deque))) {
+        return job;
+    }
+    if ((job = __koral_pool_take_injected(pool))) {
+        return job;
+    }
+    uint64_t* rng = self ? &self->rng : &__koral_pool_outsider_rng;
+    size_t start = (size_t)(__koral_pool_next_random(rng) % pool->worker_count);
+    for (size_t i = 0; i < pool->worker_count; i++) {
+        KoralPoolWorker* victim = &pool->workers[(start + i) % pool->worker_count];
+        if (victim != self && (job = __koral_pool_deque_steal(&victim->deque))) {
+            return job;
+        }
+    }
+    return NULL;
+}
+
+static int __koral_pool_has_work(KoralPool* pool) {
+    if (atomic_load_explicit(&pool->inject_size, memory_order_seq_cst) > 0) {
+        return 1;
+    }
+    for (size_t i = 0; i < pool->worker_count; i++) {
+        if (!__koral_pool_deque_is_empty(&pool->workers[i].deque)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void __koral_pool_wake_one(KoralPool* pool) {
+    // Pairs with the sleepers increment in __koral_pool_worker_main: either the
+    // parking worker sees the new job, or we see it parked and signal.
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&pool->sleepers, memory_order_relaxed) > 0) {
+        __koral_pool_lock(&pool->idle_lock);
+        __koral_pool_cond_signal(&pool->idle_cond);
+        __koral_pool_unlock(&pool->idle_lock);
+    }
+}
+
+static void __koral_pool_free(KoralPool* pool) {
+    for (size_t i = 0; i < pool->worker_count; i++) {
+        __koral_pool_deque_destroy(&pool->workers[i].deque);
+    }
+    free(pool->workers);
+    free(pool->inject_items);
+    __koral_pool_lock_destroy(&pool->inject_lock);
+    __koral_pool_lock_destroy(&pool->idle_lock);
+    __koral_pool_cond_destroy(&pool->idle_cond);
+    __koral_pool_cond_destroy(&pool->done_cond);
+    free(pool);
+}
+
+static void __koral_pool_worker_main(KoralPoolWorker* self) {
+    KoralPool* pool = self->pool;
+    __koral_pool_self = self;
+    int idle_rounds = 0;
+    for (;;) {
+        void* job = __koral_pool_find_job(pool, self);
+        if (job) {
+            __koral_pool_run(job);
+            idle_rounds = 0;
+            continue;
+        }
+        if (idle_rounds < KORAL_POOL_SPIN_ROUNDS) {
+            idle_rounds++;
+            __koral_thread_yield();
+            continue;
+        }
+        idle_rounds = 0;
+
+        __koral_pool_lock(&pool->idle_lock);
+        atomic_fetch_add_explicit(&pool->sleepers, 1, memory_order_seq_cst);
+        while (!atomic_load_explicit(&pool->shutdown, memory_order_acquire) && !__koral_pool_has_work(pool)) {
+            __koral_pool_cond_wait(&pool->idle_cond, &pool->idle_lock);
+        }
+        atomic_fetch_sub_explicit(&pool->sleepers, 1, memory_order_relaxed);
+        int stop = atomic_load_explicit(&pool->shutdown, memory_order_acquire) && !__koral_pool_has_work(pool);
+        __koral_pool_unlock(&pool->idle_lock);
+        if (stop) {
+            break;
+        }
+    }
+    __koral_pool_self = NULL;
+    __koral_rc_thread_exit();
+    __koral_box_thread_exit();
+    if (atomic_fetch_sub_explicit(&pool->alive, 1, memory_order_acq_rel) == 1
+        && atomic_load_explicit(&pool->detached, memory_order_acquire)) {
+        __koral_pool_free(pool);
+    }
+}
+
+#if defined(_WIN32) || defined(_WIN64)
+static DWORD WINAPI __koral_pool_worker_trampoline(LPVOID arg) {
+    __koral_pool_worker_main((KoralPoolWorker*)arg);
+    return 0;
+}
+
+static int __koral_pool_thread_start(KoralPoolWorker* worker) {
+    worker->thread = CreateThread(NULL, 0, __koral_pool_worker_trampoline, worker, 0, NULL);
+    return worker->thread != NULL;
+}
+
+static void __koral_pool_thread_join(KoralPoolThread thread) {
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+
+static void __koral_pool_thread_detach(KoralPoolThread thread) {
+    CloseHandle(thread);
+}
+#else
+static void* __koral_pool_worker_trampoline(void* arg) {
+    __koral_pool_worker_main((KoralPoolWorker*)arg);
+    return NULL;
+}
+
+static int __koral_pool_thread_start(KoralPoolWorker* worker) {
+    return pthread_create(&worker->thread, NULL, __koral_pool_worker_trampoline, worker) == 0;
+}
+
+static void __koral_pool_thread_join(KoralPoolThread thread) {
+    pthread_join(thread, NULL);
+}
+
+static void __koral_pool_thread_detach(KoralPoolThread thread) {
+    pthread_detach(thread);
+}
+#endif
+
+// --- Entry points used by std/async/pool.koral ---
+
+// `threads == 0` sizes the pool from __koral_hardware_concurrency().
+void* __koral_pool_create(size_t threads) {
+    if (threads == 0) {
+        threads = __koral_hardware_concurrency();
+    }
+    KoralPool* pool = (KoralPool*)calloc(1, sizeof(KoralPool));
+    KoralPoolWorker* workers = (KoralPoolWorker*)calloc(threads, sizeof(KoralPoolWorker));
+    if (!pool || !workers) __koral_pool_oom();
+    pool->workers = workers;
+    pool->worker_count = threads;
+    __koral_pool_lock_init(&pool->inject_lock);
+    __koral_pool_lock_init(&pool->idle_lock);
+    __koral_pool_cond_init(&pool->idle_cond);
+    __koral_pool_cond_init(&pool->done_cond);
+    atomic_init(&pool->inject_size, 0);
+    atomic_init(&pool->sleepers, 0);
+    atomic_init(&pool->done_waiters, 0);
+    atomic_init(&pool->shutdown, 0);
+    atomic_init(&pool->detached, 0);
+    atomic_init(&pool->alive, threads);
+    for (size_t i = 0; i < threads; i++) {
+        __koral_pool_deque_init(&workers[i].deque);
+        workers[i].pool = pool;
+        workers[i].rng = 0x9E3779B97F4A7C15ull * (i + 1);
+    }
+    for (size_t i = 0; i < threads; i++) {
+        if (!__koral_pool_thread_start(&workers[i])) {
+            fprintf(stderr, "Panic: failed to start thread pool worker\n");
+            abort();
+        }
+    }
+    return pool;
+}
+
+void __koral_pool_destroy(void* raw_pool);
+
+// Shared pool sized from the hardware concurrency, created on first use and
+// never destroyed.
+void* __koral_pool_global(void) {
+    KoralPool* pool = atomic_load_explicit(&__koral_pool_global_instance, memory_order_acquire);
+    if (pool) {
+        return pool;
+    }
+    KoralPool* created = (KoralPool*)__koral_pool_create(0);
+    KoralPool* expected = NULL;
+    if (!atomic_compare_exchange_strong_explicit(&__koral_pool_global_instance, &expected, created,
+                                                 memory_order_acq_rel, memory_order_acquire)) {
+        __koral_pool_destroy(created);
+        return expected;
+    }
+    return created;
+}
+
+// Runs every job already submitted, then stops the workers. When called from
+// one of the pool's own workers the threads are detached instead of joined and
+// the last worker to exit frees the pool.
+void __koral_pool_destroy(void* raw_pool) {
+    KoralPool* pool = (KoralPool*)raw_pool;
+    if (!pool) return;
+    int from_worker = __koral_pool_self && __koral_pool_self->pool == pool;
+    if (from_worker) {
+        atomic_store_explicit(&pool->detached, 1, memory_order_seq_cst);
+    }
+    __koral_pool_lock(&pool->idle_lock);
+    atomic_store_explicit(&pool->shutdown, 1, memory_order_seq_cst);
+    __koral_pool_cond_broadcast(&pool->idle_cond);
+    __koral_pool_unlock(&pool->idle_lock);
+    if (from_worker) {
+        for (size_t i = 0; i < pool->worker_count; i++) {
+            __koral_pool_thread_detach(pool->workers[i].thread);
+        }
+        return;
+    }
+    for (size_t i = 0; i < pool->worker_count; i++) {
+        __koral_pool_thread_join(pool->workers[i].thread);
+    }
+    __koral_pool_free(pool);
+}
+
+size_t __koral_pool_thread_count(void* raw_pool) {
+    return ((KoralPool*)raw_pool)->worker_count;
+}
+
+// Takes ownership of `job`, a malloc'ed cell holding a struct __koral_Closure.
+void __koral_pool_submit(void* raw_pool, void* job) {
+    KoralPool* pool = (KoralPool*)raw_pool;
+    KoralPoolWorker* self = __koral_pool_self;
+    if (self && self->pool == pool) {
+        __koral_pool_deque_push(&self->deque, job);
+    } else {
+        __koral_pool_inject(pool, job);
+    }
+    __koral_pool_wake_one(pool);
+}
+
+// Blocks until *state becomes non-zero, running queued jobs in the meantime.
+void __koral_pool_wait(void* raw_pool, int32_t* state) {
+    KoralPool* pool = (KoralPool*)raw_pool;
+    _Atomic int32_t* word = (_Atomic int32_t*)state;
+    KoralPoolWorker* self = (__koral_pool_self && __koral_pool_self->pool == pool) ? __koral_pool_self : NULL;
+    while (atomic_load_explicit(word, memory_order_acquire) == 0) {
+        void* job = __koral_pool_find_job(pool, self);
+        if (job) {
+            __koral_pool_run(job);
+            continue;
+        }
+        __koral_pool_lock(&pool->idle_lock);
+        atomic_fetch_add_explicit(&pool->done_waiters, 1, memory_order_seq_cst);
+        if (atomic_load_explicit(word, memory_order_seq_cst) == 0) {
+            // Bounded so that jobs submitted meanwhile are still helped with.
+            __koral_pool_cond_wait_ms(&pool->done_cond, &pool->idle_lock, KORAL_POOL_WAIT_SLICE_MS);
+        }
+        atomic_fetch_sub_explicit(&pool->done_waiters, 1, memory_order_relaxed);
+        __koral_pool_unlock(&pool->idle_lock);
+    }
+}
+
+int32_t __koral_pool_is_complete(int32_t* state) {
+    return atomic_load_explicit((_Atomic int32_t*)state, memory_order_acquire) != 0;
+}
+
+// Publishes a future's result: sets *state to 1 and wakes __koral_pool_wait.
+void __koral_pool_complete(void* raw_pool, int32_t* state) {
+    KoralPool* pool = (KoralPool*)raw_pool;
+    atomic_store_explicit((_Atomic int32_t*)state, 1, memory_order_seq_cst);
+    if (atomic_load_explicit(&pool->done_waiters, memory_order_seq_cst) > 0) {
+        __koral_pool_lock(&pool->idle_lock);
+        __koral_pool_cond_broadcast(&pool->done_cond);
+        __koral_pool_unlock(&pool->idle_lock);
+    }
+}
+
+// ============================================================================
+// Green threads (std.async)
+// ============================================================================
+//
+// Green threads are fibers multiplexed onto the workers of a dedicated thread
+// pool (M:N). Each fiber runs on its own mmap'ed stack with a guard page
+// below it; pages are only committed when touched, so a stack grows on demand
+// up to KORAL_GREEN_STACK_SIZE. Context switches use ucontext.
+//
+// A runnable fiber is submitted to the pool as a job pointer with its low bit
+// set. A fiber woken by another fiber therefore lands on the waker's local
+// deque, and idle carriers steal fibers like any other job.
+//
+// One reactor thread owns an epoll instance and a timer heap. Runtime calls
+// that would block -- socket accept/connect/send/recv, Timer sleeps, condvar
+// waits (and so channel send/recv), nanosleep -- park the fiber instead of
+// its carrier when they are made on a green thread.
+//
+// A wake may race with the park that it ends, so parking is a state machine:
+//   RUNNING -park-> PARKING -carrier-> PARKED -wake-> RUNNING (resubmitted)
+//   RUNNING/PARKING -wake-> NOTIFIED (the park returns at once, or the
+//   carrier resubmits the fiber instead of parking it)
+// Parks may return spuriously; every caller loops on its own condition.
+//
+// A fiber may resume on a different carrier, so fiber-side code reads the
+// carrier's thread-locals only through the noinline __koral_green_current().
+//
+// A fiber blocked in an OS-level wait (a pthread mutex, file I/O) still holds
+// its carrier; std.sync locks sleep on wait words and park instead. Only one fiber may wait to read and one to write a socket at a
+// time. On platforms without epoll/ucontext every green thread is an OS
+// thread.
+
+typedef struct KoralGreenWaiter {
+    void* fiber;
+    struct KoralGreenWaiter* prev;
+    struct KoralGreenWaiter* next;
+    int queued;
+    const void* key;                // wait word, for waiters in a futex bucket
+} KoralGreenWaiter;
+
+typedef struct {
+    KoralGreenWaiter* head;
+    KoralGreenWaiter* tail;
+} KoralGreenWaitList;
+
+static void __koral_green_waitlist_push(KoralGreenWaitList* list, KoralGreenWaiter* waiter) {
+    waiter->next = NULL;
+    waiter->prev = list->tail;
+    if (list->tail) {
+        list->tail->next = waiter;
+    } else {
+        list->head = waiter;
+    }
+    list->tail = waiter;
+    waiter->queued = 1;
+}
+
+static void __koral_green_waitlist_remove(KoralGreenWaitList* list, KoralGreenWaiter* waiter) {
+    if (!waiter->queued) return;
+    if (waiter->prev) waiter->prev->next = waiter->next; else list->head = waiter->next;
+    if (waiter->next) waiter->next->prev = waiter->prev; else list->tail = waiter->prev;
+    waiter->prev = waiter->next = NULL;
+    waiter->queued = 0;
+}
+
+static KoralGreenWaiter* __koral_green_waitlist_pop(KoralGreenWaitList* list) {
+    KoralGreenWaiter* waiter = list->head;
+    if (waiter) {
+        __koral_green_waitlist_remove(list, waiter);
+    }
+    return waiter;
 }
 
+#if defined(__linux__)
+#include <ucontext.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#ifndef KORAL_GREEN_STACK_SIZE
+#define KORAL_GREEN_STACK_SIZE (256 * 1024)
 #endif
+#define KORAL_GREEN_STACK_CACHE 64
+#define KORAL_GREEN_EPOLL_BATCH 128
+#define KORAL_GREEN_NO_TIMER ((size_t)-1)
+#define KORAL_GREEN_WAKE_TOKEN UINT64_MAX
+#define KORAL_GREEN_DEADLINE_UNSET INT64_MIN
 
-// ============================================================================
-// Sync primitives: Mutex, SharedMutex, Condvar, Atomics
-// ============================================================================
+enum {
+    KORAL_FIBER_RUNNING,
+    KORAL_FIBER_PARKING,
+    KORAL_FIBER_PARKED,
+    KORAL_FIBER_NOTIFIED,
+};
 
-// --- Condvar struct for POSIX (needs internal mutex + generation for shared mutex wait) ---
-#if !defined(_WIN32) && !defined(_WIN64)
+enum {
+    KORAL_FIBER_SWITCH_PARK,
+    KORAL_FIBER_SWITCH_YIELD,
+    KORAL_FIBER_SWITCH_EXIT,
+};
 
-typedef struct {
-    pthread_cond_t cond;
-    pthread_mutex_t internal_mutex;  // for shared mutex wait
-    volatile int generation;         // for shared mutex wait
-} KoralCondvar;
+typedef struct KoralFiber {
+    ucontext_t context;
+    ucontext_t* carrier;            // context of the carrier running the fiber
+    char* stack;                    // mapping base; the guard page comes first
+    struct __koral_Closure closure;
+    _Atomic int state;
+    int switch_reason;
+    _Atomic int refs;               // the fiber itself + the std handle
+    KoralArena* arena;              // arena scope, saved while switched out
+#if KORAL_RC_BIASED
+    int rc_lock_depth;              // Koral locks held, saved while switched out
+#endif
+    int64_t deadline_ns;            // guarded by the scheduler lock
+    size_t timer_index;             // heap slot, or KORAL_GREEN_NO_TIMER
+    KoralPoolLock join_lock;
+    KoralPoolCond join_cond;        // OS threads waiting in __koral_green_join
+    KoralGreenWaitList joiners;     // fibers waiting in __koral_green_join
+    int finished;                   // guarded by join_lock
+} KoralFiber;
 
-#else
+typedef struct {
+    KoralFiber* reader;
+    KoralFiber* writer;
+    int registered;                 // fd is in the epoll set (possibly disarmed)
+    int nonblocking;                // O_NONBLOCK was set by the green runtime
+} KoralGreenFdSlot;
 
 typedef struct {
-    CONDITION_VARIABLE cv;
-} KoralCondvar;
+    KoralPool* pool;
+    int epoll_fd;
+    int wake_fd;                    // eventfd, kicks the reactor when the timer head changes
+    KoralPoolLock lock;             // fd slots and timer heap
+    KoralGreenFdSlot* fds;
+    size_t fd_capacity;
+    KoralFiber** timers;            // min-heap on deadline_ns
+    size_t timer_count;
+    size_t timer_capacity;
+    KoralPoolLock stack_lock;
+    char* stacks[KORAL_GREEN_STACK_CACHE];
+    size_t stack_count;
+    size_t page_size;
+} KoralGreenScheduler;
+
+static KoralGreenScheduler __koral_green;
+static pthread_once_t __koral_green_once = PTHREAD_ONCE_INIT;
+static _Atomic int __koral_green_ready = 0;
+static _Thread_local KoralFiber* __koral_green_running = NULL;
+static _Thread_local ucontext_t __koral_green_carrier_context;
+
+static __attribute__((noinline)) void* __koral_green_current(void) {
+    return __koral_green_running;
+}
+
+static int64_t __koral_green_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
 
-#endif
+// --- Stacks ---
 
-// ============================================================================
-// Mutex
-// ============================================================================
+static char* __koral_green_stack_alloc(void) {
+    __koral_pool_lock(&__koral_green.stack_lock);
+    if (__koral_green.stack_count > 0) {
+        char* stack = __koral_green.stacks[--__koral_green.stack_count];
+        __koral_pool_unlock(&__koral_green.stack_lock);
+        return stack;
+    }
+    __koral_pool_unlock(&__koral_green.stack_lock);
+    size_t guard = __koral_green.page_size;
+    char* stack = (char*)mmap(NULL, guard + KORAL_GREEN_STACK_SIZE, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if (stack == MAP_FAILED) {
+        fprintf(stderr, "Panic: failed to allocate green thread stack\n");
+        abort();
+    }
+    mprotect(stack, guard, PROT_NONE);
+    return stack;
+}
 
-#if defined(_WIN32) || defined(_WIN64)
+static void __koral_green_stack_free(char* stack) {
+    __koral_pool_lock(&__koral_green.stack_lock);
+    if (__koral_green.stack_count < KORAL_GREEN_STACK_CACHE) {
+        __koral_green.stacks[__koral_green.stack_count++] = stack;
+        __koral_pool_unlock(&__koral_green.stack_lock);
+        return;
+    }
+    __koral_pool_unlock(&__koral_green.stack_lock);
+    munmap(stack, __koral_green.page_size + KORAL_GREEN_STACK_SIZE);
+}
+
+// --- Scheduling ---
+
+static void __koral_green_schedule(KoralFiber* fiber) {
+    __koral_pool_submit(__koral_green.pool, (void*)((uintptr_t)fiber | 1));
+}
 
-void* __koral_mutex_create(void) {
-    CRITICAL_SECTION* cs = (CRITICAL_SECTION*)malloc(sizeof(CRITICAL_SECTION));
-    if (!cs) return NULL;
-    InitializeCriticalSection(cs);
-    return (void*)cs;
+static void __koral_green_release_fiber(KoralFiber* fiber) {
+    if (atomic_fetch_sub_explicit(&fiber->refs, 1, memory_order_acq_rel) == 1) {
+        __koral_pool_lock_destroy(&fiber->join_lock);
+        __koral_pool_cond_destroy(&fiber->join_cond);
+        free(fiber);
+    }
 }
 
-void __koral_mutex_destroy(void* mutex) {
-    if (!mutex) return;
-    DeleteCriticalSection((CRITICAL_SECTION*)mutex);
-    free(mutex);
+static void __koral_green_wake(void* raw_fiber) {
+    KoralFiber* fiber = (KoralFiber*)raw_fiber;
+    int state = atomic_load_explicit(&fiber->state, memory_order_acquire);
+    for (;;) {
+        if (state == KORAL_FIBER_PARKED) {
+            if (atomic_compare_exchange_weak_explicit(&fiber->state, &state, KORAL_FIBER_RUNNING,
+                                                      memory_order_acq_rel, memory_order_acquire)) {
+                __koral_green_schedule(fiber);
+                return;
+            }
+        } else if (state == KORAL_FIBER_RUNNING || state == KORAL_FIBER_PARKING) {
+            if (atomic_compare_exchange_weak_explicit(&fiber->state, &state, KORAL_FIBER_NOTIFIED,
+                                                      memory_order_acq_rel, memory_order_acquire)) {
+                return;
+            }
+        } else {
+            return;
+        }
+    }
 }
 
-void __koral_mutex_lock(void* mutex) {
-    EnterCriticalSection((CRITICAL_SECTION*)mutex);
+static void __koral_green_switch_out(KoralFiber* fiber, int reason) {
+    fiber->switch_reason = reason;
+    swapcontext(&fiber->context, fiber->carrier);
 }
 
-int32_t __koral_mutex_try_lock(void* mutex) {
-    return TryEnterCriticalSection((CRITICAL_SECTION*)mutex) ? 1 : 0;
+// Runs `fiber` on the calling carrier until it parks, yields or exits.
+static void __koral_green_resume(void* raw_fiber) {
+    KoralFiber* fiber = (KoralFiber*)raw_fiber;
+    KoralArena* carrier_arena = __koral_arena_current;
+    __koral_arena_current = fiber->arena;
+    __koral_arena_fiber = fiber;
+#if KORAL_RC_BIASED
+    int carrier_lock_depth = __koral_rc_lock_depth;
+    __koral_rc_lock_depth = fiber->rc_lock_depth;
+#endif
+    __koral_green_running = fiber;
+    fiber->carrier = &__koral_green_carrier_context;
+    swapcontext(&__koral_green_carrier_context, &fiber->context);
+    __koral_green_running = NULL;
+    fiber->arena = __koral_arena_current;
+    __koral_arena_current = carrier_arena;
+    __koral_arena_fiber = NULL;
+#if KORAL_RC_BIASED
+    fiber->rc_lock_depth = __koral_rc_lock_depth;
+    __koral_rc_lock_depth = carrier_lock_depth;
+#endif
+
+    switch (fiber->switch_reason) {
+    case KORAL_FIBER_SWITCH_YIELD:
+        __koral_green_schedule(fiber);
+        break;
+    case KORAL_FIBER_SWITCH_PARK: {
+        // Once PARKED is published a waker may resume the fiber elsewhere,
+        // so nothing below may touch it.
+        int expected = KORAL_FIBER_PARKING;
+        if (!atomic_compare_exchange_strong_explicit(&fiber->state, &expected, KORAL_FIBER_PARKED,
+                                                     memory_order_acq_rel, memory_order_acquire)) {
+            atomic_store_explicit(&fiber->state, KORAL_FIBER_RUNNING, memory_order_release);
+            __koral_green_schedule(fiber);
+        }
+        break;
+    }
+    default:
+        __koral_green_stack_free(fiber->stack);
+        __koral_green_release_fiber(fiber);
+        break;
+    }
 }
 
-void __koral_mutex_unlock(void* mutex) {
-    LeaveCriticalSection((CRITICAL_SECTION*)mutex);
+static void __koral_green_yield(void) {
+    KoralFiber* fiber = (KoralFiber*)__koral_green_current();
+    __koral_green_switch_out(fiber, KORAL_FIBER_SWITCH_YIELD);
 }
 
-#else
+static void __koral_green_entry(void) {
+    KoralFiber* fiber = (KoralFiber*)__koral_green_current();
+    __koral_closure_invoke(&fiber->closure);
+    __koral_closure_release(fiber->closure);
 
-void* __koral_mutex_create(void) {
-    pthread_mutex_t* m = (pthread_mutex_t*)malloc(sizeof(pthread_mutex_t));
-    if (!m) return NULL;
-    if (pthread_mutex_init(m, NULL) != 0) {
-        free(m);
-        return NULL;
+    __koral_pool_lock(&fiber->join_lock);
+    fiber->finished = 1;
+    KoralGreenWaiter* waiter;
+    while ((waiter = __koral_green_waitlist_pop(&fiber->joiners))) {
+        __koral_green_wake(waiter->fiber);
     }
-    return (void*)m;
+    __koral_pool_cond_broadcast(&fiber->join_cond);
+    __koral_pool_unlock(&fiber->join_lock);
+
+    __koral_green_switch_out(fiber, KORAL_FIBER_SWITCH_EXIT);
+}
+
+// --- Reactor: timers ---
+
+static void __koral_green_heap_place(size_t index, KoralFiber* fiber) {
+    __koral_green.timers[index] = fiber;
+    fiber->timer_index = index;
 }
 
-void __koral_mutex_destroy(void* mutex) {
-    if (!mutex) return;
-    pthread_mutex_destroy((pthread_mutex_t*)mutex);
-    free(mutex);
+static void __koral_green_heap_sift_up(size_t index) {
+    KoralFiber* fiber = __koral_green.timers[index];
+    while (index > 0) {
+        size_t parent = (index - 1) / 2;
+        if (__koral_green.timers[parent]->deadline_ns <= fiber->deadline_ns) break;
+        __koral_green_heap_place(index, __koral_green.timers[parent]);
+        index = parent;
+    }
+    __koral_green_heap_place(index, fiber);
 }
 
-void __koral_mutex_lock(void* mutex) {
-    pthread_mutex_lock((pthread_mutex_t*)mutex);
+static void __koral_green_heap_sift_down(size_t index) {
+    KoralFiber* fiber = __koral_green.timers[index];
+    size_t count = __koral_green.timer_count;
+    for (;;) {
+        size_t child = index * 2 + 1;
+        if (child >= count) break;
+        if (child + 1 < count
+            && __koral_green.timers[child + 1]->deadline_ns < __koral_green.timers[child]->deadline_ns) {
+            child++;
+        }
+        if (fiber->deadline_ns <= __koral_green.timers[child]->deadline_ns) break;
+        __koral_green_heap_place(index, __koral_green.timers[child]);
+        index = child;
+    }
+    __koral_green_heap_place(index, fiber);
 }
 
-int32_t __koral_mutex_try_lock(void* mutex) {
-    return pthread_mutex_trylock((pthread_mutex_t*)mutex) == 0 ? 1 : 0;
+// Caller holds the scheduler lock.
+static void __koral_green_heap_remove(KoralFiber* fiber) {
+    size_t index = fiber->timer_index;
+    fiber->timer_index = KORAL_GREEN_NO_TIMER;
+    KoralFiber* last = __koral_green.timers[--__koral_green.timer_count];
+    if (last == fiber) return;
+    __koral_green_heap_place(index, last);
+    __koral_green_heap_sift_up(index);
+    __koral_green_heap_sift_down(last->timer_index);
 }
 
-void __koral_mutex_unlock(void* mutex) {
-    pthread_mutex_unlock((pthread_mutex_t*)mutex);
+static void __koral_green_kick_reactor(void) {
+    uint64_t one = 1;
+    ssize_t written = write(__koral_green.wake_fd, &one, sizeof(one));
+    (void)written;
 }
 
-#endif
+static void __koral_green_timer_add(KoralFiber* fiber, int64_t deadline_ns) {
+    __koral_pool_lock(&__koral_green.lock);
+    if (__koral_green.timer_count == __koral_green.timer_capacity) {
+        size_t capacity = __koral_green.timer_capacity ? __koral_green.timer_capacity * 2 : 64;
+        KoralFiber** timers = (KoralFiber**)realloc(__koral_green.timers, capacity * sizeof(KoralFiber*));
+        if (!timers) __koral_pool_oom();
+        __koral_green.timers = timers;
+        __koral_green.timer_capacity = capacity;
+    }
+    fiber->deadline_ns = deadline_ns;
+    __koral_green_heap_place(__koral_green.timer_count++, fiber);
+    __koral_green_heap_sift_up(fiber->timer_index);
+    int is_head = fiber->timer_index == 0;
+    __koral_pool_unlock(&__koral_green.lock);
+    if (is_head) {
+        __koral_green_kick_reactor();
+    }
+}
 
+static void __koral_green_timer_cancel(KoralFiber* fiber) {
+    __koral_pool_lock(&__koral_green.lock);
+    if (fiber->timer_index != KORAL_GREEN_NO_TIMER) {
+        __koral_green_heap_remove(fiber);
+    }
+    __koral_pool_unlock(&__koral_green.lock);
+}
 
-// ============================================================================
-// SharedMutex
-// ============================================================================
+// Parks the current fiber until it is woken or, with `deadline_ns >= 0`, the
+// monotonic clock reaches the deadline.
+static void __koral_green_park_until(int64_t deadline_ns) {
+    KoralFiber* fiber = (KoralFiber*)__koral_green_current();
+    if (deadline_ns >= 0) {
+        __koral_green_timer_add(fiber, deadline_ns);
+    }
+    int expected = KORAL_FIBER_RUNNING;
+    if (atomic_compare_exchange_strong_explicit(&fiber->state, &expected, KORAL_FIBER_PARKING,
+                                                memory_order_acq_rel, memory_order_acquire)) {
+        __koral_green_switch_out(fiber, KORAL_FIBER_SWITCH_PARK);
+    } else {
+        // Woken before parking: consume the notification.
+        atomic_store_explicit(&fiber->state, KORAL_FIBER_RUNNING, memory_order_release);
+    }
+    if (deadline_ns >= 0) {
+        __koral_green_timer_cancel(fiber);
+    }
+}
+
+// --- Reactor: file descriptors ---
+
+// Caller holds the scheduler lock.
+static KoralGreenFdSlot* __koral_green_fd_slot(int fd) {
+    if ((size_t)fd >= __koral_green.fd_capacity) {
+        size_t capacity = __koral_green.fd_capacity ? __koral_green.fd_capacity : 256;
+        while (capacity <= (size_t)fd) capacity *= 2;
+        KoralGreenFdSlot* fds = (KoralGreenFdSlot*)realloc(__koral_green.fds, capacity * sizeof(KoralGreenFdSlot));
+        if (!fds) __koral_pool_oom();
+        memset(fds + __koral_green.fd_capacity, 0,
+               (capacity - __koral_green.fd_capacity) * sizeof(KoralGreenFdSlot));
+        __koral_green.fds = fds;
+        __koral_green.fd_capacity = capacity;
+    }
+    return &__koral_green.fds[fd];
+}
+
+// Re-arms the one-shot registration of `fd` for its current waiters. Caller
+// holds the scheduler lock. Returns 0 on success.
+static int __koral_green_fd_arm(int fd, KoralGreenFdSlot* slot) {
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLONESHOT | EPOLLRDHUP;
+    if (slot->reader) event.events |= EPOLLIN;
+    if (slot->writer) event.events |= EPOLLOUT;
+    event.data.u64 = (uint64_t)fd;
+    int op = slot->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl(__koral_green.epoll_fd, op, fd, &event) != 0) {
+        // The fd number may have been closed and reused behind our back.
+        op = (errno == ENOENT) ? EPOLL_CTL_ADD : (errno == EEXIST) ? EPOLL_CTL_MOD : -1;
+        if (op < 0 || epoll_ctl(__koral_green.epoll_fd, op, fd, &event) != 0) {
+            return -1;
+        }
+    }
+    slot->registered = 1;
+    return 0;
+}
 
-#if defined(_WIN32) || defined(_WIN64)
+// Parks the current fiber until `fd` is readable (or writable). Returns -1 if
+// `deadline_ns` passed first, 0 otherwise (including spurious wakeups).
+static int __koral_green_wait_fd(int fd, int for_write, int64_t deadline_ns) {
+    KoralFiber* fiber = (KoralFiber*)__koral_green_current();
+    __koral_pool_lock(&__koral_green.lock);
+    KoralGreenFdSlot* slot = __koral_green_fd_slot(fd);
+    if (for_write) {
+        slot->writer = fiber;
+    } else {
+        slot->reader = fiber;
+    }
+    int armed = __koral_green_fd_arm(fd, slot) == 0;
+    if (!armed) {
+        if (for_write) slot->writer = NULL; else slot->reader = NULL;
+    }
+    __koral_pool_unlock(&__koral_green.lock);
+
+    if (armed) {
+        __koral_green_park_until(deadline_ns);
+        __koral_pool_lock(&__koral_green.lock);
+        slot = &__koral_green.fds[fd];
+        if (slot->reader == fiber) slot->reader = NULL;
+        if (slot->writer == fiber) slot->writer = NULL;
+        __koral_pool_unlock(&__koral_green.lock);
+    } else {
+        // Not pollable through epoll: fall back to blocking the carrier.
+        struct pollfd entry = { fd, (short)(for_write ? POLLOUT : POLLIN), 0 };
+        int64_t remaining = deadline_ns < 0 ? -1 : (deadline_ns - __koral_green_now_ns() + 999999) / 1000000;
+        poll(&entry, 1, deadline_ns < 0 ? -1 : (remaining > 0 ? (int)remaining : 0));
+    }
+    return (deadline_ns >= 0 && __koral_green_now_ns() >= deadline_ns) ? -1 : 0;
+}
+
+static void* __koral_green_reactor_main(void* arg) {
+    (void)arg;
+    struct epoll_event events[KORAL_GREEN_EPOLL_BATCH];
+    for (;;) {
+        int timeout_ms = -1;
+        __koral_pool_lock(&__koral_green.lock);
+        if (__koral_green.timer_count > 0) {
+            int64_t delta = __koral_green.timers[0]->deadline_ns - __koral_green_now_ns();
+            int64_t ms = delta <= 0 ? 0 : (delta + 999999) / 1000000;
+            timeout_ms = ms > INT32_MAX ? INT32_MAX : (int)ms;
+        }
+        __koral_pool_unlock(&__koral_green.lock);
+
+        int count = epoll_wait(__koral_green.epoll_fd, events, KORAL_GREEN_EPOLL_BATCH, timeout_ms);
+        __koral_pool_lock(&__koral_green.lock);
+        for (int i = 0; i < count; i++) {
+            if (events[i].data.u64 == KORAL_GREEN_WAKE_TOKEN) {
+                uint64_t drained;
+                ssize_t got = read(__koral_green.wake_fd, &drained, sizeof(drained));
+                (void)got;
+                continue;
+            }
+            int fd = (int)events[i].data.u64;
+            if ((size_t)fd >= __koral_green.fd_capacity) continue;
+            KoralGreenFdSlot* slot = &__koral_green.fds[fd];
+            uint32_t ready = events[i].events;
+            uint32_t failed = EPOLLERR | EPOLLHUP;
+            if (slot->reader && (ready & (EPOLLIN | EPOLLRDHUP | failed))) {
+                __koral_green_wake(slot->reader);
+                slot->reader = NULL;
+            }
+            if (slot->writer && (ready & (EPOLLOUT | failed))) {
+                __koral_green_wake(slot->writer);
+                slot->writer = NULL;
+            }
+            // One-shot disarmed the whole fd; re-arm for whoever still waits.
+            if ((slot->reader || slot->writer) && __koral_green_fd_arm(fd, slot) != 0) {
+                if (slot->reader) __koral_green_wake(slot->reader);
+                if (slot->writer) __koral_green_wake(slot->writer);
+                slot->reader = slot->writer = NULL;
+            }
+        }
+        int64_t now = __koral_green_now_ns();
+        while (__koral_green.timer_count > 0 && __koral_green.timers[0]->deadline_ns <= now) {
+            KoralFiber* fiber = __koral_green.timers[0];
+            __koral_green_heap_remove(fiber);
+            __koral_green_wake(fiber);
+        }
+        __koral_pool_unlock(&__koral_green.lock);
+    }
+    return NULL;
+}
 
-void* __koral_shared_mutex_create(void) {
-    SRWLOCK* lock = (SRWLOCK*)malloc(sizeof(SRWLOCK));
-    if (!lock) return NULL;
-    InitializeSRWLock(lock);
-    return (void*)lock;
+static void __koral_green_init(void) {
+    __koral_green.page_size = (size_t)sysconf(_SC_PAGESIZE);
+    __koral_pool_lock_init(&__koral_green.lock);
+    __koral_pool_lock_init(&__koral_green.stack_lock);
+    __koral_green.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    __koral_green.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (__koral_green.epoll_fd < 0 || __koral_green.wake_fd < 0) {
+        fprintf(stderr, "Panic: failed to create green thread reactor\n");
+        abort();
+    }
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.u64 = KORAL_GREEN_WAKE_TOKEN;
+    epoll_ctl(__koral_green.epoll_fd, EPOLL_CTL_ADD, __koral_green.wake_fd, &event);
+    __koral_green.pool = (KoralPool*)__koral_pool_create(0);
+    pthread_t reactor;
+    if (pthread_create(&reactor, NULL, __koral_green_reactor_main, NULL) != 0) {
+        fprintf(stderr, "Panic: failed to start green thread reactor\n");
+        abort();
+    }
+    pthread_detach(reactor);
+    atomic_store_explicit(&__koral_green_ready, 1, memory_order_release);
+}
+
+// --- Hooks used by blocking socket calls ---
+
+// On a green thread, switches `fd` to non-blocking mode (once) so that EAGAIN
+// can park the fiber instead of the carrier.
+static void __koral_green_prepare_fd(int fd) {
+    if (fd < 0 || !__koral_green_current()) return;
+    __koral_pool_lock(&__koral_green.lock);
+    KoralGreenFdSlot* slot = __koral_green_fd_slot(fd);
+    if (!slot->nonblocking) {
+        int flags = fcntl(fd, F_GETFL, 0);
+        if (flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0) {
+            slot->nonblocking = 1;
+        }
+    }
+    __koral_pool_unlock(&__koral_green.lock);
 }
 
-void __koral_shared_mutex_destroy(void* shared_mutex) {
-    if (!shared_mutex) return;
-    // SRWLOCK needs no destroy
-    free(shared_mutex);
+static int __koral_green_fd_is_nonblocking(int fd) {
+    if (fd < 0 || !atomic_load_explicit(&__koral_green_ready, memory_order_acquire)) return 0;
+    __koral_pool_lock(&__koral_green.lock);
+    int nonblocking = (size_t)fd < __koral_green.fd_capacity && __koral_green.fds[fd].nonblocking;
+    __koral_pool_unlock(&__koral_green.lock);
+    return nonblocking;
 }
 
-void __koral_shared_mutex_read_lock(void* shared_mutex) {
-    AcquireSRWLockShared((SRWLOCK*)shared_mutex);
+// Called after a socket call on `fd` failed. If it failed with EAGAIN only
+// because the green runtime made `fd` non-blocking, waits for readiness --
+// parking the fiber, or polling on an OS thread -- within the socket's
+// SO_RCVTIMEO/SO_SNDTIMEO, which the caller tracks in `*deadline_ns`
+// (initially KORAL_GREEN_DEADLINE_UNSET). Returns 1 to retry the call, 0 to
+// report the failure (errno is EAGAIN after a timeout).
+static int __koral_green_retry_fd(int fd, int for_write, int64_t* deadline_ns) {
+    if ((errno != EAGAIN && errno != EWOULDBLOCK) || !__koral_green_fd_is_nonblocking(fd)) {
+        return 0;
+    }
+    if (*deadline_ns == KORAL_GREEN_DEADLINE_UNSET) {
+        struct timeval tv = { 0, 0 };
+        socklen_t len = (socklen_t)sizeof(tv);
+        getsockopt(fd, SOL_SOCKET, for_write ? SO_SNDTIMEO : SO_RCVTIMEO, &tv, &len);
+        *deadline_ns = (tv.tv_sec == 0 && tv.tv_usec == 0)
+            ? -1
+            : __koral_green_now_ns() + (int64_t)tv.tv_sec * 1000000000LL + (int64_t)tv.tv_usec * 1000LL;
+    }
+    if (*deadline_ns >= 0 && __koral_green_now_ns() >= *deadline_ns) {
+        errno = EAGAIN;
+        return 0;
+    }
+    if (__koral_green_current()) {
+        if (__koral_green_wait_fd(fd, for_write, *deadline_ns) < 0) {
+            errno = EAGAIN;
+            return 0;
+        }
+        return 1;
+    }
+    struct pollfd entry = { fd, (short)(for_write ? POLLOUT : POLLIN), 0 };
+    int timeout_ms = -1;
+    if (*deadline_ns >= 0) {
+        int64_t ms = (*deadline_ns - __koral_green_now_ns() + 999999) / 1000000;
+        timeout_ms = ms <= 0 ? 0 : (ms > INT32_MAX ? INT32_MAX : (int)ms);
+    }
+    if (poll(&entry, 1, timeout_ms) == 0) {
+        errno = EAGAIN;
+        return 0;
+    }
+    return 1;
 }
 
-void __koral_shared_mutex_read_unlock(void* shared_mutex) {
-    ReleaseSRWLockShared((SRWLOCK*)shared_mutex);
+// Completes a connect() that returned EINPROGRESS on a socket the green
+// runtime made non-blocking. Returns 0 on success, -1 with errno set.
+static int __koral_green_finish_connect(int fd) {
+    if (errno != EINPROGRESS || !__koral_green_fd_is_nonblocking(fd)) {
+        return -1;
+    }
+    int64_t deadline_ns = KORAL_GREEN_DEADLINE_UNSET;
+    for (;;) {
+        struct pollfd entry = { fd, POLLOUT, 0 };
+        if (poll(&entry, 1, 0) > 0) break;
+        errno = EAGAIN;
+        if (!__koral_green_retry_fd(fd, 1, &deadline_ns)) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+    }
+    int error = 0;
+    socklen_t len = (socklen_t)sizeof(error);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) != 0) return -1;
+    if (error != 0) {
+        errno = error;
+        return -1;
+    }
+    return 0;
 }
 
-void __koral_shared_mutex_write_lock(void* shared_mutex) {
-    AcquireSRWLockExclusive((SRWLOCK*)shared_mutex);
+// Called before `fd` is closed: wakes any fiber still waiting on it and
+// forgets its state, since the fd number may be reused.
+static void __koral_green_forget_fd(int fd) {
+    if (fd < 0 || !atomic_load_explicit(&__koral_green_ready, memory_order_acquire)) return;
+    __koral_pool_lock(&__koral_green.lock);
+    if ((size_t)fd < __koral_green.fd_capacity) {
+        KoralGreenFdSlot* slot = &__koral_green.fds[fd];
+        if (slot->reader) __koral_green_wake(slot->reader);
+        if (slot->writer) __koral_green_wake(slot->writer);
+        memset(slot, 0, sizeof(*slot));
+    }
+    __koral_pool_unlock(&__koral_green.lock);
+}
+
+// --- Entry points used by std/async/green.koral ---
+
+// Takes ownership of `job`, a malloc'ed cell holding a struct __koral_Closure,
+// and starts it on a new green thread. Returns a handle for the join/release
+// functions below.
+void* __koral_green_spawn(void* job) {
+    pthread_once(&__koral_green_once, __koral_green_init);
+    KoralFiber* fiber = (KoralFiber*)calloc(1, sizeof(KoralFiber));
+    if (!fiber) __koral_pool_oom();
+    fiber->closure = *(struct __koral_Closure*)job;
+    free(job);
+    fiber->stack = __koral_green_stack_alloc();
+    fiber->timer_index = KORAL_GREEN_NO_TIMER;
+    atomic_init(&fiber->state, KORAL_FIBER_RUNNING);
+    atomic_init(&fiber->refs, 2);
+    __koral_pool_lock_init(&fiber->join_lock);
+    __koral_pool_cond_init(&fiber->join_cond);
+    getcontext(&fiber->context);
+    fiber->context.uc_stack.ss_sp = fiber->stack + __koral_green.page_size;
+    fiber->context.uc_stack.ss_size = KORAL_GREEN_STACK_SIZE;
+    fiber->context.uc_link = NULL;
+    makecontext(&fiber->context, __koral_green_entry, 0);
+    __koral_green_schedule(fiber);
+    return fiber;
+}
+
+// Blocks until the green thread has finished; parks when called from
+// another green thread.
+void __koral_green_join(void* raw_fiber) {
+    KoralFiber* fiber = (KoralFiber*)raw_fiber;
+    __koral_pool_lock(&fiber->join_lock);
+    while (!fiber->finished) {
+        void* self = __koral_green_current();
+        if (self) {
+            KoralGreenWaiter waiter = { .fiber = self };
+            __koral_green_waitlist_push(&fiber->joiners, &waiter);
+            __koral_pool_unlock(&fiber->join_lock);
+            __koral_green_park_until(-1);
+            __koral_pool_lock(&fiber->join_lock);
+            __koral_green_waitlist_remove(&fiber->joiners, &waiter);
+        } else {
+            __koral_pool_cond_wait(&fiber->join_cond, &fiber->join_lock);
+        }
+    }
+    __koral_pool_unlock(&fiber->join_lock);
 }
 
-void __koral_shared_mutex_write_unlock(void* shared_mutex) {
-    ReleaseSRWLockExclusive((SRWLOCK*)shared_mutex);
+int32_t __koral_green_is_finished(void* raw_fiber) {
+    KoralFiber* fiber = (KoralFiber*)raw_fiber;
+    __koral_pool_lock(&fiber->join_lock);
+    int32_t finished = fiber->finished;
+    __koral_pool_unlock(&fiber->join_lock);
+    return finished;
 }
 
-int32_t __koral_shared_mutex_try_read_lock(void* shared_mutex) {
-    return TryAcquireSRWLockShared((SRWLOCK*)shared_mutex) ? 1 : 0;
+// Drops the std handle; the fiber itself keeps running if it has not finished.
+void __koral_green_release(void* raw_fiber) {
+    __koral_green_release_fiber((KoralFiber*)raw_fiber);
 }
 
-int32_t __koral_shared_mutex_try_write_lock(void* shared_mutex) {
-    return TryAcquireSRWLockExclusive((SRWLOCK*)shared_mutex) ? 1 : 0;
+int32_t __koral_green_in_fiber(void) {
+    return __koral_green_current() != NULL;
 }
 
 #else
 
-void* __koral_shared_mutex_create(void) {
-    pthread_rwlock_t* rw = (pthread_rwlock_t*)malloc(sizeof(pthread_rwlock_t));
-    if (!rw) return NULL;
-    pthread_rwlockattr_t attr;
-    pthread_rwlockattr_init(&attr);
-#ifdef PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP
-    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+// Without epoll/ucontext each green thread is an OS thread, and none of the
+// blocking calls above ever see a fiber.
+
+typedef struct {
+    struct __koral_Closure closure;
+    KoralPoolLock lock;
+    KoralPoolCond cond;
+    KoralPoolThread thread;
+    int finished;
+    _Atomic int refs;
+} KoralGreenThread;
+
+static void* __koral_green_current(void) { return NULL; }
+static void __koral_green_park_until(int64_t deadline_ns) { (void)deadline_ns; }
+static void __koral_green_wake(void* fiber) { (void)fiber; }
+static void __koral_green_yield(void) {}
+static void __koral_green_resume(void* fiber) { (void)fiber; }
+static int64_t __koral_green_now_ns(void) { return 0; }
+
+#if !defined(_WIN32) && !defined(_WIN64)
+static void __koral_green_prepare_fd(int fd) { (void)fd; }
+static int __koral_green_retry_fd(int fd, int for_write, int64_t* deadline_ns) {
+    (void)fd; (void)for_write; (void)deadline_ns;
+    return 0;
+}
+static int __koral_green_finish_connect(int fd) { (void)fd; return -1; }
+static void __koral_green_forget_fd(int fd) { (void)fd; }
+#define KORAL_GREEN_DEADLINE_UNSET INT64_MIN
 #endif
-    if (pthread_rwlock_init(rw, &attr) != 0) {
-        pthread_rwlockattr_destroy(&attr);
-        free(rw);
-        return NULL;
+
+static void __koral_green_thread_release(KoralGreenThread* thread) {
+    if (atomic_fetch_sub_explicit(&thread->refs, 1, memory_order_acq_rel) == 1) {
+        __koral_pool_lock_destroy(&thread->lock);
+        __koral_pool_cond_destroy(&thread->cond);
+        free(thread);
     }
-    pthread_rwlockattr_destroy(&attr);
-    return (void*)rw;
 }
 
-void __koral_shared_mutex_destroy(void* shared_mutex) {
-    if (!shared_mutex) return;
-    pthread_rwlock_destroy((pthread_rwlock_t*)shared_mutex);
-    free(shared_mutex);
+static void __koral_green_thread_main(KoralGreenThread* thread) {
+    __koral_closure_invoke(&thread->closure);
+    __koral_closure_release(thread->closure);
+    __koral_pool_lock(&thread->lock);
+    thread->finished = 1;
+    __koral_pool_cond_broadcast(&thread->cond);
+    __koral_pool_unlock(&thread->lock);
+    __koral_green_thread_release(thread);
+    __koral_rc_thread_exit();
+    __koral_box_thread_exit();
+}
+
+#if defined(_WIN32) || defined(_WIN64)
+static DWORD WINAPI __koral_green_thread_trampoline(LPVOID arg) {
+    __koral_green_thread_main((KoralGreenThread*)arg);
+    return 0;
+}
+#else
+static void* __koral_green_thread_trampoline(void* arg) {
+    __koral_green_thread_main((KoralGreenThread*)arg);
+    return NULL;
 }
+#endif
 
-void __koral_shared_mutex_read_lock(void* shared_mutex) {
-    pthread_rwlock_rdlock((pthread_rwlock_t*)shared_mutex);
+void* __koral_green_spawn(void* job) {
+    KoralGreenThread* thread = (KoralGreenThread*)calloc(1, sizeof(KoralGreenThread));
+    if (!thread) __koral_pool_oom();
+    thread->closure = *(struct __koral_Closure*)job;
+    free(job);
+    __koral_pool_lock_init(&thread->lock);
+    __koral_pool_cond_init(&thread->cond);
+    atomic_init(&thread->refs, 2);
+#if defined(_WIN32) || defined(_WIN64)
+    thread->thread = CreateThread(NULL, 0, __koral_green_thread_trampoline, thread, 0, NULL);
+    int started = thread->thread != NULL;
+#else
+    int started = pthread_create(&thread->thread, NULL, __koral_green_thread_trampoline, thread) == 0;
+#endif
+    if (!started) {
+        fprintf(stderr, "Panic: failed to start green thread\n");
+        abort();
+    }
+    __koral_pool_thread_detach(thread->thread);
+    return thread;
 }
 
-void __koral_shared_mutex_read_unlock(void* shared_mutex) {
-    pthread_rwlock_unlock((pthread_rwlock_t*)shared_mutex);
+void __koral_green_join(void* raw_thread) {
+    KoralGreenThread* thread = (KoralGreenThread*)raw_thread;
+    __koral_pool_lock(&thread->lock);
+    while (!thread->finished) {
+        __koral_pool_cond_wait(&thread->cond, &thread->lock);
+    }
+    __koral_pool_unlock(&thread->lock);
 }
 
-void __koral_shared_mutex_write_lock(void* shared_mutex) {
-    pthread_rwlock_wrlock((pthread_rwlock_t*)shared_mutex);
+int32_t __koral_green_is_finished(void* raw_thread) {
+    KoralGreenThread* thread = (KoralGreenThread*)raw_thread;
+    __koral_pool_lock(&thread->lock);
+    int32_t finished = thread->finished;
+    __koral_pool_unlock(&thread->lock);
+    return finished;
 }
 
-void __koral_shared_mutex_write_unlock(void* shared_mutex) {
-    pthread_rwlock_unlock((pthread_rwlock_t*)shared_mutex);
+void __koral_green_release(void* raw_thread) {
+    __koral_green_thread_release((KoralGreenThread*)raw_thread);
 }
 
-int32_t __koral_shared_mutex_try_read_lock(void* shared_mutex) {
-    return pthread_rwlock_tryrdlock((pthread_rwlock_t*)shared_mutex) == 0 ? 1 : 0;
+int32_t __koral_green_in_fiber(void) {
+    return 0;
 }
 
-int32_t __koral_shared_mutex_try_write_lock(void* shared_mutex) {
-    return pthread_rwlock_trywrlock((pthread_rwlock_t*)shared_mutex) == 0 ? 1 : 0;
+#endif
+
+// ============================================================================
+// Wait words (std.sync)
+// ============================================================================
+// Futex-style wait/wake on a 32-bit word. A waiter sleeps only while the word
+// still holds the value it last saw, so a waker must change the word before
+// calling __koral_futex_wake. Wakes may be spurious; callers loop.
+//
+// Green threads queue in a bucket hashed from the word's address and park
+// their fiber. OS threads use the futex syscall on Linux and the bucket's
+// condvar elsewhere. Wake skips the bucket lock while no one is queued there.
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define KORAL_FUTEX_BUCKETS 256
+
+int32_t __koral_atomic_load_i32(int32_t* ptr);
+
+typedef struct {
+    KoralPoolLock lock;
+    KoralPoolCond cond;             // OS-thread waiters without a futex syscall
+    KoralGreenWaitList waiters;     // parked fibers, keyed by their word
+    _Atomic int32_t count;          // queued waiters, read by wake without the lock
+} KoralFutexBucket;
+
+static _Atomic(KoralFutexBucket*) __koral_futex_table = NULL;
+
+static KoralFutexBucket* __koral_futex_bucket(const int32_t* word) {
+    KoralFutexBucket* table = atomic_load_explicit(&__koral_futex_table, memory_order_acquire);
+    if (!table) {
+        KoralFutexBucket* created = (KoralFutexBucket*)calloc(KORAL_FUTEX_BUCKETS, sizeof(KoralFutexBucket));
+        if (!created) __koral_pool_oom();
+        for (size_t i = 0; i < KORAL_FUTEX_BUCKETS; i++) {
+            __koral_pool_lock_init(&created[i].lock);
+            __koral_pool_cond_init(&created[i].cond);
+        }
+        KoralFutexBucket* expected = NULL;
+        if (atomic_compare_exchange_strong_explicit(&__koral_futex_table, &expected, created,
+                                                    memory_order_acq_rel, memory_order_acquire)) {
+            table = created;
+        } else {
+            for (size_t i = 0; i < KORAL_FUTEX_BUCKETS; i++) {
+                __koral_pool_cond_destroy(&created[i].cond);
+                __koral_pool_lock_destroy(&created[i].lock);
+            }
+            free(created);
+            table = expected;
+        }
+    }
+    uintptr_t hash = (uintptr_t)word >> 2;
+    hash ^= hash >> 9;
+    return &table[hash % KORAL_FUTEX_BUCKETS];
+}
+
+// Queues the caller in the word's bucket and sleeps if `*word == expected`,
+// for at most `timeout_ns` when it is not negative.
+// The count is raised before the word is read again, pairing with the
+// word update a waker makes before reading the count.
+static void __koral_futex_wait_queued(int32_t* word, int32_t expected, void* fiber, int64_t timeout_ns) {
+    KoralFutexBucket* bucket = __koral_futex_bucket(word);
+    __koral_pool_lock(&bucket->lock);
+    atomic_fetch_add_explicit(&bucket->count, 1, memory_order_seq_cst);
+    if (__koral_atomic_load_i32(word) == expected) {
+        if (fiber) {
+            KoralGreenWaiter waiter = { .fiber = fiber, .key = word };
+            __koral_green_waitlist_push(&bucket->waiters, &waiter);
+            __koral_pool_unlock(&bucket->lock);
+            __koral_green_park_until(timeout_ns < 0 ? -1 : __koral_green_now_ns() + timeout_ns);
+            __koral_pool_lock(&bucket->lock);
+            __koral_green_waitlist_remove(&bucket->waiters, &waiter);
+        } else if (timeout_ns >= 0) {
+            int64_t ms = (timeout_ns + 999999) / 1000000;
+#if KORAL_RC_BIASED
+            if (ms > KORAL_RC_WAIT_SLICE_MS) ms = KORAL_RC_WAIT_SLICE_MS;
+#endif
+            __koral_pool_cond_wait_ms(&bucket->cond, &bucket->lock, (uint32_t)(ms > 0 ? ms : 1));
+        } else {
+#if KORAL_RC_BIASED
+            __koral_pool_cond_wait_ms(&bucket->cond, &bucket->lock, KORAL_RC_WAIT_SLICE_MS);
+#else
+            __koral_pool_cond_wait(&bucket->cond, &bucket->lock);
+#endif
+        }
+    }
+    atomic_fetch_sub_explicit(&bucket->count, 1, memory_order_seq_cst);
+    __koral_pool_unlock(&bucket->lock);
+#if KORAL_RC_BIASED
+    if (!fiber) __koral_rc_poll();
+#endif
 }
 
+void __koral_futex_wait(int32_t* word, int32_t expected) {
+    void* fiber = __koral_green_current();
+#if defined(__linux__)
+    if (!fiber) {
+#if KORAL_RC_BIASED
+        // Sleep in slices so queued releases are drained while blocked.
+        struct timespec slice = { 0, KORAL_RC_WAIT_SLICE_MS * 1000000L };
+        syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, expected, &slice, NULL, 0);
+        __koral_rc_poll();
+#else
+        syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
 #endif
+        return;
+    }
+#endif
+    __koral_futex_wait_queued(word, expected, fiber, -1);
+}
 
+// Like __koral_futex_wait, but gives up after `timeout_ns` nanoseconds.
+// Callers check their own deadline; an early return is just a spurious wake.
+void __koral_futex_wait_for(int32_t* word, int32_t expected, int64_t timeout_ns) {
+    if (timeout_ns <= 0) return;
+    void* fiber = __koral_green_current();
+#if defined(__linux__)
+    if (!fiber) {
+#if KORAL_RC_BIASED
+        if (timeout_ns > KORAL_RC_WAIT_SLICE_MS * 1000000LL) timeout_ns = KORAL_RC_WAIT_SLICE_MS * 1000000LL;
+#endif
+        struct timespec limit = { (time_t)(timeout_ns / 1000000000LL), (long)(timeout_ns % 1000000000LL) };
+        syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, expected, &limit, NULL, 0);
+#if KORAL_RC_BIASED
+        __koral_rc_poll();
+#endif
+        return;
+    }
+#endif
+    __koral_futex_wait_queued(word, expected, fiber, timeout_ns);
+}
+
+// Wakes up to `count` fibers and up to `count` OS threads waiting on `word`.
+void __koral_futex_wake(int32_t* word, int32_t count) {
+    KoralFutexBucket* bucket = __koral_futex_bucket(word);
+    if (atomic_load_explicit(&bucket->count, memory_order_seq_cst) > 0) {
+        __koral_pool_lock(&bucket->lock);
+        int32_t woken = 0;
+        KoralGreenWaiter* waiter = bucket->waiters.head;
+        while (waiter && woken < count) {
+            KoralGreenWaiter* next = waiter->next;
+            if (waiter->key == word) {
+                __koral_green_waitlist_remove(&bucket->waiters, waiter);
+                __koral_green_wake(waiter->fiber);
+                woken++;
+            }
+            waiter = next;
+        }
+#if !defined(__linux__)
+        // Words sharing the bucket share the condvar.
+        __koral_pool_cond_broadcast(&bucket->cond);
+#endif
+        __koral_pool_unlock(&bucket->lock);
+    }
+#if defined(__linux__)
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+#endif
+}
 
 // ============================================================================
-// Condvar
+// Lock words (std.sync)
 // ============================================================================
+// Mutex, condvar and shared-mutex state held in one caller-owned 32-bit word,
+// so the lock can live inline in the struct it protects. Uncontended
+// lock/unlock is a single atomic operation; contended callers spin briefly,
+// then sleep on the word with __koral_futex_wait (parking green threads).
 
-#if defined(_WIN32) || defined(_WIN64)
+#define KORAL_LOCK_SPIN 100
+
+int32_t __koral_atomic_swap_i32(int32_t* ptr, int32_t value);
+int32_t __koral_atomic_cas_i32(int32_t* ptr, int32_t expected, int32_t desired);
+int32_t __koral_atomic_fetch_add_i32(int32_t* ptr, int32_t delta);
+
+// --- Mutex word: 0 unlocked, 1 locked, 2 locked with possible sleepers ---
 
-void* __koral_condvar_create(void) {
-    KoralCondvar* cv = (KoralCondvar*)malloc(sizeof(KoralCondvar));
-    if (!cv) return NULL;
-    InitializeConditionVariable(&cv->cv);
-    return (void*)cv;
+static void __koral_lock_word_lock_contended(int32_t* word) {
+    for (int spin = 0; spin < KORAL_LOCK_SPIN; spin++) {
+        int32_t state = __koral_atomic_load_i32(word);
+        if (state == 0 && __koral_atomic_cas_i32(word, 0, 1)) return;
+        if (state == 2) break;
+        __koral_lock_spin_hint();
+    }
+    while (__koral_atomic_swap_i32(word, 2) != 0) {
+        __koral_futex_wait(word, 2);
+    }
 }
 
-void __koral_condvar_destroy(void* raw) {
-    if (!raw) return;
-    // CONDITION_VARIABLE needs no destroy
-    free(raw);
+void __koral_lock_word_lock(int32_t* word) {
+    if (!__koral_atomic_cas_i32(word, 0, 1)) {
+        __koral_lock_word_lock_contended(word);
+    }
+    KORAL_RC_LOCK_ACQUIRED();
 }
 
-void __koral_condvar_wait(void* raw, void* mutex) {
-    KoralCondvar* cv = (KoralCondvar*)raw;
-    SleepConditionVariableCS(&cv->cv, (CRITICAL_SECTION*)mutex, INFINITE);
+int32_t __koral_lock_word_try_lock(int32_t* word) {
+    if (__koral_atomic_cas_i32(word, 0, 1)) {
+        KORAL_RC_LOCK_ACQUIRED();
+        return 1;
+    }
+    return 0;
 }
 
-void __koral_condvar_signal(void* raw) {
-    KoralCondvar* cv = (KoralCondvar*)raw;
-    WakeConditionVariable(&cv->cv);
+void __koral_lock_word_unlock(int32_t* word) {
+    KORAL_RC_LOCK_RELEASED();
+    if (__koral_atomic_swap_i32(word, 0) == 2) {
+        __koral_futex_wake(word, 1);
+    }
 }
 
-void __koral_condvar_broadcast(void* raw) {
-    KoralCondvar* cv = (KoralCondvar*)raw;
-    WakeAllConditionVariable(&cv->cv);
+// --- Shared mutex word ---
+// Low bits count readers; WRITE marks an exclusive owner. A writer that has
+// to wait sets WRITER_WAITING, which keeps new readers out until some writer
+// gets in. Anyone about to sleep sets SLEEPERS; whoever clears it wakes all.
+
+#define KORAL_RW_READERS        0x1FFFFFFF
+#define KORAL_RW_WRITE          0x20000000
+#define KORAL_RW_WRITER_WAITING 0x40000000
+#define KORAL_RW_SLEEPERS       ((int32_t)0x80000000u)
+
+// Sets SLEEPERS (and `extra`) on `state` and sleeps if the word still holds it.
+static void __koral_rw_word_sleep(int32_t* word, int32_t state, int32_t extra) {
+    int32_t want = state | KORAL_RW_SLEEPERS | extra;
+    if (want == state || __koral_atomic_cas_i32(word, state, want)) {
+        __koral_futex_wait(word, want);
+    }
 }
 
-void __koral_condvar_wait_shared_mutex(void* raw, void* shared_mutex) {
-    KoralCondvar* cv = (KoralCondvar*)raw;
-    // Last parameter 0 = exclusive mode (CONDITION_VARIABLE_LOCKMODE_SHARED not set)
-    SleepConditionVariableSRW(&cv->cv, (SRWLOCK*)shared_mutex, INFINITE, 0);
+static void __koral_rw_word_wake_sleepers(int32_t* word, int32_t state) {
+    while ((state & KORAL_RW_SLEEPERS) && (state & (KORAL_RW_READERS | KORAL_RW_WRITE)) == 0) {
+        if (__koral_atomic_cas_i32(word, state, state & ~KORAL_RW_SLEEPERS)) {
+            __koral_futex_wake(word, INT32_MAX);
+            return;
+        }
+        state = __koral_atomic_load_i32(word);
+    }
 }
 
-#else
+static int __koral_rw_word_try_read(int32_t* word, int32_t state) {
+    return (state & (KORAL_RW_WRITE | KORAL_RW_WRITER_WAITING)) == 0
+        && (state & KORAL_RW_READERS) != KORAL_RW_READERS
+        && __koral_atomic_cas_i32(word, state, state + 1);
+}
 
-void* __koral_condvar_create(void) {
-    KoralCondvar* cv = (KoralCondvar*)malloc(sizeof(KoralCondvar));
-    if (!cv) return NULL;
-    if (pthread_cond_init(&cv->cond, NULL) != 0) {
-        free(cv);
-        return NULL;
+static int __koral_rw_word_try_write(int32_t* word, int32_t state) {
+    return (state & (KORAL_RW_READERS | KORAL_RW_WRITE)) == 0
+        && __koral_atomic_cas_i32(word, state, (state | KORAL_RW_WRITE) & ~KORAL_RW_WRITER_WAITING);
+}
+
+void __koral_rw_word_read_lock(int32_t* word) {
+    int spin = 0;
+    for (;;) {
+        int32_t state = __koral_atomic_load_i32(word);
+        if (__koral_rw_word_try_read(word, state)) break;
+        if ((state & (KORAL_RW_WRITE | KORAL_RW_WRITER_WAITING)) == 0) continue;
+        if (spin < KORAL_LOCK_SPIN) {
+            spin++;
+            __koral_lock_spin_hint();
+            continue;
+        }
+        __koral_rw_word_sleep(word, state, 0);
     }
-    if (pthread_mutex_init(&cv->internal_mutex, NULL) != 0) {
-        pthread_cond_destroy(&cv->cond);
-        free(cv);
-        return NULL;
+    KORAL_RC_LOCK_ACQUIRED();
+}
+
+int32_t __koral_rw_word_try_read_lock(int32_t* word) {
+    for (;;) {
+        int32_t state = __koral_atomic_load_i32(word);
+        if (__koral_rw_word_try_read(word, state)) {
+            KORAL_RC_LOCK_ACQUIRED();
+            return 1;
+        }
+        if ((state & (KORAL_RW_WRITE | KORAL_RW_WRITER_WAITING)) != 0) return 0;
     }
-    cv->generation = 0;
-    return (void*)cv;
 }
 
-void __koral_condvar_destroy(void* raw) {
-    if (!raw) return;
-    KoralCondvar* cv = (KoralCondvar*)raw;
-    pthread_cond_destroy(&cv->cond);
-    pthread_mutex_destroy(&cv->internal_mutex);
-    free(cv);
+void __koral_rw_word_read_unlock(int32_t* word) {
+    KORAL_RC_LOCK_RELEASED();
+    int32_t state = __koral_atomic_fetch_add_i32(word, -1) - 1;
+    __koral_rw_word_wake_sleepers(word, state);
 }
 
-void __koral_condvar_wait(void* raw, void* mutex) {
-    KoralCondvar* cv = (KoralCondvar*)raw;
-    // Standard condvar wait with external mutex (pthread_mutex_t)
-    pthread_cond_wait(&cv->cond, (pthread_mutex_t*)mutex);
+void __koral_rw_word_write_lock(int32_t* word) {
+    int spin = 0;
+    for (;;) {
+        int32_t state = __koral_atomic_load_i32(word);
+        if (__koral_rw_word_try_write(word, state)) break;
+        if ((state & (KORAL_RW_READERS | KORAL_RW_WRITE)) == 0) continue;
+        if (spin < KORAL_LOCK_SPIN) {
+            spin++;
+            __koral_lock_spin_hint();
+            continue;
+        }
+        __koral_rw_word_sleep(word, state, KORAL_RW_WRITER_WAITING);
+    }
+    KORAL_RC_LOCK_ACQUIRED();
+}
+
+int32_t __koral_rw_word_try_write_lock(int32_t* word) {
+    int32_t state = __koral_atomic_load_i32(word);
+    while ((state & (KORAL_RW_READERS | KORAL_RW_WRITE)) == 0) {
+        if (__koral_rw_word_try_write(word, state)) {
+            KORAL_RC_LOCK_ACQUIRED();
+            return 1;
+        }
+        state = __koral_atomic_load_i32(word);
+    }
+    return 0;
 }
 
-void __koral_condvar_signal(void* raw) {
-    KoralCondvar* cv = (KoralCondvar*)raw;
-    pthread_mutex_lock(&cv->internal_mutex);
-    cv->generation++;
-    pthread_cond_signal(&cv->cond);
-    pthread_mutex_unlock(&cv->internal_mutex);
+void __koral_rw_word_write_unlock(int32_t* word) {
+    KORAL_RC_LOCK_RELEASED();
+    int32_t state = __koral_atomic_load_i32(word);
+    while (!__koral_atomic_cas_i32(word, state, state & ~KORAL_RW_WRITE)) {
+        state = __koral_atomic_load_i32(word);
+    }
+    __koral_rw_word_wake_sleepers(word, state & ~KORAL_RW_WRITE);
 }
 
-void __koral_condvar_broadcast(void* raw) {
-    KoralCondvar* cv = (KoralCondvar*)raw;
-    pthread_mutex_lock(&cv->internal_mutex);
-    cv->generation++;
-    pthread_cond_broadcast(&cv->cond);
-    pthread_mutex_unlock(&cv->internal_mutex);
+// --- Condvar word ---
+// `cond` is a sequence number bumped by every notify and `waiters` counts the
+// threads between prepare and wakeup, so notify without waiters never enters
+// the kernel. Waiters raise the count before reading the sequence, pairing
+// with the notifier bumping the sequence before reading the count.
+
+static int32_t __koral_cond_word_prepare(int32_t* cond, int32_t* waiters) {
+    __koral_atomic_fetch_add_i32(waiters, 1);
+    return __koral_atomic_load_i32(cond);
 }
 
-void __koral_condvar_wait_shared_mutex(void* raw, void* shared_mutex) {
-    KoralCondvar* cv = (KoralCondvar*)raw;
-    // POSIX: pthread_cond_wait only works with pthread_mutex_t, not pthread_rwlock_t.
-    // Use internal mutex + generation counter to avoid lost wakeups.
-    pthread_mutex_lock(&cv->internal_mutex);
-    int my_gen = cv->generation;
-    // Release the write lock before waiting
-    pthread_rwlock_unlock((pthread_rwlock_t*)shared_mutex);
-    // Wait on internal cond+mutex until generation changes
-    while (my_gen == cv->generation) {
-        pthread_cond_wait(&cv->cond, &cv->internal_mutex);
+void __koral_cond_word_wait(int32_t* cond, int32_t* waiters, int32_t* mutex_word) {
+    int32_t seq = __koral_cond_word_prepare(cond, waiters);
+    __koral_lock_word_unlock(mutex_word);
+    __koral_futex_wait(cond, seq);
+    __koral_atomic_fetch_add_i32(waiters, -1);
+    // Other waiters may be queued behind us, so relock as contended.
+    while (__koral_atomic_swap_i32(mutex_word, 2) != 0) {
+        __koral_futex_wait(mutex_word, 2);
     }
-    pthread_mutex_unlock(&cv->internal_mutex);
-    // Re-acquire the write lock
-    pthread_rwlock_wrlock((pthread_rwlock_t*)shared_mutex);
+    KORAL_RC_LOCK_ACQUIRED();
 }
 
-#endif
+void __koral_cond_word_wait_write(int32_t* cond, int32_t* waiters, int32_t* rw_word) {
+    int32_t seq = __koral_cond_word_prepare(cond, waiters);
+    __koral_rw_word_write_unlock(rw_word);
+    __koral_futex_wait(cond, seq);
+    __koral_atomic_fetch_add_i32(waiters, -1);
+    __koral_rw_word_write_lock(rw_word);
+}
 
+void __koral_cond_word_signal(int32_t* cond, int32_t* waiters) {
+    __koral_atomic_fetch_add_i32(cond, 1);
+    if (__koral_atomic_load_i32(waiters) > 0) {
+        __koral_futex_wake(cond, 1);
+    }
+}
+
+void __koral_cond_word_broadcast(int32_t* cond, int32_t* waiters) {
+    __koral_atomic_fetch_add_i32(cond, 1);
+    if (__koral_atomic_load_i32(waiters) > 0) {
+        __koral_futex_wake(cond, INT32_MAX);
+    }
+}
 
 // ============================================================================
 // Atomic Operations
 // ============================================================================
 
-// --- i32 atomics (used by AtomicBool) ---
+// --- i32 atomics (used by AtomicBool and channel wait words) ---
 
 #if defined(_WIN32) || defined(_WIN64)
 
@@ -3578,6 +7572,10 @@ int32_t __koral_atomic_cas_i32(int32_t* ptr, int32_t expected, int32_t desired)
     return old == (LONG)expected ? 1 : 0;
 }
 
+int32_t __koral_atomic_fetch_add_i32(int32_t* ptr, int32_t delta) {
+    return (int32_t)InterlockedExchangeAdd((volatile LONG*)ptr, (LONG)delta);
+}
+
 #else
 
 int32_t __koral_atomic_load_i32(int32_t* ptr) {
@@ -3597,6 +7595,10 @@ int32_t __koral_atomic_cas_i32(int32_t* ptr, int32_t expected, int32_t desired)
                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST) ? 1 : 0;
 }
 
+int32_t __koral_atomic_fetch_add_i32(int32_t* ptr, int32_t delta) {
+    return __atomic_fetch_add(ptr, delta, __ATOMIC_SEQ_CST);
+}
+
 #endif
 
 // --- intptr_t atomics (used by AtomicInt) ---
@@ -3974,6 +7976,34 @@ int64_t __koral_socket_send(int64_t fd, uint8_t* buf, uint64_t len, int32_t flag
     return (int64_t)n;
 }
 
+// Sends up to `count` bytes of `file_fd` starting at `offset` without
+// moving the file offset. Returns the bytes sent (possibly fewer), or -1.
+int64_t __koral_socket_sendfile(int64_t fd, int32_t file_fd, uint64_t offset, uint64_t count) {
+    uint8_t buf[65536];
+    HANDLE h = (HANDLE)_get_osfhandle(file_fd);
+    if (h == INVALID_HANDLE_VALUE) { errno = EBADF; return -1; }
+    OVERLAPPED ov = {0};
+    ov.Offset = (DWORD)(offset & 0xffffffffu);
+    ov.OffsetHigh = (DWORD)(offset >> 32);
+    DWORD want = count < sizeof(buf) ? (DWORD)count : (DWORD)sizeof(buf);
+    DWORD got = 0;
+    if (!ReadFile(h, buf, want, &got, &ov)) {
+        if (GetLastError() == ERROR_HANDLE_EOF) return 0;
+        errno = EIO;
+        return -1;
+    }
+    DWORD sent = 0;
+    while (sent < got) {
+        int n = send((SOCKET)fd, (const char*)buf + sent, (int)(got - sent), 0);
+        if (n == SOCKET_ERROR) {
+            errno = WSAGetLastError();
+            return sent > 0 ? (int64_t)sent : -1;
+        }
+        sent += (DWORD)n;
+    }
+    return (int64_t)sent;
+}
+
 int64_t __koral_socket_recv(int64_t fd, uint8_t* buf, uint64_t len, int32_t flags) {
     int n = recv((SOCKET)fd, (char*)buf, (int)len, flags);
     if (n == SOCKET_ERROR) {
@@ -4058,6 +8088,9 @@ int32_t __koral_socket_getpeername(int64_t fd, uint8_t* addr_out, uint32_t* addr
 #else  // POSIX
 
 #include <sys/socket.h>
+#if defined(__APPLE__)
+#include <sys/uio.h>
+#endif
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
@@ -4194,6 +8227,7 @@ int64_t __koral_socket_create(int32_t domain, int32_t type, int32_t protocol) {
 }
 
 int32_t __koral_socket_close(int64_t fd) {
+    __koral_green_forget_fd((int)fd);
     return close((int)fd) == 0 ? 0 : -1;
 }
 
@@ -4213,7 +8247,13 @@ int32_t __koral_socket_listen(int64_t fd, int32_t backlog) {
 int64_t __koral_socket_accept(int64_t fd, uint8_t* addr_out, uint32_t* addr_len_out) {
     struct sockaddr_storage native_addr;
     socklen_t alen = (socklen_t)sizeof(native_addr);
-    int s = accept((int)fd, (struct sockaddr*)&native_addr, &alen);
+    int64_t deadline_ns = KORAL_GREEN_DEADLINE_UNSET;
+    int s;
+    __koral_green_prepare_fd((int)fd);
+    do {
+        alen = (socklen_t)sizeof(native_addr);
+        s = accept((int)fd, (struct sockaddr*)&native_addr, &alen);
+    } while (s < 0 && __koral_green_retry_fd((int)fd, 0, &deadline_ns));
     if (s < 0) return -1;
     if (addr_out && addr_len_out) {
         uint32_t cap = *addr_len_out;
@@ -4232,16 +8272,72 @@ int32_t __koral_socket_connect(int64_t fd, uint8_t* addr, uint32_t addr_len) {
     if (__koral_decode_sockaddr_portable(addr, addr_len, &native_addr, &native_len) != 0) {
         return -1;
     }
-    return connect((int)fd, (const struct sockaddr*)&native_addr, native_len) == 0 ? 0 : -1;
+    __koral_green_prepare_fd((int)fd);
+    if (connect((int)fd, (const struct sockaddr*)&native_addr, native_len) == 0) {
+        return 0;
+    }
+    return __koral_green_finish_connect((int)fd) == 0 ? 0 : -1;
 }
 
 int64_t __koral_socket_send(int64_t fd, uint8_t* buf, uint64_t len, int32_t flags) {
-    ssize_t n = send((int)fd, buf, (size_t)len, flags);
+    int64_t deadline_ns = KORAL_GREEN_DEADLINE_UNSET;
+    ssize_t n;
+    __koral_green_prepare_fd((int)fd);
+    do {
+        n = send((int)fd, buf, (size_t)len, flags);
+    } while (n < 0 && __koral_green_retry_fd((int)fd, 1, &deadline_ns));
     return (int64_t)n;
 }
 
+// Sends up to `count` bytes of `file_fd` starting at `offset` without
+// moving the file offset. Linux and macOS hand the pages to the socket in
+// the kernel; elsewhere one pread buffer is sent. Returns the bytes sent
+// (possibly fewer), or -1.
+int64_t __koral_socket_sendfile(int64_t fd, int32_t file_fd, uint64_t offset, uint64_t count) {
+    int64_t deadline_ns = KORAL_GREEN_DEADLINE_UNSET;
+    __koral_green_prepare_fd((int)fd);
+#if defined(__linux__)
+    size_t want = count < KORAL_COPY_CHUNK ? (size_t)count : KORAL_COPY_CHUNK;
+    ssize_t n;
+    do {
+        off_t off = (off_t)offset;
+        n = sendfile((int)fd, file_fd, &off, want);
+    } while (n < 0 && __koral_green_retry_fd((int)fd, 1, &deadline_ns));
+    if (n >= 0 || (errno != EINVAL && errno != ENOSYS)) return (int64_t)n;
+#elif defined(__APPLE__)
+    int r;
+    off_t len;
+    do {
+        len = (off_t)(count < KORAL_COPY_CHUNK ? count : KORAL_COPY_CHUNK);
+        r = sendfile(file_fd, (int)fd, (off_t)offset, &len, NULL, 0);
+        if (r < 0 && len > 0) return (int64_t)len;  // partial send before EAGAIN
+    } while (r < 0 && __koral_green_retry_fd((int)fd, 1, &deadline_ns));
+    if (r == 0) return (int64_t)len;
+    if (errno != ENOTSUP && errno != ENOTSOCK && errno != EINVAL) return -1;
+#endif
+    uint8_t buf[65536];
+    size_t chunk = count < sizeof(buf) ? (size_t)count : sizeof(buf);
+    ssize_t got = pread(file_fd, buf, chunk, (off_t)offset);
+    if (got <= 0) return (int64_t)got;
+    size_t sent = 0;
+    while (sent < (size_t)got) {
+        ssize_t w = send((int)fd, buf + sent, (size_t)got - sent, 0);
+        if (w < 0) {
+            if (__koral_green_retry_fd((int)fd, 1, &deadline_ns)) continue;
+            return sent > 0 ? (int64_t)sent : -1;
+        }
+        sent += (size_t)w;
+    }
+    return (int64_t)sent;
+}
+
 int64_t __koral_socket_recv(int64_t fd, uint8_t* buf, uint64_t len, int32_t flags) {
-    ssize_t n = recv((int)fd, buf, (size_t)len, flags);
+    int64_t deadline_ns = KORAL_GREEN_DEADLINE_UNSET;
+    ssize_t n;
+    __koral_green_prepare_fd((int)fd);
+    do {
+        n = recv((int)fd, buf, (size_t)len, flags);
+    } while (n < 0 && __koral_green_retry_fd((int)fd, 0, &deadline_ns));
     return (int64_t)n;
 }
 
@@ -4252,8 +8348,13 @@ int64_t __koral_socket_sendto(int64_t fd, uint8_t* buf, uint64_t len,
     if (__koral_decode_sockaddr_portable(addr, addr_len, &native_addr, &native_len) != 0) {
         return -1;
     }
-    ssize_t n = sendto((int)fd, buf, (size_t)len, flags,
-                       (const struct sockaddr*)&native_addr, native_len);
+    int64_t deadline_ns = KORAL_GREEN_DEADLINE_UNSET;
+    ssize_t n;
+    __koral_green_prepare_fd((int)fd);
+    do {
+        n = sendto((int)fd, buf, (size_t)len, flags,
+                   (const struct sockaddr*)&native_addr, native_len);
+    } while (n < 0 && __koral_green_retry_fd((int)fd, 1, &deadline_ns));
     return (int64_t)n;
 }
 
@@ -4261,8 +8362,14 @@ int64_t __koral_socket_recvfrom(int64_t fd, uint8_t* buf, uint64_t len,
                               int32_t flags, uint8_t* addr_out, uint32_t* addr_len_out) {
     struct sockaddr_storage native_addr;
     socklen_t alen = (socklen_t)sizeof(native_addr);
-    ssize_t n = recvfrom((int)fd, buf, (size_t)len, flags,
-                         (struct sockaddr*)&native_addr, &alen);
+    int64_t deadline_ns = KORAL_GREEN_DEADLINE_UNSET;
+    ssize_t n;
+    __koral_green_prepare_fd((int)fd);
+    do {
+        alen = (socklen_t)sizeof(native_addr);
+        n = recvfrom((int)fd, buf, (size_t)len, flags,
+                     (struct sockaddr*)&native_addr, &alen);
+    } while (n < 0 && __koral_green_retry_fd((int)fd, 0, &deadline_ns));
     if (n >= 0 && addr_out && addr_len_out) {
         uint32_t cap = *addr_len_out;
         if (__koral_encode_sockaddr_portable((const struct sockaddr*)&native_addr, alen, addr_out, &cap) != 0) {
@@ -1,9 +1,26 @@
 #ifndef KORAL_RUNTIME_H
 #define KORAL_RUNTIME_H
 
-#define KORAL_RUNTIME_ABI_VERSION 6
+#define KORAL_RUNTIME_ABI_VERSION 9
+
+// Biased reference counting (opt-in, -DKORAL_RC_BIASED=1 or koralc
+// --biased-rc): a box is owned by the thread that allocated it, which updates
+// `local_count` with plain loads/stores; other threads use the atomic
+// `strong_count`. The default keeps the plain layout where every
+// retain/release is an atomic RMW. The runtime and the generated C must be
+// compiled with the same setting.
+#ifndef KORAL_RC_BIASED
+#define KORAL_RC_BIASED 0
+#endif
+
+// Size-class pool for box allocations (see __koral_box_alloc). Set to 0 to
+// fall back to malloc/free, e.g. under sanitizers.
+#ifndef KORAL_BOX_POOL
+#define KORAL_BOX_POOL 1
+#endif
 
 #include <stdatomic.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <limits.h>
 
@@ -40,37 +57,103 @@ struct __koral_Closure {
 };
 
 // Merged layout convention: the control block and payload are allocated as one
-// contiguous block via a single malloc(sizeof(Control) + sizeof(T)).
+// contiguous block via a single __koral_box_alloc(sizeof(Control) + sizeof(T)).
 // Memory: [ __koral_Control | payload data ... ]
 //          ^                 ^
 //          control           control->ptr  (points to payload right after)
 // Sub-refs created via make_ref/make_mut_ref share the same control block
 // but have their own ptr pointing into the owner's payload.
+//
+// Biased layout: with KORAL_RC_BIASED, strong_count is the *shared* counter
+// encoded as (count << KORAL_RC_SHARED_SHIFT) | flags, and may go negative
+// while the owner thread still holds local references. Generated code must not
+// touch the counters directly; use __koral_control_init and the query helpers.
 struct __koral_Control {
     _Atomic int strong_count;
     _Atomic int weak_count;
     __koral_Dtor dtor;
     void* ptr;  // points to the payload (may be inside a merged allocation)
+#if KORAL_RC_BIASED
+    _Atomic uintptr_t owner;   // owning thread token; 0 once merged/shared
+    _Atomic int local_count;   // owner-only counter (plain load/store, no RMW)
+#endif
 };
 
+#if KORAL_RC_BIASED
+#define KORAL_RC_SHARED_SHIFT 2
+#define KORAL_RC_SHARED_ONE (1 << KORAL_RC_SHARED_SHIFT)
+#define KORAL_RC_FLAG_MERGED 0x1
+#define KORAL_RC_FLAG_QUEUED 0x2
+#endif
+
 void __koral_set_args(int32_t argc, uint8_t** argv);
 void __koral_panic_float_cast_overflow(void);
 
 int32_t __koral_spawn_thread(uint8_t** out_handle, uint64_t* out_tid,
                              struct __koral_Closure closure, uint64_t stack_size);
+int32_t __koral_spawn_thread_configured(uint8_t** out_handle, uint64_t* out_tid, void* job,
+                                        uint64_t stack_size, const uintptr_t* cpus, uintptr_t cpu_count,
+                                        int32_t policy, int32_t priority, intptr_t numa_node);
 int32_t __koral_thread_join(uint8_t* handle);
 void __koral_thread_detach(uint8_t* handle);
 uint64_t __koral_thread_current_id(void);
 void __koral_thread_yield(void);
 uint32_t __koral_hardware_concurrency(void);
+uintptr_t __koral_thread_current_cpus(uintptr_t* out, uintptr_t capacity);
+
+// Allocation for merged control+payload blocks. Blocks are released by
+// __koral_weak_release when the last weak reference goes away.
+void* __koral_box_alloc(size_t size);
+void __koral_box_free(void* block);
+uintptr_t __koral_box_slab_count(void);
+
+void __koral_retain_control(void* raw_control);
+void __koral_release_control(void* raw_control);
+
+// A NULL control marks an immortal object such as a static string literal.
+// The check is inline so retaining or releasing one is a compare, not a call.
+static inline void __koral_retain(void* raw_control) {
+    if (raw_control) __koral_retain_control(raw_control);
+}
+
+static inline void __koral_release(void* raw_control) {
+    if (raw_control) __koral_release_control(raw_control);
+}
 
-void __koral_retain(void* raw_control);
-void __koral_release(void* raw_control);
 void __koral_weak_retain(void* raw_control);
 void __koral_weak_release(void* raw_control);
 void __koral_ref_drop(void* raw_ref);
 void __koral_weakref_drop(void* raw_weak_ref);
 
+#if KORAL_RC_BIASED
+
+void __koral_control_init(void* raw_control);
+int __koral_control_is_unique(void* raw_control);
+uintptr_t __koral_control_strong_count(void* raw_control);
+
+#else
+
+// Plain counters: initialising and querying a box are single loads and
+// stores, kept inline so generated code does not pay a call for them.
+static inline void __koral_control_init(void* raw_control) {
+    struct __koral_Control* control = (struct __koral_Control*)raw_control;
+    atomic_init(&control->strong_count, 1);
+    atomic_init(&control->weak_count, 1);
+}
+
+static inline int __koral_control_is_unique(void* raw_control) {
+    struct __koral_Control* control = (struct __koral_Control*)raw_control;
+    return atomic_load(&control->strong_count) == 1;
+}
+
+static inline uintptr_t __koral_control_strong_count(void* raw_control) {
+    struct __koral_Control* control = (struct __koral_Control*)raw_control;
+    int count = atomic_load(&control->strong_count);
+    return count > 0 ? (uintptr_t)count : 0;
+}
+
+#endif
+
 struct __koral_WeakRef __koral_downgrade_ref(struct __koral_Ref r);
 struct __koral_Ref __koral_upgrade_ref(struct __koral_WeakRef w, int* success);
 
@@ -514,4 +597,94 @@ KORAL_DEFINE_WRAPPING_UNSIGNED_SHR(uint64_t, u64, 63)
 KORAL_DEFINE_WRAPPING_UNSIGNED_SHL(uintptr_t, usize, (uintptr_t)(sizeof(uintptr_t) * 8 - 1))
 KORAL_DEFINE_WRAPPING_UNSIGNED_SHR(uintptr_t, usize, (uintptr_t)(sizeof(uintptr_t) * 8 - 1))
 
+// ============================================================================
+// Hash table control groups (std Dict / Set)
+// ============================================================================
+//
+// Dict and Set keep one control byte per slot beside the slot array:
+// 0x80 = empty, 0xFE = deleted, 0x00..0x7F = full, holding 7 bits of the
+// slot's hash. Lookups compare a whole 16-byte group at once; each match
+// function returns a mask with bit i set when byte i of the group matches.
+// They are inline so a probe in generated code does not pay a call per group.
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define KORAL_GROUP_SSE2 1
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define KORAL_GROUP_NEON 1
+#endif
+
+#define KORAL_GROUP_WIDTH 16
+
+#if KORAL_GROUP_NEON
+static inline uint32_t __koral_group_movemask(uint8x16_t eq) {
+    static const uint8_t weights[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x16_t bits = vandq_u8(eq, vld1q_u8(weights));
+    return (uint32_t)vaddv_u8(vget_low_u8(bits)) | ((uint32_t)vaddv_u8(vget_high_u8(bits)) << 8);
+}
+#endif
+
+// Bytes equal to `h2`: candidate slots for a key with those hash bits.
+static inline uint32_t __koral_group_match(uint8_t* group, uint8_t h2) {
+#if KORAL_GROUP_SSE2
+    __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)h2)));
+#elif KORAL_GROUP_NEON
+    return __koral_group_movemask(vceqq_u8(vld1q_u8(group), vdupq_n_u8(h2)));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < KORAL_GROUP_WIDTH; i++) {
+        mask |= (uint32_t)(group[i] == h2) << i;
+    }
+    return mask;
+#endif
+}
+
+// Empty bytes. A group with one of these ends every probe sequence.
+static inline uint32_t __koral_group_match_empty(uint8_t* group) {
+    return __koral_group_match(group, 0x80);
+}
+
+// Empty or deleted bytes (high bit set): slots an insert may take.
+static inline uint32_t __koral_group_match_free(uint8_t* group) {
+#if KORAL_GROUP_SSE2
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+#elif KORAL_GROUP_NEON
+    return __koral_group_movemask(vcltzq_s8(vreinterpretq_s8_u8(vld1q_u8(group))));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < KORAL_GROUP_WIDTH; i++) {
+        mask |= (uint32_t)(group[i] >> 7) << i;
+    }
+    return mask;
+#endif
+}
+
+// Index of the lowest set bit of a non-zero mask.
+static inline uint32_t __koral_group_lowest(uint32_t mask) {
+#if defined(__GNUC__) || defined(__clang__)
+    return (uint32_t)__builtin_ctz(mask);
+#else
+    uint32_t index = 0;
+    while ((mask & 1) == 0) {
+        mask >>= 1;
+        index++;
+    }
+    return index;
+#endif
+}
+
+// Spreads a key hash over all bits, so that both the 7 control bits and the
+// group index are usable even for identity hashes such as Int's.
+static inline uintptr_t __koral_hash_mix(uintptr_t h) {
+#if UINTPTR_MAX > 0xFFFFFFFFu
+    uint64_t x = (uint64_t)h * 0x9E3779B97F4A7C15ull;
+    return (uintptr_t)(x ^ (x >> 32));
+#else
+    uint32_t x = (uint32_t)h * 0x9E3779B9u;
+    return (uintptr_t)(x ^ (x >> 16));
+#endif
+}
+
 #endif // KORAL_RUNTIME_H